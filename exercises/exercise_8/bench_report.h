@@ -0,0 +1,356 @@
+#ifndef BENCH_REPORT_H
+#define BENCH_REPORT_H
+
+#include <glad/glad.h>
+
+#include <profiler.h>
+#include <gl_stats.h>
+#include <program_cache.h>
+#include <shader_compiler.h>
+#include <shader_variants.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+// What --bench runs, parsed from the command line:
+//   --bench [--frames N] [--warmup N] [--size WIDTHxHEIGHT] [--report FILE]
+//   --path NAME|FILE plays a standard camera path or a recorded one, --record FILE records the run (see camera_path.h),
+//   both also work without --bench
+//   --gl-debug asks for a debug context and collects its KHR_debug performance messages (see gl_stats.h)
+//   --capture FILE [--capture-frames N] [--capture-after N] records the GL calls for replay/gl_replay.cpp (see
+//   gl_capture.h), the replayed frames start after the given number of frames, with the first measured frame of
+//   --bench, or else from the settings panel
+//   --no-program-cache compiles every shader from its sources instead of loading cached binaries (see program_cache.h)
+//   --shader-compile sync|parallel|thread picks how shaders are compiled (see shader_compiler.h), by default the
+//   parallel extension if the driver has it and else the worker thread. --bench waits for all of them before the
+//   first frame
+//   --no-hot-reload does not watch the shader and asset folders for changes (see hot_reload.h), --bench never does
+//   --validate checks the CPU code against what it must produce on a synthetic scene, without opening a window, and
+//   exits with 1 when something does not match (see validation.h)
+// Without a display, build with -DGLFW_USE_OSMESA=ON, GLFW then creates its contexts through OSMesa
+// (osmesa_context.c on top of the null_* platform) instead of a window system.
+struct BenchOptions
+{
+    bool enabled = false;
+    int frames = 300;           // measured frames
+    int warmupFrames = 30;      // rendered first and left out of the report
+    int width = 1280, height = 720;
+    std::string reportPath = "bench_report.json";
+    std::string cameraPath;     // played from the first frame, empty for none
+    std::string recordPath;     // where the camera path of the run is saved at exit, empty for none
+    bool glDebug = false;
+    std::string capturePath;    // GL capture, empty for none
+    int captureFrames = 1;
+    int captureAfter = -1;      // frames before the captured ones, negative when they are started by hand
+    bool programCache = true;
+    ShaderCompiler::Mode shaderCompile = ShaderCompiler::AUTOMATIC;
+    bool hotReload = true;
+    bool validate = false;
+
+    // false with a message when the arguments make no sense
+    bool parse(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+            if (!strcmp(argv[i], "--bench"))
+                enabled = true;
+            else if (!strcmp(argv[i], "--frames") && value && (frames = atoi(value)) > 0)
+                i++;
+            else if (!strcmp(argv[i], "--warmup") && value && (warmupFrames = atoi(value)) >= 0)
+                i++;
+            else if (!strcmp(argv[i], "--size") && value && sscanf(value, "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+                i++;
+            else if (!strcmp(argv[i], "--report") && value)
+                reportPath = argv[++i];
+            else if (!strcmp(argv[i], "--path") && value)
+                cameraPath = argv[++i];
+            else if (!strcmp(argv[i], "--record") && value)
+                recordPath = argv[++i];
+            else if (!strcmp(argv[i], "--gl-debug"))
+                glDebug = true;
+            else if (!strcmp(argv[i], "--capture") && value)
+                capturePath = argv[++i];
+            else if (!strcmp(argv[i], "--capture-frames") && value && (captureFrames = atoi(value)) > 0)
+                i++;
+            else if (!strcmp(argv[i], "--capture-after") && value && (captureAfter = atoi(value)) >= 0)
+                i++;
+            else if (!strcmp(argv[i], "--no-program-cache"))
+                programCache = false;
+            else if (!strcmp(argv[i], "--shader-compile") && value && parseShaderCompile(value))
+                i++;
+            else if (!strcmp(argv[i], "--no-hot-reload"))
+                hotReload = false;
+            else if (!strcmp(argv[i], "--validate"))
+                validate = true;
+            else
+            {
+                std::cout << "Unknown or invalid argument " << argv[i] << std::endl
+                          << "Usage: " << argv[0] << " [--bench [--frames N] [--warmup N] [--size WIDTHxHEIGHT] [--report FILE]] [--path NAME|FILE] [--record FILE] [--gl-debug]"
+                          << " [--capture FILE [--capture-frames N] [--capture-after N]] [--no-program-cache] [--shader-compile sync|parallel|thread]"
+                          << " [--no-hot-reload] [--validate]" << std::endl;
+                return false;
+            }
+        }
+        if (enabled && captureAfter < 0)
+            captureAfter = warmupFrames;
+        return true;
+    }
+
+    bool parseShaderCompile(const char* value)
+    {
+        static const std::pair<const char*, ShaderCompiler::Mode> modes[] = {
+            { "sync", ShaderCompiler::SYNCHRONOUS }, { "parallel", ShaderCompiler::PARALLEL_EXTENSION },
+            { "thread", ShaderCompiler::WORKER_THREAD }, { "auto", ShaderCompiler::AUTOMATIC }
+        };
+        for (const auto& mode : modes)
+            if (!strcmp(value, mode.first))
+            {
+                shaderCompile = mode.second;
+                return true;
+            }
+        return false;
+    }
+};
+
+// Collects what a --bench run measures and writes it as JSON: how long each startup stage took (with the program cache
+// hits and misses of the shaders and the compile time of every PBR variant), the CPU and GPU
+// times of every profiler pass, frame time percentiles, the GL calls per frame and per pass by category (gl_stats.h)
+// and the peak memory of the process.
+class BenchReport
+{
+public:
+    explicit BenchReport(const BenchOptions& options) : options(options)
+    {
+        lastStage = Clock::now();
+    }
+
+    // the time since the previous stage ended, or since the report was created
+    void startupStage(const char* name)
+    {
+        Clock::time_point now = Clock::now();
+        startupStages.push_back({ name, std::chrono::duration<float, std::milli>(now - lastStage).count() });
+        lastStage = now;
+    }
+
+    // cpuMs covers the whole frame up to the swap, GPU times come from what the profiler read back since the last call,
+    // GL calls from the frame glStats ended last
+    void endFrame(float cpuMs, const Profiler& profiler, const GlStats& glStats)
+    {
+        frameCpuMs.push_back(cpuMs);
+        const GlStats::Counts& frame = glStats.frame();
+        for (int category = 0; category < GlStats::CATEGORY_COUNT; category++)
+        {
+            glCalls[category].push_back((float)frame.calls[category]);
+            redundantGlCalls[category].push_back((float)frame.redundant[category]);
+        }
+        glCalls[GlStats::CATEGORY_COUNT].push_back((float)frame.totalCalls());
+        redundantGlCalls[GlStats::CATEGORY_COUNT].push_back((float)frame.totalRedundant());
+        uploadMB.push_back(frame.uploadBytes / 1048576.0f);
+        for (const GlStats::Pass& glPass : glStats.passes())
+        {
+            Pass& pass = passes[passIndex(glPass.name)];
+            pass.glCalls.push_back((float)glPass.counts.totalCalls());
+            pass.redundantGlCalls.push_back((float)glPass.counts.totalRedundant());
+        }
+        debugMessages = glStats.debugMessages();
+
+        // the profiler reads frames back FRAME_COUNT frames later, the first ones are still from the warmup
+        int newFrames = std::min(profiler.readBackFrames - readBackFrames, (int)Profiler::HISTORY);
+        readBackFrames = profiler.readBackFrames;
+        if ((int)frameCpuMs.size() <= Profiler::FRAME_COUNT)
+            return;
+        for (int ago = newFrames - 1; ago >= 0; ago--)
+        {
+            int index = profiler.historyIndex(ago);
+            frameGpuMs.push_back(profiler.frameGpuHistory[index]);
+            for (const Profiler::Scope& scope : profiler.scopes())
+            {
+                Pass& pass = passes[passIndex(scope.name)];
+                if (scope.gpuHistory[index] >= 0.0f)
+                {
+                    pass.gpuMs.push_back(scope.gpuHistory[index]);
+                    pass.cpuMs.push_back(scope.cpuHistory[index]);
+                }
+            }
+        }
+    }
+
+    bool write(int droppedGpuFrames, const ShaderVariants& pbrVariants) const
+    {
+        FILE* file = fopen(options.reportPath.c_str(), "w");
+        if (!file)
+        {
+            std::cout << "Benchmark: could not write " << options.reportPath << std::endl;
+            return false;
+        }
+        fprintf(file, "{\n");
+        fprintf(file, "  \"renderer\": \"%s\",\n", escape((const char*)glGetString(GL_RENDERER)).c_str());
+        fprintf(file, "  \"version\": \"%s\",\n", escape((const char*)glGetString(GL_VERSION)).c_str());
+        fprintf(file, "  \"width\": %d, \"height\": %d, \"frames\": %d, \"warmupFrames\": %d,\n",
+                options.width, options.height, (int)frameCpuMs.size(), options.warmupFrames);
+        fprintf(file, "  \"cameraPath\": \"%s\",\n", escape(options.cameraPath.c_str()).c_str());
+
+        float startupTotal = 0.0f;
+        fprintf(file, "  \"startupMs\": {");
+        for (size_t i = 0; i < startupStages.size(); i++)
+        {
+            fprintf(file, "%s\"%s\": %.3f", i ? ", " : " ", startupStages[i].name, startupStages[i].ms);
+            startupTotal += startupStages[i].ms;
+        }
+        fprintf(file, ", \"total\": %.3f },\n", startupTotal);
+        const ProgramCache::Stats& cache = ProgramCache::stats();
+        fprintf(file, "  \"programCache\": { \"hits\": %d, \"misses\": %d, \"rejected\": %d, \"loadMs\": %.3f, \"compileMs\": %.3f, \"savedMs\": %.3f },\n",
+                cache.hits, cache.misses, cache.rejected, cache.loadMs, cache.compileMs, cache.savedMs);
+        ShaderVariants::Stats variants = pbrVariants.stats();
+        fprintf(file, "  \"pbrVariants\": { \"count\": %d, \"cached\": %d, \"compileMs\": %.3f, \"variants\": {",
+                variants.variants, variants.cached, variants.compileMs);
+        int variantIndex = 0;
+        pbrVariants.forEach([&](uint32_t key, const Shader& variant) {
+            fprintf(file, "%s\n    \"%s\": %.3f", variantIndex++ ? "," : "", pbrVariants.keyName(key).c_str(), variant.compileMs);
+        });
+        fprintf(file, "\n  } },\n");
+
+        fprintf(file, "  \"frameCpuMs\": %s,\n", summary(frameCpuMs).c_str());
+        fprintf(file, "  \"frameGpuMs\": %s,\n", summary(frameGpuMs).c_str());
+        fprintf(file, "  \"droppedGpuFrames\": %d,\n", droppedGpuFrames);
+        fprintf(file, "  \"drawCalls\": %s,\n", summary(glCalls[GlStats::DRAW]).c_str());
+        fprintf(file, "  \"dispatches\": %s,\n", summary(glCalls[GlStats::DISPATCH]).c_str());
+        writeCategories(file, "glCalls", glCalls);
+        writeCategories(file, "redundantGlCalls", redundantGlCalls);
+        fprintf(file, "  \"uploadMB\": %s,\n", summary(uploadMB).c_str());
+        fprintf(file, "  \"glDebugMessages\": [");
+        for (size_t i = 0; i < debugMessages.size(); i++)
+            fprintf(file, "%s\n    { \"id\": %u, \"count\": %d, \"text\": \"%s\" }", i ? "," : "", debugMessages[i].id,
+                    debugMessages[i].count, escape(debugMessages[i].text.c_str()).c_str());
+        fprintf(file, "%s],\n", debugMessages.empty() ? "" : "\n  ");
+        fprintf(file, "  \"passes\": {");
+        for (size_t i = 0; i < passes.size(); i++)
+            fprintf(file, "%s\n    \"%s\": { \"gpuMs\": %s, \"cpuMs\": %s, \"glCalls\": %s, \"redundantGlCalls\": %s }",
+                    i ? "," : "", passes[i].name.c_str(), summary(passes[i].gpuMs).c_str(), summary(passes[i].cpuMs).c_str(),
+                    summary(passes[i].glCalls).c_str(), summary(passes[i].redundantGlCalls).c_str());
+        fprintf(file, "\n  },\n");
+        fprintf(file, "  \"peakMemoryMB\": %.1f\n", peakMemoryMB());
+        fprintf(file, "}\n");
+        fclose(file);
+
+        std::cout << "Benchmark: " << frameCpuMs.size() << " frames, " << summary(frameCpuMs) << " ms CPU per frame, written to "
+                  << options.reportPath << std::endl;
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Stage
+    {
+        const char* name;
+        float ms;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        std::vector<float> gpuMs, cpuMs;
+        std::vector<float> glCalls, redundantGlCalls;
+    };
+
+    const BenchOptions& options;
+    Clock::time_point lastStage;
+    std::vector<Stage> startupStages;
+    std::vector<float> frameCpuMs, frameGpuMs, uploadMB;
+    std::vector<float> glCalls[GlStats::CATEGORY_COUNT + 1], redundantGlCalls[GlStats::CATEGORY_COUNT + 1];  // the total last
+    std::vector<GlStats::DebugMessage> debugMessages;
+    std::vector<Pass> passes;
+    int readBackFrames = 0;
+
+    int passIndex(const std::string& name)
+    {
+        for (size_t i = 0; i < passes.size(); i++)
+            if (passes[i].name == name)
+                return (int)i;
+        passes.push_back({ name, {}, {}, {}, {} });
+        return (int)passes.size() - 1;
+    }
+
+    // one summary per category and the total, as a JSON object
+    static void writeCategories(FILE* file, const char* name, const std::vector<float>* values)
+    {
+        fprintf(file, "  \"%s\": { \"total\": %s", name, summary(values[GlStats::CATEGORY_COUNT]).c_str());
+        for (int category = 0; category < GlStats::CATEGORY_COUNT; category++)
+            fprintf(file, ",\n    \"%s\": %s", GlStats::categoryName(category), summary(values[category]).c_str());
+        fprintf(file, " },\n");
+    }
+
+    // mean, percentiles and extremes as a JSON object
+    static std::string summary(std::vector<float> values)
+    {
+        if (values.empty())
+            return "null";
+        std::sort(values.begin(), values.end());
+        float sum = 0.0f;
+        for (float value : values)
+            sum += value;
+        auto percentile = [&values](float fraction) {
+            return values[std::min((size_t)(fraction * values.size()), values.size() - 1)];
+        };
+        char text[256];
+        snprintf(text, sizeof(text), "{ \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"min\": %.3f, \"max\": %.3f }",
+                 sum / values.size(), percentile(0.5f), percentile(0.95f), percentile(0.99f), values.front(), values.back());
+        return text;
+    }
+
+    // a JSON string body, driver messages can hold line breaks and other control characters
+    static std::string escape(const char* text)
+    {
+        std::string escaped;
+        for (; text && *text; text++)
+        {
+            unsigned char c = (unsigned char)*text;
+            if (c == '"' || c == '\\')
+                escaped += std::string("\\") + *text;
+            else if (c == '\n')
+                escaped += "\\n";
+            else if (c == '\r')
+                escaped += "\\r";
+            else if (c == '\t')
+                escaped += "\\t";
+            else if (c < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", c);
+                escaped += code;
+            }
+            else
+                escaped += *text;
+        }
+        return escaped;
+    }
+
+    // peak resident set size of the process, 0 where it is not available
+    static float peakMemoryMB()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1048576.0f;    // bytes
+#else
+        return usage.ru_maxrss / 1024.0f;       // kilobytes
+#endif
+#else
+        return 0.0f;
+#endif
+    }
+};
+
+#endif
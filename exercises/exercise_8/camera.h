@@ -103,6 +103,14 @@ public:
         updateCameraVectors();
     }
 
+    // Sets the Euler Angles directly, for when the camera follows something else than the input (e.g. a recorded path)
+    void SetOrientation(float yaw, float pitch)
+    {
+        Yaw = yaw;
+        Pitch = pitch;
+        updateCameraVectors();
+    }
+
     // Processes input received from a mouse scroll-wheel event. Only requires input on the vertical wheel-axis
     void ProcessMouseScroll(float yoffset)
     {
@@ -0,0 +1,435 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <camera.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+
+// A camera pose per tick plus the settings that changed on the way, for runs that have to see the same views.
+// Keys are tickSeconds apart and played back through a Catmull-Rom spline, so a path recorded at a low tick
+// rate still moves smoothly and the same time always gives the same pose, whatever the frame rate.
+// Settings are stored by name, a file keeps working when settings are added or reordered.
+//
+// File layout, little endian:
+//   "RCAM", uint32 version, float tickSeconds, uint32 flags (1 closed), uint32 keys, uint32 settings, uint32 events
+//   per setting: uint8 length, name
+//   per key:     float position[3], yaw, pitch, zoom
+//   per event:   uint32 tick, uint32 setting, 4 bytes value (int32, 0/1 or float as the setting is)
+class CameraPath
+{
+public:
+    struct Key
+    {
+        glm::vec3 position;
+        float yaw, pitch, zoom;
+    };
+
+    // a value of the app that a path can change, see CameraPathRecorder and CameraPathPlayer
+    struct Setting
+    {
+        enum Type { INT, BOOL, FLOAT };
+        const char* name;
+        Type type;
+        void* value;
+
+        Setting(const char* name, int* value) : name(name), type(INT), value(value) {}
+        Setting(const char* name, bool* value) : name(name), type(BOOL), value(value) {}
+        Setting(const char* name, float* value) : name(name), type(FLOAT), value(value) {}
+
+        uint32_t get() const
+        {
+            uint32_t bits = 0;
+            if (type == BOOL)
+                bits = *(bool*)value ? 1 : 0;
+            else
+                memcpy(&bits, value, 4);
+            return bits;
+        }
+
+        void set(uint32_t bits) const
+        {
+            if (type == BOOL)
+                *(bool*)value = bits != 0;
+            else
+                memcpy(value, &bits, 4);
+        }
+    };
+
+    struct Event
+    {
+        uint32_t tick;
+        uint32_t setting;   // index into settingNames
+        uint32_t value;
+    };
+
+    float tickSeconds = 0.05f;
+    bool closed = false;    // the last key leads back into the first
+    std::vector<Key> keys;
+    std::vector<std::string> settingNames;
+    std::vector<Event> events;
+
+    float duration() const
+    {
+        if (keys.empty())
+            return 0.0f;
+        return (closed ? keys.size() : keys.size() - 1) * tickSeconds;
+    }
+
+    // the pose at time seconds into the path, held at the ends of an open path and wrapped around a closed one
+    Key sample(float time) const
+    {
+        if (keys.size() < 2)
+            return keys.empty() ? Key{ glm::vec3(0.0f), -90.0f, 0.0f, 45.0f } : keys[0];
+        float position = time / tickSeconds;
+        int count = (int)keys.size();
+        int index;
+        if (closed)
+        {
+            position = fmod(position, (float)count);
+            if (position < 0.0f)
+                position += count;
+            index = (int)position;
+        }
+        else
+        {
+            position = glm::clamp(position, 0.0f, (float)(count - 1));
+            index = std::min((int)position, count - 2);
+        }
+        float t = position - index;
+
+        const Key& k0 = key(index - 1);
+        const Key& k1 = key(index);
+        const Key& k2 = key(index + 1);
+        const Key& k3 = key(index + 2);
+        Key result;
+        result.position = catmullRom(k0.position, k1.position, k2.position, k3.position, t);
+        // yaw taken the short way round between neighbours, a closed path ends a whole turn away from where it starts
+        float yaw0 = continuousYaw(k0.yaw, k1.yaw);
+        float yaw2 = continuousYaw(k2.yaw, k1.yaw);
+        float yaw3 = continuousYaw(k3.yaw, yaw2);
+        result.yaw = catmullRom(yaw0, k1.yaw, yaw2, yaw3, t);
+        result.pitch = catmullRom(k0.pitch, k1.pitch, k2.pitch, k3.pitch, t);
+        result.zoom = catmullRom(k0.zoom, k1.zoom, k2.zoom, k3.zoom, t);
+        return result;
+    }
+
+    bool save(const std::string& path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Camera path: could not write " << path << std::endl;
+            return false;
+        }
+        file.write("RCAM", 4);
+        write(file, (uint32_t)VERSION);
+        write(file, tickSeconds);
+        write(file, (uint32_t)(closed ? 1 : 0));
+        write(file, (uint32_t)keys.size());
+        write(file, (uint32_t)settingNames.size());
+        write(file, (uint32_t)events.size());
+        for (const std::string& name : settingNames)
+        {
+            write(file, (uint8_t)name.size());
+            file.write(name.data(), name.size());
+        }
+        for (const Key& key : keys)
+        {
+            float values[6] = { key.position.x, key.position.y, key.position.z, key.yaw, key.pitch, key.zoom };
+            file.write((const char*)values, sizeof(values));
+        }
+        for (const Event& event : events)
+        {
+            write(file, event.tick);
+            write(file, event.setting);
+            write(file, event.value);
+        }
+        return (bool)file;
+    }
+
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        char magic[4] = {};
+        uint32_t version = 0, flags = 0, keyCount = 0, settingCount = 0, eventCount = 0;
+        file.read(magic, 4);
+        read(file, version);
+        if (!file || memcmp(magic, "RCAM", 4) != 0 || version != VERSION)
+        {
+            std::cout << "Camera path: " << path << " is not a camera path this version can read" << std::endl;
+            return false;
+        }
+        read(file, tickSeconds);
+        read(file, flags);
+        read(file, keyCount);
+        read(file, settingCount);
+        read(file, eventCount);
+        closed = (flags & 1) != 0;
+        // every setting name takes at least its length byte, so counts the rest of the file cannot hold are corrupt
+        std::streampos start = file.tellg();
+        file.seekg(0, std::ios::end);
+        uint64_t remaining = file ? (uint64_t)(file.tellg() - start) : 0;
+        file.seekg(start);
+        if (!file || settingCount + keyCount * (uint64_t)KEY_SIZE + eventCount * (uint64_t)EVENT_SIZE > remaining)
+        {
+            std::cout << "Camera path: " << path << " is truncated" << std::endl;
+            return false;
+        }
+
+        settingNames.resize(settingCount);
+        for (std::string& name : settingNames)
+        {
+            uint8_t length = 0;
+            read(file, length);
+            name.resize(length);
+            file.read(&name[0], length);
+        }
+        keys.resize(keyCount);
+        for (Key& key : keys)
+        {
+            float values[6];
+            file.read((char*)values, sizeof(values));
+            key = Key{ glm::vec3(values[0], values[1], values[2]), values[3], values[4], values[5] };
+        }
+        events.resize(eventCount);
+        for (Event& event : events)
+        {
+            read(file, event.tick);
+            read(file, event.setting);
+            read(file, event.value);
+        }
+        if (!file || tickSeconds <= 0.0f)
+        {
+            std::cout << "Camera path: " << path << " is truncated" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // the standard paths, so before and after comparisons look at the same views
+    static const std::vector<std::string>& standardNames()
+    {
+        static const std::vector<std::string> names = { "car", "house" };
+        return names;
+    }
+
+    // "car" circles the car at changing heights, "house" walks from the car around the back of the house
+    static bool standard(const std::string& name, CameraPath& path)
+    {
+        path = CameraPath();
+        if (name == "car")
+        {
+            const int KEYS = 12;
+            path.tickSeconds = 1.5f;
+            path.closed = true;
+            glm::vec3 target(0.0f, 0.6f, 0.0f);
+            for (int i = 0; i < KEYS; i++)
+            {
+                float angle = i * glm::two_pi<float>() / KEYS;
+                glm::vec3 position(sin(angle) * 5.0f, 1.8f + 0.7f * sin(angle * 2.0f), cos(angle) * 5.0f);
+                path.keys.push_back(lookingAt(position, target - position, path.keys));
+            }
+            return true;
+        }
+        if (name == "house")
+        {
+            // clear of the roof and of the stones behind the house
+            const glm::vec3 points[] = { { 2.5f, 1.6f, 6.0f }, { -1.5f, 1.6f, 6.0f }, { -5.0f, 1.6f, 5.5f }, { -9.0f, 1.6f, 4.5f },
+                                         { -11.0f, 1.6f, 1.0f }, { -10.5f, 1.6f, -3.0f }, { -7.0f, 1.6f, -5.5f }, { -3.0f, 1.6f, -6.0f },
+                                         { 1.5f, 1.6f, -4.5f } };
+            const int count = sizeof(points) / sizeof(points[0]);
+            const glm::vec3 house(-3.5f, 1.2f, -0.45f);
+            path.tickSeconds = 2.0f;
+            for (int i = 0; i < count; i++)
+            {
+                // along the walk, turned towards the house
+                glm::vec3 travel = glm::normalize(points[std::min(i + 1, count - 1)] - points[std::max(i - 1, 0)]);
+                glm::vec3 direction = travel + 0.6f * glm::normalize(house - points[i]);
+                path.keys.push_back(lookingAt(points[i], direction, path.keys));
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // yaw moved by whole turns to within half a turn of previous
+    static float continuousYaw(float yaw, float previous)
+    {
+        return yaw - 360.0f * std::round((yaw - previous) / 360.0f);
+    }
+
+private:
+    static const uint32_t VERSION = 1;
+    static const uint32_t KEY_SIZE = 6 * sizeof(float);         // position, yaw, pitch and zoom
+    static const uint32_t EVENT_SIZE = 3 * sizeof(uint32_t);    // tick, setting and value
+
+    const Key& key(int index) const
+    {
+        int count = (int)keys.size();
+        if (closed)
+            return keys[((index % count) + count) % count];
+        return keys[glm::clamp(index, 0, count - 1)];
+    }
+
+    template <typename T>
+    static T catmullRom(const T& p0, const T& p1, const T& p2, const T& p3, float t)
+    {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+
+    // the Euler angles Camera uses for looking along direction, yaw continued from the keys before
+    static Key lookingAt(const glm::vec3& position, glm::vec3 direction, const std::vector<Key>& previous)
+    {
+        direction = glm::normalize(direction);
+        Key key;
+        key.position = position;
+        key.yaw = glm::degrees(atan2(direction.z, direction.x));
+        key.pitch = glm::degrees(asin(direction.y));
+        key.zoom = ZOOM;
+        if (!previous.empty())
+            key.yaw = continuousYaw(key.yaw, previous.back().yaw);
+        return key;
+    }
+
+    template <typename T>
+    static void write(std::ofstream& file, const T& value)
+    {
+        file.write((const char*)&value, sizeof(T));
+    }
+
+    template <typename T>
+    static void read(std::ifstream& file, T& value)
+    {
+        file.read((char*)&value, sizeof(T));
+    }
+};
+
+// Turns what the camera and the settings do into a CameraPath, one key per tick.
+// Frames are usually longer than a tick, the ticks in between are interpolated between the poses of two frames.
+class CameraPathRecorder
+{
+public:
+    CameraPathRecorder(const std::vector<CameraPath::Setting>& settings, float tickSeconds = 0.05f) : settings(settings)
+    {
+        recorded.tickSeconds = tickSeconds;
+        for (const CameraPath::Setting& setting : settings)
+            recorded.settingNames.push_back(setting.name);
+        lastValues.assign(settings.size(), 0);
+    }
+
+    // time in seconds since the recording started
+    void update(float time, const Camera& camera)
+    {
+        CameraPath::Key current = { camera.Position, camera.Yaw, camera.Pitch, camera.Zoom };
+        if (recorded.keys.empty())
+        {
+            previousTime = time;
+            previous = current;
+        }
+        current.yaw = CameraPath::continuousYaw(current.yaw, previous.yaw);
+
+        uint32_t tick;
+        while ((tick = (uint32_t)recorded.keys.size()) * recorded.tickSeconds <= time)
+        {
+            float t = time > previousTime ? glm::clamp((tick * recorded.tickSeconds - previousTime) / (time - previousTime), 0.0f, 1.0f) : 1.0f;
+            CameraPath::Key key;
+            key.position = glm::mix(previous.position, current.position, t);
+            key.yaw = glm::mix(previous.yaw, current.yaw, t);
+            key.pitch = glm::mix(previous.pitch, current.pitch, t);
+            key.zoom = glm::mix(previous.zoom, current.zoom, t);
+            recorded.keys.push_back(key);
+
+            // every setting at the first tick, after that only the changes
+            for (size_t i = 0; i < settings.size(); i++)
+            {
+                uint32_t value = settings[i].get();
+                if (tick == 0 || value != lastValues[i])
+                    recorded.events.push_back({ tick, (uint32_t)i, value });
+                lastValues[i] = value;
+            }
+        }
+        previousTime = time;
+        previous = current;
+    }
+
+    const CameraPath& path() const
+    {
+        return recorded;
+    }
+
+private:
+    std::vector<CameraPath::Setting> settings;
+    std::vector<uint32_t> lastValues;
+    CameraPath recorded;
+    float previousTime = 0.0f;
+    CameraPath::Key previous;
+};
+
+// Drives the camera and the settings from a CameraPath. Settings the path does not know are left alone,
+// and settings the app no longer has are skipped.
+class CameraPathPlayer
+{
+public:
+    bool loop;
+
+    CameraPathPlayer(const CameraPath& path, const std::vector<CameraPath::Setting>& settings, bool loop = true)
+        : loop(loop), played(path), settings(settings)
+    {
+        for (const std::string& name : played.settingNames)
+        {
+            int index = -1;
+            for (size_t i = 0; i < settings.size(); i++)
+                if (name == settings[i].name)
+                    index = (int)i;
+            targets.push_back(index);
+        }
+    }
+
+    // the pose at time seconds into the playback, false once a path that does not loop is over
+    bool update(float time, Camera& camera)
+    {
+        float duration = played.duration();
+        bool over = !loop && time > duration;
+        float pathTime = loop && duration > 0.0f ? fmod(time, duration) : std::min(time, duration);
+        if (pathTime < lastTime)
+            nextEvent = 0;    // looped, the first tick sets every setting again
+        lastTime = pathTime;
+
+        while (nextEvent < played.events.size() && played.events[nextEvent].tick * played.tickSeconds <= pathTime)
+        {
+            const CameraPath::Event& event = played.events[nextEvent++];
+            if (event.setting < targets.size() && targets[event.setting] >= 0)
+                settings[targets[event.setting]].set(event.value);
+        }
+
+        CameraPath::Key key = played.sample(pathTime);
+        camera.Position = key.position;
+        camera.Zoom = key.zoom;
+        camera.SetOrientation(key.yaw, key.pitch);
+        return !over;
+    }
+
+    float duration() const
+    {
+        return played.duration();
+    }
+
+private:
+    CameraPath played;
+    std::vector<CameraPath::Setting> settings;
+    std::vector<int> targets;       // index into settings for each setting of the path, -1 when the app has none
+    size_t nextEvent = 0;
+    float lastTime = -1.0f;
+};
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef COMMAND_BUFFER_H
+#define COMMAND_BUFFER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// A list of render commands that any thread can record and that is submitted later by the thread owning
+// the context (see CommandSubmitter). Commands only hold plain values: handles of programs, vertex arrays
+// and textures, the enums below and offsets into the uniform data the buffer carries along, so recording
+// never calls into the graphics API.
+// Recording the same calls always gives the same bytes, and reset() keeps the memory, so once the buffers
+// have grown to the largest frame, recording does not allocate anymore.
+class CommandBuffer
+{
+public:
+    enum Type : uint8_t { BIND_PROGRAM, BIND_VERTEX_ARRAY, BIND_TEXTURE, SET_UNIFORM_BLOCK, SET_STATE, DRAW_INDEXED, DRAW };
+    enum Primitive : uint8_t { TRIANGLES, LINES, POINTS };
+    enum TextureTarget : uint8_t { TEXTURE_2D, TEXTURE_CUBE_MAP };
+    enum DepthFunc : uint8_t { LESS, LESS_EQUAL, EQUAL, ALWAYS };
+
+    // the fixed function state, always set as a whole so a buffer does not depend on what ran before it
+    struct State
+    {
+        bool depthTest = true;
+        bool depthWrite = true;
+        DepthFunc depthFunc = LESS;
+        bool additiveBlend = false;
+    };
+
+    struct Command
+    {
+        Type type;
+        union
+        {
+            uint32_t handle;                                            // BIND_PROGRAM, BIND_VERTEX_ARRAY
+            struct { uint32_t unit, handle; TextureTarget target; } texture;
+            struct { uint32_t binding, offset, size; } uniformBlock;    // offset into uniforms()
+            struct { bool depthTest, depthWrite, additiveBlend; DepthFunc depthFunc; } state;
+            struct { Primitive primitive; uint32_t count, first; } draw; // first index or first vertex
+        };
+    };
+
+    // uniform block data is placed at multiples of this, which has to be a multiple of the
+    // offset alignment the backend needs for binding a range of a uniform buffer
+    explicit CommandBuffer(uint32_t uniformAlignment = 256) : uniformAlignment(uniformAlignment)
+    {
+    }
+
+    void reset()
+    {
+        commandList.clear();
+        uniformData.clear();
+    }
+
+    void bindProgram(uint32_t program)
+    {
+        push(BIND_PROGRAM).handle = program;
+    }
+
+    void bindVertexArray(uint32_t vertexArray)
+    {
+        push(BIND_VERTEX_ARRAY).handle = vertexArray;
+    }
+
+    void bindTexture(uint32_t unit, TextureTarget target, uint32_t texture)
+    {
+        Command& command = push(BIND_TEXTURE);
+        command.texture.unit = unit;
+        command.texture.handle = texture;
+        command.texture.target = target;
+    }
+
+    // copies size bytes of data, laid out like the std140 block, for the draws that follow
+    void setUniformBlock(uint32_t binding, const void* data, uint32_t size)
+    {
+        uint32_t offset = ((uint32_t)uniformData.size() + uniformAlignment - 1) / uniformAlignment * uniformAlignment;
+        uniformData.resize(offset + size);
+        memcpy(&uniformData[offset], data, size);
+
+        Command& command = push(SET_UNIFORM_BLOCK);
+        command.uniformBlock.binding = binding;
+        command.uniformBlock.offset = offset;
+        command.uniformBlock.size = size;
+    }
+
+    void setState(const State& state)
+    {
+        Command& command = push(SET_STATE);
+        command.state.depthTest = state.depthTest;
+        command.state.depthWrite = state.depthWrite;
+        command.state.additiveBlend = state.additiveBlend;
+        command.state.depthFunc = state.depthFunc;
+    }
+
+    // 32 bit indices of the bound vertex array, starting at index first
+    void drawIndexed(Primitive primitive, uint32_t count, uint32_t first = 0)
+    {
+        Command& command = push(DRAW_INDEXED);
+        command.draw.primitive = primitive;
+        command.draw.count = count;
+        command.draw.first = first;
+    }
+
+    void draw(Primitive primitive, uint32_t count, uint32_t first = 0)
+    {
+        Command& command = push(DRAW);
+        command.draw.primitive = primitive;
+        command.draw.count = count;
+        command.draw.first = first;
+    }
+
+    const std::vector<Command>& commands() const
+    {
+        return commandList;
+    }
+
+    const std::vector<unsigned char>& uniforms() const
+    {
+        return uniformData;
+    }
+
+    // same commands and uniform data, byte for byte
+    bool equals(const CommandBuffer& other) const
+    {
+        return commandList.size() == other.commandList.size() && uniformData == other.uniformData &&
+               (commandList.empty() || memcmp(&commandList[0], &other.commandList[0], commandList.size() * sizeof(Command)) == 0);
+    }
+
+private:
+    uint32_t uniformAlignment;
+    std::vector<Command> commandList;
+    std::vector<unsigned char> uniformData;
+
+    // zeroed first, so the padding is the same in every recording and equals can compare bytes
+    Command& push(Type type)
+    {
+        commandList.emplace_back();
+        Command& command = commandList.back();
+        memset(&command, 0, sizeof(Command));
+        command.type = type;
+        return command;
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+#ifndef COMMAND_SUBMITTER_H
+#define COMMAND_SUBMITTER_H
+
+#include <glad/glad.h>
+
+#include <command_buffer.h>
+#include <streaming_buffer.h>
+
+#include <vector>
+#include <cstring>
+
+// The GL side of CommandBuffer, runs on the thread that owns the context.
+// submit() copies the uniform data of all the buffers into this frame's region of the streaming buffer
+// and then replays the commands in the order of the buffers, so the result does not depend on
+// which thread recorded what. Binds of the program or vertex array that is already bound are skipped.
+// The GL state is left as the last commands set it.
+class CommandSubmitter
+{
+public:
+    // commands and GL calls of the last submit
+    int commandCount = 0;
+    int drawCount = 0;
+    int skippedBinds = 0;
+
+    explicit CommandSubmitter(StreamingBuffer* stream) : stream(stream)
+    {
+    }
+
+    // what the command buffers for this submitter have to be created with
+    uint32_t uniformAlignment() const
+    {
+        return (uint32_t)stream->uniformAlignment;
+    }
+
+    void submit(const CommandBuffer* const* buffers, int count)
+    {
+        commandCount = drawCount = skippedBinds = 0;
+        boundProgram = boundVertexArray = ~0u;
+
+        size_t alignment = stream->uniformAlignment;
+        baseOffsets.resize(count);
+        size_t total = 0;
+        for (int i = 0; i < count; i++)
+        {
+            baseOffsets[i] = total;
+            total += (buffers[i]->uniforms().size() + alignment - 1) / alignment * alignment;
+        }
+
+        if (total > 0)
+        {
+            size_t offset;
+            unsigned char* mapped = (unsigned char*)stream->map(total, alignment, offset);
+            for (int i = 0; i < count; i++)
+            {
+                if (!buffers[i]->uniforms().empty())
+                    memcpy(mapped + baseOffsets[i], &buffers[i]->uniforms()[0], buffers[i]->uniforms().size());
+                baseOffsets[i] += offset;
+            }
+            stream->unmap();
+        }
+
+        for (int i = 0; i < count; i++)
+            execute(*buffers[i], baseOffsets[i]);
+        glBindVertexArray(0);
+    }
+
+private:
+    StreamingBuffer* stream;
+    std::vector<size_t> baseOffsets;
+    unsigned int boundProgram, boundVertexArray;
+
+    void execute(const CommandBuffer& buffer, size_t baseOffset)
+    {
+        static const GLenum primitives[] = { GL_TRIANGLES, GL_LINES, GL_POINTS };
+        static const GLenum textureTargets[] = { GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP };
+        static const GLenum depthFuncs[] = { GL_LESS, GL_LEQUAL, GL_EQUAL, GL_ALWAYS };
+
+        for (const CommandBuffer::Command& command : buffer.commands())
+        {
+            commandCount++;
+            switch (command.type)
+            {
+            case CommandBuffer::BIND_PROGRAM:
+                if (command.handle == boundProgram)
+                    skippedBinds++;
+                else
+                    glUseProgram(boundProgram = command.handle);
+                break;
+            case CommandBuffer::BIND_VERTEX_ARRAY:
+                if (command.handle == boundVertexArray)
+                    skippedBinds++;
+                else
+                    glBindVertexArray(boundVertexArray = command.handle);
+                break;
+            case CommandBuffer::BIND_TEXTURE:
+                glActiveTexture(GL_TEXTURE0 + command.texture.unit);
+                glBindTexture(textureTargets[command.texture.target], command.texture.handle);
+                break;
+            case CommandBuffer::SET_UNIFORM_BLOCK:
+                glBindBufferRange(GL_UNIFORM_BUFFER, command.uniformBlock.binding, stream->id,
+                                  baseOffset + command.uniformBlock.offset, command.uniformBlock.size);
+                break;
+            case CommandBuffer::SET_STATE:
+                if (command.state.depthTest)
+                    glEnable(GL_DEPTH_TEST);
+                else
+                    glDisable(GL_DEPTH_TEST);
+                glDepthMask(command.state.depthWrite ? GL_TRUE : GL_FALSE);
+                glDepthFunc(depthFuncs[command.state.depthFunc]);
+                if (command.state.additiveBlend)
+                {
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_ONE, GL_ONE);
+                }
+                else
+                {
+                    glDisable(GL_BLEND);
+                    glBlendFunc(GL_ONE, GL_ZERO);
+                }
+                break;
+            case CommandBuffer::DRAW_INDEXED:
+                glDrawElements(primitives[command.draw.primitive], command.draw.count, GL_UNSIGNED_INT,
+                               (void*)(command.draw.first * sizeof(GLuint)));
+                drawCount++;
+                break;
+            case CommandBuffer::DRAW:
+                glDrawArrays(primitives[command.draw.primitive], command.draw.first, command.draw.count);
+                drawCount++;
+                break;
+            }
+        }
+    }
+};
+
+#endif
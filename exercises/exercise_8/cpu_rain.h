@@ -0,0 +1,422 @@
+#ifndef CPU_RAIN_H
+#define CPU_RAIN_H
+
+#include <glm/glm.hpp>
+
+#include <thread_pool.h>
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPU_RAIN_SSE2 1
+#endif
+
+// CPU version of the rain in shaders/rain_simulate.comp, without a GL context.
+// Drop positions follow the same wrap-around box as the shaders: the seed of every drop is moved by
+// velocity * time and wrapped into the box in front of the camera. Streaks are culled against the
+// frustum and the rain map (a CPU copy of its depth), splashes are placed where the drop's column hits it.
+// The output matches the compute shader: two compacted arrays of xyz + opacity.
+// Seeds are kept as a structure of arrays so the kernel can process four drops per SSE instruction,
+// and the drops are split into chunks over a ThreadPool.
+// hash, rainSeed, the drop position, the streak opacity and the near field fade are the C++ port of shaders/rain_common.glsl,
+// keep them in step.
+class CpuRain
+{
+public:
+    // the rain uniforms, see setSplashUniforms in main.cpp
+    struct Params
+    {
+        float currentTime;
+        float boxSize;
+        glm::vec3 cameraPosition;
+        glm::vec3 forward;
+        glm::vec3 velocity;
+        float nearFieldFadeStart;
+        float nearFieldFadeEnd;
+        float splashSpeed;
+        float splashQuadSize;
+        glm::mat4 viewProjection;
+    };
+
+    std::vector<glm::vec4> streaks;     // visible streaks, position of the drop and opacity
+    std::vector<glm::vec4> splashes;    // visible splashes, position on the surface and opacity
+    bool simd = true;                   // false runs the scalar reference kernel
+
+    // number of drops, the seeds are regenerated when it changes
+    void setCount(int count)
+    {
+        if (count == (int)seedX.size())
+            return;
+        seedX.resize(count);
+        seedY.resize(count);
+        seedZ.resize(count);
+        for (int id = 0; id < count; id++)
+        {
+            glm::vec3 seed = rainSeed((uint32_t)id, count);
+            seedX[id] = seed.x;
+            seedY[id] = seed.y;
+            seedZ[id] = seed.z;
+        }
+    }
+
+    int count() const
+    {
+        return (int)seedX.size();
+    }
+
+    // CPU copy of the rain map, depth values row by row starting at the bottom as glGetTexImage returns them
+    void setRainMap(const std::vector<float>& depth, int width, int height, const glm::mat4& matrix)
+    {
+        rainDepth = depth;
+        rainWidth = width;
+        rainHeight = height;
+        rainSpaceMatrix = matrix;
+        inverseRainSpaceMatrix = glm::inverse(matrix);
+    }
+
+    const glm::mat4& rainMapMatrix() const
+    {
+        return rainSpaceMatrix;
+    }
+
+    // moves every drop to params.currentTime and collects the visible streaks and splashes.
+    // Without a pool everything runs on the calling thread
+    void update(const Params& params, ThreadPool* pool = nullptr)
+    {
+        setFrustum(params.viewProjection);
+        int threads = pool ? pool->size() : 1;
+        if ((int)threadStreaks.size() < threads)
+        {
+            threadStreaks.resize(threads);
+            threadSplashes.resize(threads);
+        }
+
+        // every chunk appends to the lists of its thread, chunk order does not matter for the output
+        for (int i = 0; i < threads; i++)
+        {
+            threadStreaks[i].clear();
+            threadSplashes[i].clear();
+        }
+        auto body = [&](int begin, int end, int thread)
+        {
+            if (simd)
+                updateRange(params, begin, end, threadStreaks[thread], threadSplashes[thread]);
+            else
+                updateRangeReference(params, begin, end, threadStreaks[thread], threadSplashes[thread]);
+        };
+        if (pool)
+            pool->parallelFor(count(), CHUNK_SIZE, body);
+        else
+            for (int begin = 0; begin < count(); begin += CHUNK_SIZE)
+                body(begin, std::min(begin + CHUNK_SIZE, count()), 0);
+
+        streaks.clear();
+        splashes.clear();
+        for (int i = 0; i < threads; i++)
+        {
+            streaks.insert(streaks.end(), threadStreaks[i].begin(), threadStreaks[i].end());
+            splashes.insert(splashes.end(), threadSplashes[i].begin(), threadSplashes[i].end());
+        }
+    }
+
+private:
+    static const int CHUNK_SIZE = 16384;
+
+    std::vector<float> seedX, seedY, seedZ;
+    std::vector<std::vector<glm::vec4>> threadStreaks, threadSplashes;
+
+    std::vector<float> rainDepth;
+    int rainWidth = 0, rainHeight = 0;
+    glm::mat4 rainSpaceMatrix = glm::mat4(0.0f);
+    glm::mat4 inverseRainSpaceMatrix = glm::mat4(0.0f);
+    glm::vec4 frustum[5];
+
+    // Hash and RainSeed of shaders/rain_common.glsl
+    static glm::uvec3 hash(glm::uvec3 v)
+    {
+        v = v * 1664525u + 1013904223u;
+        v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+        v ^= v >> 16u;
+        v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+        return v;
+    }
+
+    static glm::vec3 rainSeed(uint32_t id, int count)
+    {
+        glm::uvec3 sequence = id * glm::uvec3(3518319155u, 2882110345u, 2360945575u);
+        glm::vec3 jitter = glm::vec3(hash(glm::uvec3(id)) >> 8u) / 16777216.0f - 0.5f;
+        return glm::fract(glm::vec3(sequence >> 8u) / 16777216.0f + jitter / std::pow((float)count, 1.0f / 3.0f));
+    }
+
+    // left, right, bottom, top and w > 0 of the view projection, like RainSimulation
+    void setFrustum(const glm::mat4& m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        frustum[0] = row3 + row0;
+        frustum[1] = row3 - row0;
+        frustum[2] = row3 + row1;
+        frustum[3] = row3 - row1;
+        frustum[4] = row3;
+    }
+
+    // bilinear lookup with a white border, like the GL_LINEAR / GL_CLAMP_TO_BORDER rain map
+    float fetchDepth(int x, int y) const
+    {
+        if (x < 0 || y < 0 || x >= rainWidth || y >= rainHeight)
+            return 1.0f;
+        return rainDepth[(size_t)y * rainWidth + x];
+    }
+
+    float sampleRainMap(float u, float v) const
+    {
+        if (rainDepth.empty())
+            return 1.0f;
+        float fx = u * rainWidth - 0.5f;
+        float fy = v * rainHeight - 0.5f;
+        float floorX = std::floor(fx), floorY = std::floor(fy);
+        // far outside of the map, also keeps the conversion to int in range
+        if (floorX < -1.0f || floorY < -1.0f || floorX >= rainWidth || floorY >= rainHeight)
+            return 1.0f;
+        int x0 = (int)floorX, y0 = (int)floorY;
+        float tx = fx - floorX, ty = fy - floorY;
+        return glm::mix(glm::mix(fetchDepth(x0, y0), fetchDepth(x0 + 1, y0), tx),
+                        glm::mix(fetchDepth(x0, y0 + 1), fetchDepth(x0 + 1, y0 + 1), tx), ty);
+    }
+
+    static float smoothstep(float edge0, float edge1, float x)
+    {
+        float t = glm::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+        return t * t * (3.0f - 2.0f * t);
+    }
+
+    // StreakAlpha of shaders/rain_common.glsl
+    static float streakOpacity(const Params& params)
+    {
+        return 1.0f - glm::length(glm::vec2(params.velocity)) / params.boxSize * 0.5f;
+    }
+
+    // rain map occlusion, frustum culling and splash of one drop
+    void emitDrop(const Params& params, glm::vec3 worldPos, float fade,
+                  std::vector<glm::vec4>& outStreaks, std::vector<glm::vec4>& outSplashes) const
+    {
+        glm::vec4 rainSpace = rainSpaceMatrix * glm::vec4(worldPos, 1.0f);
+        glm::vec3 projCoords = glm::vec3(rainSpace) / rainSpace.w * 0.5f + 0.5f;
+        float closestDepth = sampleRainMap(projCoords.x, projCoords.y);
+        float currentDepth = glm::clamp(projCoords.z, -1.0f, 1.0f);
+
+        if (currentDepth - 0.005f <= closestDepth && streakVisible(worldPos, worldPos - params.velocity))
+        {
+            outStreaks.push_back(glm::vec4(worldPos, 0.3f * streakOpacity(params) * fade));
+        }
+
+        float range = glm::clamp((closestDepth - currentDepth) / params.splashSpeed, 0.0f, 1.0f);
+        if (range < 1.0f)
+        {
+            projCoords.z = closestDepth;
+            glm::vec4 temp = inverseRainSpaceMatrix * glm::vec4(projCoords * 2.0f - 1.0f, 1.0f);
+            glm::vec3 splashPos = glm::vec3(temp) / temp.w;
+            if (splashVisible(splashPos, params.splashQuadSize * 1.5f))
+                outSplashes.push_back(glm::vec4(splashPos, glm::mix(0.2f, 0.0f, range) * fade));
+        }
+    }
+
+    bool streakVisible(glm::vec3 bottom, glm::vec3 top) const
+    {
+        for (int i = 0; i < 5; i++)
+            if (glm::dot(glm::vec3(frustum[i]), bottom) + frustum[i].w < 0.0f && glm::dot(glm::vec3(frustum[i]), top) + frustum[i].w < 0.0f)
+                return false;
+        return true;
+    }
+
+    bool splashVisible(glm::vec3 center, float radius) const
+    {
+        for (int i = 0; i < 5; i++)
+            if (glm::dot(glm::vec3(frustum[i]), center) + frustum[i].w < -radius * glm::length(glm::vec3(frustum[i])))
+                return false;
+        return true;
+    }
+
+    // scalar kernel, written as close to the shader as possible to validate the SIMD one against
+    void updateRangeReference(const Params& params, int begin, int end,
+                              std::vector<glm::vec4>& outStreaks, std::vector<glm::vec4>& outSplashes) const
+    {
+        glm::vec3 boxOrigin = params.cameraPosition + params.forward - glm::vec3(params.boxSize) * 0.5f;
+        for (int id = begin; id < end; id++)
+        {
+            // GetDropPosition of shaders/rain_common.glsl
+            glm::vec3 position = glm::vec3(seedX[id], seedY[id], seedZ[id]) * params.boxSize;
+            position += params.velocity * params.currentTime - (params.cameraPosition + params.forward + glm::vec3(params.boxSize) * 0.5f);
+            position = glm::mod(position, params.boxSize);
+            glm::vec3 worldPos = position + boxOrigin;
+
+            // NearFieldFade of shaders/rain_common.glsl
+            float fade = 1.0f - smoothstep(params.nearFieldFadeStart, params.nearFieldFadeEnd,
+                                           glm::length(glm::vec2(worldPos.x, worldPos.z) - glm::vec2(params.cameraPosition.x, params.cameraPosition.z)));
+            if (fade == 0.0f)
+                continue;
+            emitDrop(params, worldPos, fade, outStreaks, outSplashes);
+        }
+    }
+
+#ifdef CPU_RAIN_SSE2
+    // floor for SSE2, which has no rounding instruction. Values must fit in an int
+    static __m128 floor4(__m128 x)
+    {
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+        return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+    }
+
+    // GLSL mod, x - y * floor(x / y)
+    static __m128 mod4(__m128 x, __m128 y)
+    {
+        return _mm_sub_ps(x, _mm_mul_ps(y, floor4(_mm_div_ps(x, y))));
+    }
+
+    // 4x4 matrix times (x, y, z, 1) for four points at a time, summed in the same order as glm
+    static void transform4(const glm::mat4& m, __m128 x, __m128 y, __m128 z, __m128 out[4])
+    {
+        for (int row = 0; row < 4; row++)
+            out[row] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(m[0][row]), x), _mm_mul_ps(_mm_set1_ps(m[1][row]), y)),
+                                             _mm_mul_ps(_mm_set1_ps(m[2][row]), z)), _mm_set1_ps(m[3][row]));
+    }
+
+    static __m128 planeDistance4(const glm::vec4& plane, __m128 x, __m128 y, __m128 z)
+    {
+        return _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x), _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+                                     _mm_mul_ps(_mm_set1_ps(plane.z), z)), _mm_set1_ps(plane.w));
+    }
+
+    static __m128 clamp4(__m128 x, __m128 low, __m128 high)
+    {
+        return _mm_min_ps(_mm_max_ps(x, low), high);
+    }
+
+    // the same as updateRangeReference for four drops at a time, only the rain map lookups are scalar
+    void updateRange(const Params& params, int begin, int end,
+                     std::vector<glm::vec4>& outStreaks, std::vector<glm::vec4>& outSplashes) const
+    {
+        glm::vec3 offset = params.velocity * params.currentTime - (params.cameraPosition + params.forward + glm::vec3(params.boxSize) * 0.5f);
+        glm::vec3 boxOrigin = params.cameraPosition + params.forward - glm::vec3(params.boxSize) * 0.5f;
+
+        const __m128 box = _mm_set1_ps(params.boxSize);
+        const __m128 offsetX = _mm_set1_ps(offset.x), offsetY = _mm_set1_ps(offset.y), offsetZ = _mm_set1_ps(offset.z);
+        const __m128 originX = _mm_set1_ps(boxOrigin.x), originY = _mm_set1_ps(boxOrigin.y), originZ = _mm_set1_ps(boxOrigin.z);
+        const __m128 cameraX = _mm_set1_ps(params.cameraPosition.x), cameraZ = _mm_set1_ps(params.cameraPosition.z);
+        const __m128 fadeStart = _mm_set1_ps(params.nearFieldFadeStart);
+        const __m128 fadeRange = _mm_set1_ps(params.nearFieldFadeEnd - params.nearFieldFadeStart);
+        const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f), three = _mm_set1_ps(3.0f);
+        const __m128 streakAlpha = _mm_set1_ps(0.3f * streakOpacity(params));
+        const __m128 splashSpeed = _mm_set1_ps(params.splashSpeed);
+        const __m128 splashAlpha = _mm_set1_ps(0.2f);
+
+        // the top of a streak is one velocity behind the drop
+        float topOffset[5];
+        __m128 splashMargin[5];
+        for (int i = 0; i < 5; i++)
+        {
+            topOffset[i] = glm::dot(glm::vec3(frustum[i]), params.velocity);
+            splashMargin[i] = _mm_set1_ps(-params.splashQuadSize * 1.5f * glm::length(glm::vec3(frustum[i])));
+        }
+
+        int id = begin;
+        for (; id + 4 <= end; id += 4)
+        {
+            __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&seedX[id]), box), offsetX);
+            __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&seedY[id]), box), offsetY);
+            __m128 z = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&seedZ[id]), box), offsetZ);
+            x = _mm_add_ps(mod4(x, box), originX);
+            y = _mm_add_ps(mod4(y, box), originY);
+            z = _mm_add_ps(mod4(z, box), originZ);
+
+            // 1 - smoothstep(fadeStart, fadeEnd, horizontal distance)
+            __m128 dx = _mm_sub_ps(x, cameraX), dz = _mm_sub_ps(z, cameraZ);
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz)));
+            __m128 t = clamp4(_mm_div_ps(_mm_sub_ps(distance, fadeStart), fadeRange), zero, one);
+            __m128 fade = _mm_sub_ps(one, _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(three, _mm_mul_ps(two, t))));
+            __m128 alive = _mm_cmpgt_ps(fade, zero);
+            if (!_mm_movemask_ps(alive))
+                continue;
+
+            // rain space position, then one scalar rain map lookup per drop
+            __m128 rainSpace[4];
+            transform4(rainSpaceMatrix, x, y, z, rainSpace);
+            __m128 projX = _mm_add_ps(_mm_mul_ps(_mm_div_ps(rainSpace[0], rainSpace[3]), half), half);
+            __m128 projY = _mm_add_ps(_mm_mul_ps(_mm_div_ps(rainSpace[1], rainSpace[3]), half), half);
+            __m128 projZ = _mm_add_ps(_mm_mul_ps(_mm_div_ps(rainSpace[2], rainSpace[3]), half), half);
+            alignas(16) float lanesU[4], lanesV[4], lanesClosest[4];
+            _mm_store_ps(lanesU, projX);
+            _mm_store_ps(lanesV, projY);
+            for (int lane = 0; lane < 4; lane++)
+                lanesClosest[lane] = sampleRainMap(lanesU[lane], lanesV[lane]);
+            __m128 closestDepth = _mm_load_ps(lanesClosest);
+            __m128 currentDepth = clamp4(projZ, _mm_set1_ps(-1.0f), one);
+
+            // streak: not under cover and not entirely outside of one frustum plane
+            __m128 streak = _mm_and_ps(alive, _mm_cmple_ps(_mm_sub_ps(currentDepth, _mm_set1_ps(0.005f)), closestDepth));
+            for (int i = 0; i < 5; i++)
+            {
+                __m128 bottom = planeDistance4(frustum[i], x, y, z);
+                __m128 top = _mm_sub_ps(bottom, _mm_set1_ps(topOffset[i]));
+                streak = _mm_andnot_ps(_mm_and_ps(_mm_cmplt_ps(bottom, zero), _mm_cmplt_ps(top, zero)), streak);
+            }
+
+            // splash: close enough to the surface below, placed on it and tested as a sphere
+            __m128 range = clamp4(_mm_div_ps(_mm_sub_ps(closestDepth, currentDepth), splashSpeed), zero, one);
+            __m128 splash = _mm_and_ps(alive, _mm_cmplt_ps(range, one));
+            __m128 splashX = zero, splashY = zero, splashZ = zero;
+            if (_mm_movemask_ps(splash))
+            {
+                __m128 world[4];
+                transform4(inverseRainSpaceMatrix, _mm_sub_ps(_mm_mul_ps(projX, two), one), _mm_sub_ps(_mm_mul_ps(projY, two), one),
+                           _mm_sub_ps(_mm_mul_ps(closestDepth, two), one), world);
+                splashX = _mm_div_ps(world[0], world[3]);
+                splashY = _mm_div_ps(world[1], world[3]);
+                splashZ = _mm_div_ps(world[2], world[3]);
+                for (int i = 0; i < 5; i++)
+                    splash = _mm_andnot_ps(_mm_cmplt_ps(planeDistance4(frustum[i], splashX, splashY, splashZ), splashMargin[i]), splash);
+            }
+
+            int streakMask = _mm_movemask_ps(streak);
+            int splashMask = _mm_movemask_ps(splash);
+            if (!(streakMask | splashMask))
+                continue;
+
+            alignas(16) float lanes[7][4];
+            _mm_store_ps(lanes[0], x);
+            _mm_store_ps(lanes[1], y);
+            _mm_store_ps(lanes[2], z);
+            _mm_store_ps(lanes[3], _mm_mul_ps(streakAlpha, fade));
+            _mm_store_ps(lanes[4], splashX);
+            _mm_store_ps(lanes[5], splashY);
+            _mm_store_ps(lanes[6], splashZ);
+            alignas(16) float splashAlphas[4];
+            _mm_store_ps(splashAlphas, _mm_mul_ps(_mm_mul_ps(splashAlpha, _mm_sub_ps(one, range)), fade));
+            for (int lane = 0; lane < 4; lane++)
+            {
+                if (streakMask & (1 << lane))
+                    outStreaks.push_back(glm::vec4(lanes[0][lane], lanes[1][lane], lanes[2][lane], lanes[3][lane]));
+                if (splashMask & (1 << lane))
+                    outSplashes.push_back(glm::vec4(lanes[4][lane], lanes[5][lane], lanes[6][lane], splashAlphas[lane]));
+            }
+        }
+
+        // the last few drops of the range
+        updateRangeReference(params, id, end, outStreaks, outSplashes);
+    }
+#else
+    void updateRange(const Params& params, int begin, int end,
+                     std::vector<glm::vec4>& outStreaks, std::vector<glm::vec4>& outSplashes) const
+    {
+        updateRangeReference(params, begin, end, outStreaks, outSplashes);
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <GLFW/glfw3.h>
+
+#include <chrono>
+#include <thread>
+#include <ctime>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX    // std::min and std::max below
+#endif
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <trace.h>
+
+// Decides when the next frame starts, instead of spinning until the frame interval has passed.
+// In TARGET_FPS mode the wait sleeps most of the way and only spins for the last bit, where the OS
+// timer is not precise enough. With lateStart the wait also covers the predicted CPU cost of the next
+// frame, so the frame starts as late as possible and its input is as fresh as possible when it is shown.
+// Keeps the recent frame times and the process CPU time to check how much of a core the app really uses.
+class FramePacer
+{
+public:
+    enum Mode { UNCAPPED, VSYNC, TARGET_FPS };
+
+    int mode = TARGET_FPS;
+    float targetFps = 50.0f;
+    bool lateStart = false;
+
+    // statistics, updated every frame
+    float predictedWorkMs = 0.0f;   // CPU time a frame is expected to need
+    float cpuUtilization = 0.0f;    // process CPU time over wall time, 1 is one full core
+
+    FramePacer()
+    {
+        frameTimes.reserve(HISTORY);
+        deadline = frameStart = workStart = Clock::now();
+        utilizationStart = frameStart;
+        utilizationCpuStart = processCpuSeconds();
+    }
+
+    // marks where the frame's work starts, call at the top of the frame
+    void beginFrame()
+    {
+        workStart = Clock::now();
+    }
+
+    // call after swapping buffers, waits until the next frame should start.
+    // uncapped skips the wait for this frame, for benchmarks
+    void endFrame(bool uncapped = false)
+    {
+        Clock::time_point workEnd = Clock::now();
+        float workMs = std::chrono::duration<float, std::milli>(workEnd - workStart).count();
+        // decays slowly and follows spikes right away, so a frame that gets more expensive is rarely late twice
+        predictedWorkMs = std::max(workMs, predictedWorkMs * 0.95f + workMs * 0.05f);
+
+        if (mode != appliedMode)
+        {
+            glfwSwapInterval(mode == VSYNC ? 1 : 0);
+            appliedMode = mode;
+        }
+
+        if (mode == TARGET_FPS && !uncapped && targetFps > 0.0f)
+        {
+            Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.0f / targetFps));
+            deadline += interval;
+            // more than a frame behind, start over instead of rushing to catch up
+            if (deadline < workEnd)
+                deadline = workEnd;
+            Clock::time_point wakeUp = deadline;
+            if (lateStart)
+                wakeUp -= std::min(interval, std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(predictedWorkMs)));
+            waitUntil(wakeUp);
+        }
+        else
+            deadline = Clock::now();
+
+        Clock::time_point now = Clock::now();
+        recordFrame(std::chrono::duration<float, std::milli>(now - frameStart).count());
+        frameStart = now;
+        updateUtilization(now);
+    }
+
+    // frame time in milliseconds below which the given fraction of the recent frames are
+    float percentileMs(float fraction) const
+    {
+        if (frameTimes.empty())
+            return 0.0f;
+        std::vector<float> sorted(frameTimes);
+        size_t index = std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const size_t HISTORY = 240;
+
+    Clock::time_point deadline, frameStart, workStart;
+    int appliedMode = -1;
+    std::vector<float> frameTimes;
+    size_t nextFrameTime = 0;
+    float sleepOvershootMs = 1.0f;   // how much later than asked a sleep tends to return
+
+    Clock::time_point utilizationStart;
+    double utilizationCpuStart;
+
+    // sleeps while the remaining time is comfortably above how much sleeps overshoot, then spins
+    void waitUntil(Clock::time_point target)
+    {
+        TRACE_SCOPE("Wait for next frame");
+        for (;;)
+        {
+            Clock::time_point now = Clock::now();
+            float remainingMs = std::chrono::duration<float, std::milli>(target - now).count();
+            if (remainingMs <= sleepOvershootMs + 0.5f)
+                break;
+            float sleepMs = remainingMs - sleepOvershootMs - 0.5f;
+            std::this_thread::sleep_for(std::chrono::duration<float, std::milli>(sleepMs));
+            float sleptMs = std::chrono::duration<float, std::milli>(Clock::now() - now).count();
+            sleepOvershootMs = std::min(std::max(sleepOvershootMs * 0.9f + (sleptMs - sleepMs) * 0.1f, 0.05f), 4.0f);
+        }
+        while (Clock::now() < target)
+            std::this_thread::yield();
+    }
+
+    void recordFrame(float ms)
+    {
+        if (frameTimes.size() < HISTORY)
+            frameTimes.push_back(ms);
+        else
+            frameTimes[nextFrameTime] = ms;
+        nextFrameTime = (nextFrameTime + 1) % HISTORY;
+    }
+
+    // user and kernel time of all threads of the process. Not std::clock, which is the wall time since start on MSVC
+    static double processCpuSeconds()
+    {
+#ifdef _WIN32
+        FILETIME creation, exit, kernel, user;
+        if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+            return 0.0;
+        auto seconds = [](const FILETIME& time) {   // in 100 ns ticks
+            return (double)(((unsigned long long)time.dwHighDateTime << 32) | time.dwLowDateTime) * 1e-7;
+        };
+        return seconds(kernel) + seconds(user);
+#elif defined(CLOCK_PROCESS_CPUTIME_ID)
+        timespec time;
+        if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+            return 0.0;
+        return time.tv_sec + time.tv_nsec * 1e-9;
+#else
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+    }
+
+    // averaged over half a second
+    void updateUtilization(Clock::time_point now)
+    {
+        float wallSeconds = std::chrono::duration<float>(now - utilizationStart).count();
+        if (wallSeconds < 0.5f)
+            return;
+        double cpu = processCpuSeconds();
+        cpuUtilization = (float)(cpu - utilizationCpuStart) / wallSeconds;
+        utilizationStart = now;
+        utilizationCpuStart = cpu;
+    }
+};
+
+#endif
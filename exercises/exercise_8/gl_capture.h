@@ -0,0 +1,683 @@
+#ifndef GL_CAPTURE_H
+#define GL_CAPTURE_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_map>
+#include <iostream>
+
+// Writes the GL command stream of the app to a file that replay/gl_replay.cpp runs again without the app, to
+// study what the frames cost on any machine.
+// A capture starts right after the GL functions are loaded and records every call from there on, with the data
+// they upload, so the replay can build the same objects. Somewhere later a window of frames starts
+// (beginWindow()), those are the ones the replay loops over and times, everything before them it runs once as
+// setup. Profiler scopes go into the file as pass markers.
+// Calls are hooked by replacing glad's debug function pointers (glad is generated with GLAD_DEBUG, the GL macros
+// go through them), so glad's own wrapper and whatever its callbacks do (gl_stats.h) still run behind the hook.
+// Only the functions listed below are recorded, queries of GL state are left out as they change nothing. Object
+// names, uniform locations, uniform block indices and fences are recorded as the app saw them and mapped to
+// what the replay gets back; vertex attribute locations are assumed to come out the same.
+// Data written into a mapped buffer is recorded when it is unmapped, so persistently mapped buffers cannot be
+// captured (StreamingBuffer maps per allocation while capturing). Pixel uploads assume no pixel unpack buffer
+// and no skipped rows or pixels.
+//
+// File layout, little endian: "RGLC", uint32 version, int32 width and height of the window, then one record per
+// call: uint16 call, then the arguments as the function takes them, pointers as 64 bits. Data is a uint8 that is
+// 0 for a null pointer, otherwise followed by a uint64 size and the bytes; strings are a uint32 length and the
+// characters.
+
+// Functions without data behind their pointers, recorded by the generic hook. The string has a character per
+// argument for how the replay maps it: T texture, B buffer, V vertex array, F framebuffer, Q query, P program,
+// S shader, L uniform location (of the program in use), K uniform block index (of the program before it),
+// Y fence, - used as it is
+#define GL_CAPTURE_FUNCTIONS(F) \
+    F(glActiveTexture, "-") \
+    F(glAttachShader, "PS") \
+    F(glBeginQuery, "-Q") \
+    F(glBindBuffer, "-B") \
+    F(glBindBufferBase, "--B") \
+    F(glBindBufferRange, "--B--") \
+    F(glBindFramebuffer, "-F") \
+    F(glBindImageTexture, "-T-----") \
+    F(glBindSampler, "--") \
+    F(glBindTexture, "-T") \
+    F(glBindVertexArray, "V") \
+    F(glBlendColor, "----") \
+    F(glBlendEquation, "-") \
+    F(glBlendEquationSeparate, "--") \
+    F(glBlendFunc, "--") \
+    F(glBlendFuncSeparate, "----") \
+    F(glClear, "-") \
+    F(glClearColor, "----") \
+    F(glClientWaitSync, "Y--") \
+    F(glColorMask, "----") \
+    F(glCompileShader, "S") \
+    F(glCopyBufferSubData, "-----") \
+    F(glDeleteProgram, "P") \
+    F(glDeleteShader, "S") \
+    F(glDeleteSync, "Y") \
+    F(glDepthFunc, "-") \
+    F(glDepthMask, "-") \
+    F(glDepthRange, "--") \
+    F(glDetachShader, "PS") \
+    F(glDisable, "-") \
+    F(glDisableVertexAttribArray, "-") \
+    F(glDispatchCompute, "---") \
+    F(glDrawArrays, "---") \
+    F(glDrawArraysIndirect, "--") \
+    F(glDrawArraysInstanced, "----") \
+    F(glDrawBuffer, "-") \
+    F(glDrawElements, "----") \
+    F(glDrawElementsBaseVertex, "-----") \
+    F(glDrawElementsInstanced, "-----") \
+    F(glEnable, "-") \
+    F(glEnableVertexAttribArray, "-") \
+    F(glEndQuery, "-") \
+    F(glFramebufferTexture2D, "---T-") \
+    F(glFramebufferTextureLayer, "--T--") \
+    F(glGenerateMipmap, "-") \
+    F(glLinkProgram, "P") \
+    F(glMemoryBarrier, "-") \
+    F(glPolygonMode, "--") \
+    F(glQueryCounter, "Q-") \
+    F(glReadBuffer, "-") \
+    F(glScissor, "----") \
+    F(glTexBuffer, "--B") \
+    F(glTexParameteri, "---") \
+    F(glUniform1f, "L-") \
+    F(glUniform1i, "L-") \
+    F(glUniform2f, "L--") \
+    F(glUniform3f, "L---") \
+    F(glUniform4f, "L----") \
+    F(glUniformBlockBinding, "PK-") \
+    F(glUseProgram, "P") \
+    F(glVertexAttribPointer, "------") \
+    F(glViewport, "----")
+
+// functions that upload data, create or delete objects or return what later calls use, each with its own hook
+#define GL_CAPTURE_SPECIAL_FUNCTIONS(F) \
+    F(glBufferData) \
+    F(glBufferSubData) \
+    F(glCreateProgram) \
+    F(glCreateShader) \
+    F(glDeleteBuffers) \
+    F(glDeleteFramebuffers) \
+    F(glDeleteQueries) \
+    F(glDeleteTextures) \
+    F(glDeleteVertexArrays) \
+    F(glDrawBuffers) \
+    F(glFenceSync) \
+    F(glGenBuffers) \
+    F(glGenFramebuffers) \
+    F(glGenQueries) \
+    F(glGenTextures) \
+    F(glGenVertexArrays) \
+    F(glGetUniformBlockIndex) \
+    F(glGetUniformLocation) \
+    F(glMapBufferRange) \
+    F(glPixelStorei) \
+    F(glShaderSource) \
+    F(glTexImage2D) \
+    F(glTexImage3D) \
+    F(glTexParameterfv) \
+    F(glUniform1fv) \
+    F(glUniform2fv) \
+    F(glUniform3fv) \
+    F(glUniform4fv) \
+    F(glUniformMatrix2fv) \
+    F(glUniformMatrix3fv) \
+    F(glUniformMatrix4fv) \
+    F(glUnmapBuffer)
+
+class GlCapture
+{
+public:
+    static const uint32_t MAGIC = 0x434c4752;     // "RGLC"
+    static const uint32_t VERSION = 1;
+
+    enum Call : uint16_t
+    {
+#define GL_CAPTURE_CALL(name, ...) CALL_##name,
+        GL_CAPTURE_FUNCTIONS(GL_CAPTURE_CALL)
+        GL_CAPTURE_SPECIAL_FUNCTIONS(GL_CAPTURE_CALL)
+#undef GL_CAPTURE_CALL
+        CALL_WINDOW,        // the replayed frames start
+        CALL_FRAME,         // a frame ended, the window was swapped
+        CALL_PASS_BEGIN,    // string name
+        CALL_PASS_END,
+        CALL_END,           // the last frame of the window ended
+        CALL_COUNT
+    };
+
+    static const char* callName(int call)
+    {
+        static const char* names[CALL_COUNT] = {
+#define GL_CAPTURE_NAME(name, ...) #name,
+            GL_CAPTURE_FUNCTIONS(GL_CAPTURE_NAME)
+            GL_CAPTURE_SPECIAL_FUNCTIONS(GL_CAPTURE_NAME)
+#undef GL_CAPTURE_NAME
+            "window", "frame", "pass begin", "pass end", "end"
+        };
+        return call < CALL_COUNT ? names[call] : "unknown";
+    }
+
+    // argument mappings of the generic functions, nullptr for the others
+    static const char* argumentKinds(int call)
+    {
+        static const char* kinds[] = {
+#define GL_CAPTURE_KINDS(name, kinds) kinds,
+            GL_CAPTURE_FUNCTIONS(GL_CAPTURE_KINDS)
+#undef GL_CAPTURE_KINDS
+        };
+        return call < (int)(sizeof(kinds) / sizeof(kinds[0])) ? kinds[call] : nullptr;
+    }
+
+    // needs the GL functions loaded, width and height are those of the window
+    static bool start(const char* path, int width, int height)
+    {
+        State& capture = state();
+        capture.file = fopen(path, "wb");
+        if (!capture.file)
+        {
+            std::cout << "Capture: could not write " << path << std::endl;
+            return false;
+        }
+        setvbuf(capture.file, nullptr, _IOFBF, 1 << 20);
+        capture.path = path;
+        put((uint32_t)MAGIC);
+        put((uint32_t)VERSION);
+        put((int32_t)width);
+        put((int32_t)height);
+        hook(true);
+        return true;
+    }
+
+    static bool capturing()
+    {
+        return state().file != nullptr;
+    }
+
+    // frames left in the window, also when it only starts with the next frame, 0 before it was asked for
+    static int windowFramesLeft()
+    {
+        return state().windowFramesLeft;
+    }
+
+    // the window starts with the next frame, the replay loops over its frames
+    static void beginWindow(int frames)
+    {
+        State& capture = state();
+        if (!capture.file || capture.windowFramesLeft > 0)
+            return;
+        capture.windowFramesLeft = std::max(frames, 1);
+        capture.windowStarting = true;
+    }
+
+    // call once per frame before its first GL call
+    static void beginFrame()
+    {
+        State& capture = state();
+        if (!capture.file || !capture.windowStarting)
+            return;
+        capture.windowStarting = false;
+        begin(CALL_WINDOW);
+    }
+
+    // call once per frame after the swap, stops the capture after the last frame of the window
+    static void endFrame()
+    {
+        State& capture = state();
+        if (!capture.file)
+            return;
+        begin(CALL_FRAME);
+        if (capture.windowFramesLeft > 0 && !capture.windowStarting && --capture.windowFramesLeft == 0)
+            stop();
+    }
+
+    // also when the window did not end yet, the replay then has fewer frames or none
+    static void stop()
+    {
+        State& capture = state();
+        if (!capture.file)
+            return;
+        begin(CALL_END);
+        hook(false);
+        capture.windowFramesLeft = 0;
+        capture.windowStarting = false;
+        long bytes = ftell(capture.file);
+        fclose(capture.file);
+        capture.file = nullptr;
+        std::cout << "Capture: wrote " << capture.windowCalls << " calls of the replayed frames, " << bytes / 1048576.0f
+                  << " MB in all, to " << capture.path << std::endl;
+    }
+
+    // names have to stay valid until the capture ends, the profiler passes its string literals
+    static void beginPass(const char* name)
+    {
+        if (!capturing())
+            return;
+        begin(CALL_PASS_BEGIN);
+        putString(name, strlen(name));
+    }
+
+    static void endPass()
+    {
+        if (capturing())
+            begin(CALL_PASS_END);
+    }
+
+    // bytes of a pixel rectangle as glTexImage reads it, with the given unpack row length, image height and alignment
+    static uint64_t imageSize(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type,
+                              GLint rowLength = 0, GLint imageHeight = 0, GLint alignment = 4)
+    {
+        if (width <= 0 || height <= 0 || depth <= 0)
+            return 0;
+        uint64_t components = 4;
+        switch (format)
+        {
+        case GL_RED: case GL_GREEN: case GL_BLUE: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: case GL_STENCIL_INDEX:
+            components = 1; break;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL:
+            components = 2; break;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: case GL_BGR_INTEGER:
+            components = 3; break;
+        }
+        uint64_t pixel;
+        switch (type)
+        {
+        case GL_UNSIGNED_BYTE: case GL_BYTE:
+            pixel = components; break;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT:
+            pixel = components * 2; break;
+        case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1:
+            pixel = 2; break;
+        case GL_FLOAT_32_UNSIGNED_INT_24_8_REV:
+            pixel = 8; break;
+        case GL_UNSIGNED_INT_24_8: case GL_UNSIGNED_INT_10F_11F_11F_REV: case GL_UNSIGNED_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_8_8_8_8: case GL_UNSIGNED_INT_8_8_8_8_REV: case GL_UNSIGNED_INT_5_9_9_9_REV:
+            pixel = 4; break;
+        default:
+            pixel = components * 4; break;
+        }
+        uint64_t rowBytes = (rowLength > 0 ? rowLength : width) * pixel;
+        rowBytes = (rowBytes + alignment - 1) / alignment * alignment;
+        uint64_t rows = imageHeight > 0 ? imageHeight : height;
+        return rowBytes * (rows * (depth - 1) + height - 1) + width * pixel;
+    }
+
+private:
+    struct Mapping
+    {
+        void* data;
+        GLsizeiptr length;
+        bool write;
+    };
+
+    struct State
+    {
+        FILE* file = nullptr;
+        std::string path;
+        int windowFramesLeft = 0;
+        bool windowStarting = false;
+        int windowCalls = 0;
+        std::unordered_map<GLenum, Mapping> mappings;     // by target
+        GLint unpackAlignment = 4, unpackRowLength = 0, unpackImageHeight = 0;
+    };
+
+    static State& state()
+    {
+        static State capture;
+        return capture;
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_arithmetic<T>::value>::type put(T value)
+    {
+        fwrite(&value, sizeof(value), 1, state().file);
+    }
+
+    template <typename T>
+    static typename std::enable_if<std::is_pointer<T>::value>::type put(T value)
+    {
+        put((uint64_t)(uintptr_t)value);
+    }
+
+    static void putData(const void* data, uint64_t size)
+    {
+        put((uint8_t)(data != nullptr));
+        if (!data)
+            return;
+        put(size);
+        fwrite(data, 1, (size_t)size, state().file);
+    }
+
+    static void putString(const char* text, size_t length)
+    {
+        put((uint32_t)length);
+        fwrite(text, 1, length, state().file);
+    }
+
+    static void begin(Call call)
+    {
+        put((uint16_t)call);
+        if (state().windowFramesLeft > 0 && !state().windowStarting)
+            state().windowCalls++;
+    }
+
+    template <typename... Args>
+    static void record(Call call, Args... args)
+    {
+        begin(call);
+        // braced so the arguments are written in order
+        int order[] = { 0, (put(args), 0)... };
+        (void)order;
+    }
+
+    // the function glad called before the hook went in, one per function
+    template <int Id, typename Function>
+    static Function& original()
+    {
+        static Function function = nullptr;
+        return function;
+    }
+
+    template <int Id, typename Function>
+    struct Hook;
+
+    template <int Id, typename R, typename... Args>
+    struct Hook<Id, R (APIENTRYP)(Args...)>
+    {
+        static R APIENTRY call(Args... args)
+        {
+            record((Call)Id, args...);
+            return original<Id, R (APIENTRYP)(Args...)>()(args...);
+        }
+    };
+
+    static void hook(bool install)
+    {
+#define GL_CAPTURE_HOOK(name, ...) \
+        if (install) \
+        { \
+            original<CALL_##name, decltype(glad_debug_##name)>() = glad_debug_##name; \
+            glad_debug_##name = Hook<CALL_##name, decltype(glad_debug_##name)>::call; \
+        } \
+        else \
+            glad_debug_##name = original<CALL_##name, decltype(glad_debug_##name)>();
+#define GL_CAPTURE_SPECIAL_HOOK(name) \
+        if (install) \
+        { \
+            original<CALL_##name, decltype(glad_debug_##name)>() = glad_debug_##name; \
+            glad_debug_##name = capture_##name; \
+        } \
+        else \
+            glad_debug_##name = original<CALL_##name, decltype(glad_debug_##name)>();
+        GL_CAPTURE_FUNCTIONS(GL_CAPTURE_HOOK)
+        GL_CAPTURE_SPECIAL_FUNCTIONS(GL_CAPTURE_SPECIAL_HOOK)
+#undef GL_CAPTURE_HOOK
+#undef GL_CAPTURE_SPECIAL_HOOK
+    }
+
+#define GL_CAPTURE_ORIGINAL(name) original<CALL_##name, decltype(glad_debug_##name)>()
+
+    static void APIENTRY capture_glBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        record(CALL_glBufferData, target, size);
+        putData(data, size);
+        put(usage);
+        GL_CAPTURE_ORIGINAL(glBufferData)(target, size, data, usage);
+    }
+
+    static void APIENTRY capture_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+    {
+        record(CALL_glBufferSubData, target, offset, size);
+        putData(data, size);
+        GL_CAPTURE_ORIGINAL(glBufferSubData)(target, offset, size, data);
+    }
+
+    // what the app got back is recorded after the call, the replay maps it to what it gets
+    static GLuint APIENTRY capture_glCreateProgram()
+    {
+        GLuint program = GL_CAPTURE_ORIGINAL(glCreateProgram)();
+        record(CALL_glCreateProgram, program);
+        return program;
+    }
+
+    static GLuint APIENTRY capture_glCreateShader(GLenum type)
+    {
+        GLuint shader = GL_CAPTURE_ORIGINAL(glCreateShader)(type);
+        record(CALL_glCreateShader, type, shader);
+        return shader;
+    }
+
+    static void putNames(Call call, GLsizei n, const GLuint* names)
+    {
+        record(call, n);
+        for (GLsizei i = 0; i < n; i++)
+            put(names[i]);
+    }
+
+    static void APIENTRY capture_glGenBuffers(GLsizei n, GLuint* names)
+    {
+        GL_CAPTURE_ORIGINAL(glGenBuffers)(n, names);
+        putNames(CALL_glGenBuffers, n, names);
+    }
+
+    static void APIENTRY capture_glGenFramebuffers(GLsizei n, GLuint* names)
+    {
+        GL_CAPTURE_ORIGINAL(glGenFramebuffers)(n, names);
+        putNames(CALL_glGenFramebuffers, n, names);
+    }
+
+    static void APIENTRY capture_glGenQueries(GLsizei n, GLuint* names)
+    {
+        GL_CAPTURE_ORIGINAL(glGenQueries)(n, names);
+        putNames(CALL_glGenQueries, n, names);
+    }
+
+    static void APIENTRY capture_glGenTextures(GLsizei n, GLuint* names)
+    {
+        GL_CAPTURE_ORIGINAL(glGenTextures)(n, names);
+        putNames(CALL_glGenTextures, n, names);
+    }
+
+    static void APIENTRY capture_glGenVertexArrays(GLsizei n, GLuint* names)
+    {
+        GL_CAPTURE_ORIGINAL(glGenVertexArrays)(n, names);
+        putNames(CALL_glGenVertexArrays, n, names);
+    }
+
+    static void APIENTRY capture_glDeleteBuffers(GLsizei n, const GLuint* names)
+    {
+        putNames(CALL_glDeleteBuffers, n, names);
+        GL_CAPTURE_ORIGINAL(glDeleteBuffers)(n, names);
+    }
+
+    static void APIENTRY capture_glDeleteFramebuffers(GLsizei n, const GLuint* names)
+    {
+        putNames(CALL_glDeleteFramebuffers, n, names);
+        GL_CAPTURE_ORIGINAL(glDeleteFramebuffers)(n, names);
+    }
+
+    static void APIENTRY capture_glDeleteQueries(GLsizei n, const GLuint* names)
+    {
+        putNames(CALL_glDeleteQueries, n, names);
+        GL_CAPTURE_ORIGINAL(glDeleteQueries)(n, names);
+    }
+
+    static void APIENTRY capture_glDeleteTextures(GLsizei n, const GLuint* names)
+    {
+        putNames(CALL_glDeleteTextures, n, names);
+        GL_CAPTURE_ORIGINAL(glDeleteTextures)(n, names);
+    }
+
+    static void APIENTRY capture_glDeleteVertexArrays(GLsizei n, const GLuint* names)
+    {
+        putNames(CALL_glDeleteVertexArrays, n, names);
+        GL_CAPTURE_ORIGINAL(glDeleteVertexArrays)(n, names);
+    }
+
+    static void APIENTRY capture_glDrawBuffers(GLsizei n, const GLenum* buffers)
+    {
+        putNames(CALL_glDrawBuffers, n, buffers);
+        GL_CAPTURE_ORIGINAL(glDrawBuffers)(n, buffers);
+    }
+
+    static GLsync APIENTRY capture_glFenceSync(GLenum condition, GLbitfield flags)
+    {
+        GLsync sync = GL_CAPTURE_ORIGINAL(glFenceSync)(condition, flags);
+        record(CALL_glFenceSync, condition, flags, sync);
+        return sync;
+    }
+
+    static GLuint APIENTRY capture_glGetUniformBlockIndex(GLuint program, const GLchar* name)
+    {
+        GLuint index = GL_CAPTURE_ORIGINAL(glGetUniformBlockIndex)(program, name);
+        record(CALL_glGetUniformBlockIndex, program);
+        putString(name, strlen(name));
+        put(index);
+        return index;
+    }
+
+    static GLint APIENTRY capture_glGetUniformLocation(GLuint program, const GLchar* name)
+    {
+        GLint location = GL_CAPTURE_ORIGINAL(glGetUniformLocation)(program, name);
+        record(CALL_glGetUniformLocation, program);
+        putString(name, strlen(name));
+        put(location);
+        return location;
+    }
+
+    // the data goes into the file when the buffer is unmapped
+    static void* APIENTRY capture_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+    {
+        void* data = GL_CAPTURE_ORIGINAL(glMapBufferRange)(target, offset, length, access);
+        record(CALL_glMapBufferRange, target, offset, length, access);
+        state().mappings[target] = { data, length, (access & GL_MAP_WRITE_BIT) != 0 };
+        return data;
+    }
+
+    static GLboolean APIENTRY capture_glUnmapBuffer(GLenum target)
+    {
+        record(CALL_glUnmapBuffer, target);
+        auto found = state().mappings.find(target);
+        bool written = found != state().mappings.end() && found->second.write && found->second.data;
+        putData(written ? found->second.data : nullptr, written ? found->second.length : 0);
+        if (found != state().mappings.end())
+            state().mappings.erase(found);
+        return GL_CAPTURE_ORIGINAL(glUnmapBuffer)(target);
+    }
+
+    static void APIENTRY capture_glPixelStorei(GLenum name, GLint value)
+    {
+        record(CALL_glPixelStorei, name, value);
+        State& capture = state();
+        if (name == GL_UNPACK_ALIGNMENT)
+            capture.unpackAlignment = value;
+        else if (name == GL_UNPACK_ROW_LENGTH)
+            capture.unpackRowLength = value;
+        else if (name == GL_UNPACK_IMAGE_HEIGHT)
+            capture.unpackImageHeight = value;
+        GL_CAPTURE_ORIGINAL(glPixelStorei)(name, value);
+    }
+
+    // the sources of all strings go in as one
+    static void APIENTRY capture_glShaderSource(GLuint shader, GLsizei count, const GLchar* const* strings, const GLint* lengths)
+    {
+        std::string source;
+        for (GLsizei i = 0; i < count; i++)
+            source.append(strings[i], lengths && lengths[i] >= 0 ? lengths[i] : strlen(strings[i]));
+        record(CALL_glShaderSource, shader);
+        putString(source.data(), source.size());
+        GL_CAPTURE_ORIGINAL(glShaderSource)(shader, count, strings, lengths);
+    }
+
+    static void APIENTRY capture_glTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+                                              GLint border, GLenum format, GLenum type, const void* pixels)
+    {
+        const State& capture = state();
+        record(CALL_glTexImage2D, target, level, internalFormat, width, height, border, format, type);
+        putData(pixels, imageSize(width, height, 1, format, type, capture.unpackRowLength, 0, capture.unpackAlignment));
+        GL_CAPTURE_ORIGINAL(glTexImage2D)(target, level, internalFormat, width, height, border, format, type, pixels);
+    }
+
+    static void APIENTRY capture_glTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height,
+                                              GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels)
+    {
+        const State& capture = state();
+        record(CALL_glTexImage3D, target, level, internalFormat, width, height, depth, border, format, type);
+        putData(pixels, imageSize(width, height, depth, format, type, capture.unpackRowLength, capture.unpackImageHeight,
+                                  capture.unpackAlignment));
+        GL_CAPTURE_ORIGINAL(glTexImage3D)(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+    }
+
+    static void APIENTRY capture_glTexParameterfv(GLenum target, GLenum name, const GLfloat* values)
+    {
+        record(CALL_glTexParameterfv, target, name);
+        putData(values, (name == GL_TEXTURE_BORDER_COLOR ? 4 : 1) * sizeof(GLfloat));
+        GL_CAPTURE_ORIGINAL(glTexParameterfv)(target, name, values);
+    }
+
+    static void putUniforms(Call call, GLint location, GLsizei count, const GLfloat* values, int size)
+    {
+        record(call, location, count);
+        putData(values, (uint64_t)count * size * sizeof(GLfloat));
+    }
+
+    static void APIENTRY capture_glUniform1fv(GLint location, GLsizei count, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniform1fv, location, count, values, 1);
+        GL_CAPTURE_ORIGINAL(glUniform1fv)(location, count, values);
+    }
+
+    static void APIENTRY capture_glUniform2fv(GLint location, GLsizei count, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniform2fv, location, count, values, 2);
+        GL_CAPTURE_ORIGINAL(glUniform2fv)(location, count, values);
+    }
+
+    static void APIENTRY capture_glUniform3fv(GLint location, GLsizei count, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniform3fv, location, count, values, 3);
+        GL_CAPTURE_ORIGINAL(glUniform3fv)(location, count, values);
+    }
+
+    static void APIENTRY capture_glUniform4fv(GLint location, GLsizei count, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniform4fv, location, count, values, 4);
+        GL_CAPTURE_ORIGINAL(glUniform4fv)(location, count, values);
+    }
+
+    // the transpose flag goes last, after the values
+    static void APIENTRY capture_glUniformMatrix2fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniformMatrix2fv, location, count, values, 4);
+        put(transpose);
+        GL_CAPTURE_ORIGINAL(glUniformMatrix2fv)(location, count, transpose, values);
+    }
+
+    static void APIENTRY capture_glUniformMatrix3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniformMatrix3fv, location, count, values, 9);
+        put(transpose);
+        GL_CAPTURE_ORIGINAL(glUniformMatrix3fv)(location, count, transpose, values);
+    }
+
+    static void APIENTRY capture_glUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* values)
+    {
+        putUniforms(CALL_glUniformMatrix4fv, location, count, values, 16);
+        put(transpose);
+        GL_CAPTURE_ORIGINAL(glUniformMatrix4fv)(location, count, transpose, values);
+    }
+
+#undef GL_CAPTURE_ORIGINAL
+};
+
+#endif
@@ -0,0 +1,446 @@
+#ifndef GL_STATS_H
+#define GL_STATS_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <cstdarg>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <iostream>
+
+// Counts the GL calls of every frame by category, in total and per named pass, and how many of them changed
+// nothing (binding what is already bound, enabling what is already enabled, ...).
+// glad is generated in debug mode, so every GL macro goes through a wrapper that calls glad's pre callback with
+// the function and its arguments before the real call. The interposer is that callback, installed while the
+// statistics are enabled; the wrappers themselves and their glGetError after each call are always there.
+// Bound state is tracked from the calls it sees, starting out unknown, so the first bind of anything never counts
+// as redundant and state set behind its back (by another library with its own loader) is not noticed.
+// Calls count towards the innermost pass that is open (beginPass()/endPass(), the profiler scopes open them),
+// calls outside of every pass only towards the frame.
+// Optionally it also collects the performance messages of KHR_debug (core in GL 4.3), which drivers mostly send
+// to debug contexts only.
+// GL is only called from the thread that owns the context, so none of this locks.
+class GlStats
+{
+public:
+    enum Category
+    {
+        DRAW,
+        DISPATCH,
+        PROGRAM,
+        TEXTURE,            // texture, image and sampler binds and active texture units
+        BUFFER,             // buffer binds, indexed or not
+        VERTEX_ARRAY,
+        FRAMEBUFFER,        // framebuffer and renderbuffer binds
+        UPLOAD,             // buffer and texture data, mapping
+        UNIFORM,
+        STATE,              // fixed function state, viewport, clears
+        GET,                // queries of GL state, which can stall the driver
+        QUERY_SYNC,         // query objects and fences
+        OTHER,
+        CATEGORY_COUNT
+    };
+
+    struct Counts
+    {
+        int calls[CATEGORY_COUNT] = {};
+        int redundant[CATEGORY_COUNT] = {};
+        int64_t uploadBytes = 0;        // sizes given to glBufferData, glBufferSubData and glMapBufferRange
+        int debugMessages = 0;
+
+        int totalCalls() const
+        {
+            int total = 0;
+            for (int calls : this->calls)
+                total += calls;
+            return total;
+        }
+
+        int totalRedundant() const
+        {
+            int total = 0;
+            for (int redundant : this->redundant)
+                total += redundant;
+            return total;
+        }
+    };
+
+    struct Pass
+    {
+        std::string name;
+        Counts counts;
+    };
+
+    struct DebugMessage
+    {
+        GLuint id;
+        int count;
+        std::string text;
+    };
+
+    // the distinct debug messages kept, later ones are only counted
+    static const int MAX_DEBUG_MESSAGES = 64;
+
+    ~GlStats()
+    {
+        setEnabled(false);
+        setDebugMessages(false);
+    }
+
+    static const char* categoryName(int category)
+    {
+        static const char* names[CATEGORY_COUNT] = { "draw", "dispatch", "program", "texture", "buffer", "vertexArray",
+                                                     "framebuffer", "upload", "uniform", "state", "get", "querySync", "other" };
+        return names[category];
+    }
+
+    bool enabled() const
+    {
+        return active() == this;
+    }
+
+    // needs the GL functions loaded, the tracked state is forgotten while disabled
+    void setEnabled(bool enable)
+    {
+        if (enable == enabled())
+            return;
+        if (enable)
+        {
+            forgetState();
+            active() = this;
+            glad_set_pre_callback(onCall);
+        }
+        else
+        {
+            glad_set_pre_callback(ignoreCall);
+            active() = nullptr;
+        }
+    }
+
+    // false where the context has no KHR_debug
+    bool setDebugMessages(bool enable)
+    {
+        if (enable == debugMessagesOn)
+            return true;
+        if (!GLAD_GL_VERSION_4_3)
+            return false;
+        debugMessagesOn = enable;
+        if (enable)
+        {
+            // only the performance messages, synchronous so they arrive inside the call that caused them
+            glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, nullptr, GL_FALSE);
+            glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_PERFORMANCE, GL_DONT_CARE, 0, nullptr, GL_TRUE);
+            glDebugMessageCallback(onDebugMessage, this);
+            glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+            glEnable(GL_DEBUG_OUTPUT);
+        }
+        else
+        {
+            glDisable(GL_DEBUG_OUTPUT);
+            glDebugMessageCallback(nullptr, nullptr);
+        }
+        return true;
+    }
+
+    void beginPass(const char* name)
+    {
+        if (!enabled())
+            return;
+        size_t index = 0;
+        while (index < currentPasses.size() && currentPasses[index].name != name)
+            index++;
+        if (index == currentPasses.size())
+            currentPasses.push_back({ name, Counts() });
+        open.push_back((int)index);
+    }
+
+    void endPass()
+    {
+        if (!open.empty())
+            open.pop_back();
+    }
+
+    // call once per frame, after the swap, what was counted since the last call becomes the last frame
+    void endFrame()
+    {
+        lastFrame = current;
+        current = Counts();
+        lastPasses.resize(currentPasses.size());
+        for (size_t i = 0; i < currentPasses.size(); i++)
+        {
+            lastPasses[i] = currentPasses[i];
+            currentPasses[i].counts = Counts();
+        }
+    }
+
+    // the last frame, all zero when the statistics were off
+    const Counts& frame() const
+    {
+        return lastFrame;
+    }
+
+    // every pass seen so far in the order they first ran, with their counts of the last frame
+    const std::vector<Pass>& passes() const
+    {
+        return lastPasses;
+    }
+
+    const std::vector<DebugMessage>& debugMessages() const
+    {
+        return messages;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xffffffffu;
+
+    Counts current, lastFrame;
+    std::vector<Pass> currentPasses, lastPasses;
+    std::vector<int> open;                  // indices into currentPasses, innermost last
+    std::vector<DebugMessage> messages;
+    bool debugMessagesOn = false;
+
+    std::unordered_map<void*, Category> categories;     // by function, filled in as they are first called
+
+    // bound state as far as the calls seen tell, UNKNOWN or missing when they do not
+    GLuint program = UNKNOWN;
+    GLuint activeTexture = UNKNOWN;
+    std::unordered_map<uint64_t, GLuint> textures;         // by texture unit and target
+    std::unordered_map<uint64_t, GLuint> buffers;          // by target, and by target and index for indexed bindings
+    GLuint vertexArray = UNKNOWN;
+    GLuint drawFramebuffer = UNKNOWN, readFramebuffer = UNKNOWN;
+    std::unordered_map<GLenum, bool> capabilities;
+    GLenum blendSource = UNKNOWN, blendDestination = UNKNOWN;
+    GLenum depthFunc = UNKNOWN;
+    GLuint depthMask = UNKNOWN;
+
+    // the callback has no user pointer
+    static GlStats*& active()
+    {
+        static GlStats* stats = nullptr;
+        return stats;
+    }
+
+    void forgetState()
+    {
+        program = activeTexture = vertexArray = drawFramebuffer = readFramebuffer = UNKNOWN;
+        blendSource = blendDestination = depthFunc = depthMask = UNKNOWN;
+        textures.clear();
+        buffers.clear();
+        capabilities.clear();
+    }
+
+    static bool startsWith(const char* name, const char* prefix)
+    {
+        return !strncmp(name, prefix, strlen(prefix));
+    }
+
+    // by the name glad passes, only once per function
+    static Category categorize(const char* name)
+    {
+        if (startsWith(name, "glDrawBuffer"))
+            return STATE;
+        if (startsWith(name, "glDraw") || startsWith(name, "glMultiDraw"))
+            return DRAW;
+        if (startsWith(name, "glDispatchCompute"))
+            return DISPATCH;
+        if (!strcmp(name, "glUseProgram"))
+            return PROGRAM;
+        if (!strcmp(name, "glBindTexture") || !strcmp(name, "glActiveTexture") || startsWith(name, "glBindImageTexture") ||
+            startsWith(name, "glBindSampler"))
+            return TEXTURE;
+        if (startsWith(name, "glBindBuffer"))
+            return BUFFER;
+        if (!strcmp(name, "glBindVertexArray"))
+            return VERTEX_ARRAY;
+        if (!strcmp(name, "glBindFramebuffer") || !strcmp(name, "glBindRenderbuffer"))
+            return FRAMEBUFFER;
+        if (startsWith(name, "glBufferData") || startsWith(name, "glBufferSubData") || startsWith(name, "glMapBuffer") ||
+            startsWith(name, "glUnmapBuffer") || startsWith(name, "glFlushMappedBufferRange") ||
+            startsWith(name, "glCopyBufferSubData") || startsWith(name, "glTexImage") || startsWith(name, "glTexSubImage") ||
+            startsWith(name, "glTexStorage") || startsWith(name, "glCompressedTex"))
+            return UPLOAD;
+        if (startsWith(name, "glUniform") || startsWith(name, "glProgramUniform"))
+            return UNIFORM;
+        if (startsWith(name, "glGet") || startsWith(name, "glIs") || !strcmp(name, "glCheckFramebufferStatus"))
+            return GET;
+        if (startsWith(name, "glBeginQuery") || startsWith(name, "glEndQuery") || !strcmp(name, "glQueryCounter") ||
+            startsWith(name, "glGenQueries") || startsWith(name, "glDeleteQueries") || startsWith(name, "glFenceSync") ||
+            startsWith(name, "glClientWaitSync") || startsWith(name, "glWaitSync") || startsWith(name, "glDeleteSync"))
+            return QUERY_SYNC;
+        static const char* state[] = { "glEnable", "glDisable", "glBlend", "glDepth", "glCull", "glFrontFace", "glViewport",
+                                       "glScissor", "glColorMask", "glStencil", "glPolygon", "glClear", "glPixelStore",
+                                       "glLineWidth", "glPointSize", "glReadBuffer", "glSampleCoverage", "glMemoryBarrier" };
+        for (const char* prefix : state)
+            if (startsWith(name, prefix))
+                return STATE;
+        return OTHER;
+    }
+
+    // whether the call leaves the tracked state as it was, and updates it
+    bool redundant(void* function, va_list args, int64_t& bytes)
+    {
+        if (function == (void*)glUseProgram)
+            return same(program, va_arg(args, GLuint));
+        if (function == (void*)glActiveTexture)
+            return same(activeTexture, va_arg(args, GLenum));
+        if (function == (void*)glBindTexture)
+        {
+            GLenum target = va_arg(args, GLenum);
+            uint64_t key = (uint64_t)activeTexture << 32 | target;
+            return activeTexture != UNKNOWN && same(textures, key, va_arg(args, GLuint));
+        }
+        if (function == (void*)glBindBuffer)
+        {
+            GLenum target = va_arg(args, GLenum);
+            return same(buffers, target, va_arg(args, GLuint));
+        }
+        if (function == (void*)glBindBufferBase || function == (void*)glBindBufferRange)
+        {
+            // both also bind the buffer to the target itself, a range is only redundant in the bind to the target
+            GLenum target = va_arg(args, GLenum);
+            GLuint index = va_arg(args, GLuint);
+            GLuint buffer = va_arg(args, GLuint);
+            buffers[target] = buffer;
+            if (function == (void*)glBindBufferRange)
+            {
+                buffers.erase((uint64_t)(index + 1) << 32 | target);
+                return false;
+            }
+            return same(buffers, (uint64_t)(index + 1) << 32 | target, buffer);
+        }
+        if (function == (void*)glBindVertexArray)
+        {
+            // the element array buffer is part of the vertex array
+            buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+            return same(vertexArray, va_arg(args, GLuint));
+        }
+        if (function == (void*)glBindFramebuffer)
+        {
+            GLenum target = va_arg(args, GLenum);
+            GLuint framebuffer = va_arg(args, GLuint);
+            if (target == GL_DRAW_FRAMEBUFFER)
+                return same(drawFramebuffer, framebuffer);
+            if (target == GL_READ_FRAMEBUFFER)
+                return same(readFramebuffer, framebuffer);
+            bool unchanged = drawFramebuffer == framebuffer && readFramebuffer == framebuffer;
+            drawFramebuffer = readFramebuffer = framebuffer;
+            return unchanged;
+        }
+        if (function == (void*)glEnable || function == (void*)glDisable)
+        {
+            bool enable = function == (void*)glEnable;
+            auto found = capabilities.emplace(va_arg(args, GLenum), enable);
+            if (found.second)
+                return false;
+            bool unchanged = found.first->second == enable;
+            found.first->second = enable;
+            return unchanged;
+        }
+        if (function == (void*)glBlendFunc)
+        {
+            GLenum source = va_arg(args, GLenum);
+            GLenum destination = va_arg(args, GLenum);
+            bool unchanged = blendSource == source && blendDestination == destination;
+            blendSource = source;
+            blendDestination = destination;
+            return unchanged;
+        }
+        if (function == (void*)glDepthFunc)
+            return same(depthFunc, va_arg(args, GLenum));
+        if (function == (void*)glDepthMask)
+            return same(depthMask, (GLuint)va_arg(args, int));
+
+        if (function == (void*)glBufferData || function == (void*)glBufferSubData || function == (void*)glMapBufferRange)
+        {
+            va_arg(args, GLenum);
+            if (function != (void*)glBufferData)
+                va_arg(args, GLintptr);
+            bytes = va_arg(args, GLsizeiptr);
+        }
+        // deleting a bound object unbinds it, which of them is not worth tracking
+        else if (function == (void*)glDeleteTextures)
+            textures.clear();
+        else if (function == (void*)glDeleteBuffers)
+            buffers.clear();
+        else if (function == (void*)glDeleteVertexArrays)
+            vertexArray = UNKNOWN;
+        else if (function == (void*)glDeleteFramebuffers)
+            drawFramebuffer = readFramebuffer = UNKNOWN;
+        else if (function == (void*)glDeleteProgram)
+            program = UNKNOWN;
+        else if (function == (void*)glBlendFuncSeparate)
+            blendSource = blendDestination = UNKNOWN;
+        return false;
+    }
+
+    static bool same(GLuint& tracked, GLuint value)
+    {
+        bool unchanged = tracked == value;
+        tracked = value;
+        return unchanged;
+    }
+
+    static bool same(std::unordered_map<uint64_t, GLuint>& tracked, uint64_t key, GLuint value)
+    {
+        auto found = tracked.emplace(key, value);
+        if (found.second)
+            return false;
+        bool unchanged = found.first->second == value;
+        found.first->second = value;
+        return unchanged;
+    }
+
+    void count(Counts& counts, Category category, bool isRedundant, int64_t bytes)
+    {
+        counts.calls[category]++;
+        counts.redundant[category] += isRedundant;
+        counts.uploadBytes += bytes;
+    }
+
+    // glad passes the function it is about to call, which is what the GL macros point to, and its arguments
+    static void onCall(const char* name, void* function, int argumentCount, ...)
+    {
+        GlStats* stats = active();
+        auto found = stats->categories.find(function);
+        if (found == stats->categories.end())
+            found = stats->categories.emplace(function, categorize(name)).first;
+
+        int64_t bytes = 0;
+        va_list args;
+        va_start(args, argumentCount);
+        bool isRedundant = stats->redundant(function, args, bytes);
+        va_end(args);
+
+        stats->count(stats->current, found->second, isRedundant, bytes);
+        if (!stats->open.empty())
+            stats->count(stats->currentPasses[stats->open.back()].counts, found->second, isRedundant, bytes);
+    }
+
+    static void ignoreCall(const char*, void*, int, ...)
+    {
+    }
+
+    static void APIENTRY onDebugMessage(GLenum, GLenum, GLuint id, GLenum, GLsizei length, const GLchar* message, const void* user)
+    {
+        GlStats* stats = (GlStats*)user;
+        stats->current.debugMessages++;
+        if (!stats->open.empty())
+            stats->currentPasses[stats->open.back()].counts.debugMessages++;
+        for (DebugMessage& known : stats->messages)
+            if (known.id == id)
+            {
+                known.count++;
+                return;
+            }
+        if ((int)stats->messages.size() == MAX_DEBUG_MESSAGES)
+            return;
+        std::string text = length < 0 ? std::string(message) : std::string(message, length);
+        std::cout << "GL performance: " << text << std::endl;
+        stats->messages.push_back({ id, 1, text });
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// Wraps a GL query object (GL_TIME_ELAPSED, GL_SAMPLES_PASSED, ...) around the commands between begin() and end().
+// Results arrive a few frames late, so a small ring of queries is used and only queries whose
+// result is already available are read, this way the CPU never waits on the GPU.
+class GpuQuery
+{
+public:
+    double result = 0.0;    // latest result, smoothed over time when smoothing > 0
+
+    GpuQuery(GLenum target, float smoothing = 0.0f) : target(target), smoothing(smoothing)
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    ~GpuQuery()
+    {
+        glDeleteQueries(QUERY_COUNT, queries);
+    }
+
+    void begin()
+    {
+        // collect the oldest query first, if it is still in flight skip this measurement
+        if (pending[current] && !collect(current))
+        {
+            skipped = true;
+            return;
+        }
+        skipped = false;
+        glBeginQuery(target, queries[current]);
+    }
+
+    void end()
+    {
+        if (skipped)
+            return;
+        glEndQuery(target);
+        pending[current] = true;
+        current = (current + 1) % QUERY_COUNT;
+
+        // pick up anything that finished in the meantime
+        for (int i = 0; i < QUERY_COUNT; i++)
+            if (pending[i])
+                collect(i);
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    GLenum target;
+    float smoothing;
+    unsigned int queries[QUERY_COUNT];
+    bool pending[QUERY_COUNT] = {};
+    int current = 0;
+    bool skipped = false;
+    bool hasResult = false;
+
+    bool collect(int i)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return false;
+
+        GLuint64 value = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &value);
+        pending[i] = false;
+
+        result = hasResult ? result * smoothing + value * (1.0 - smoothing) : (double)value;
+        hasResult = true;
+        return true;
+    }
+};
+
+// Measures how long the GPU takes to execute the commands between begin() and end()
+class GpuTimer : public GpuQuery
+{
+public:
+    GpuTimer() : GpuQuery(GL_TIME_ELAPSED, 0.9f)
+    {
+    }
+
+    float milliseconds() const
+    {
+        return (float)(result / 1000000.0);
+    }
+};
+
+#endif
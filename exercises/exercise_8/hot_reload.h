@@ -0,0 +1,339 @@
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <iostream>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <shader.h>
+#include <model.h>
+#include <trace.h>
+
+// Reloads shaders, textures and models while the application runs when their files are written. Only what is read
+// from the changed file is touched:
+//   - a shader file compiles every program reading it again, in the background like at startup (shader_compiler.h).
+//     Each program stays in use until its new one is linked, and for good when that does not compile
+//   - an image is decoded on a thread of its own, then uploaded into the textures read from it, under the same IDs
+//   - an OBJ, or the MTL next to it, is imported on a thread of its own, then its meshes are uploaded into the
+//     buffers they already have (Model::upload)
+// The files are watched with inotify and read without blocking once a frame, on other platforms nothing is watched.
+// The paths are relative to the working directory like the loaders' ones, so edit the copies in the build folder.
+// Every reload prints how long it took from the file being written to the new resource being in use.
+class HotReload
+{
+public:
+    struct Reload
+    {
+        std::string file;
+        int programs = 0, textures = 0, models = 0;
+        int failed = 0;             // kept what they had
+        float seenMs = 0.0f;        // from the write to the watcher reading it
+        float latencyMs = 0.0f;     // from the write to the reloaded resources in use
+    };
+    static const int HISTORY = 5;
+
+    // called after the meshes of a model were uploaded again, for what depends on them
+    std::function<void(Model*)> modelReloaded;
+
+    explicit HotReload(const std::vector<std::string>& directories)
+    {
+#ifdef __linux__
+        watcher = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watcher < 0)
+        {
+            std::cout << "Hot reload: inotify is not available" << std::endl;
+            return;
+        }
+        for (const std::string& directory : directories)
+        {
+            // editors either write the file in place or move a new one over it
+            int watch = inotify_add_watch(watcher, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (watch < 0)
+                std::cout << "Hot reload: cannot watch " << directory << std::endl;
+            else
+                watches.push_back({ watch, directory });
+        }
+#endif
+    }
+
+    // waits for the imports still running
+    ~HotReload()
+    {
+#ifdef __linux__
+        if (watcher >= 0)
+            close(watcher);
+#endif
+    }
+
+    HotReload(const HotReload&) = delete;
+    HotReload& operator=(const HotReload&) = delete;
+
+    int watchedDirectories() const
+    {
+        return (int)watches.size();
+    }
+
+    void addModel(Model* model)
+    {
+        models.push_back(model);
+    }
+
+    // a texture outside the models, upload gets the decoded image of file
+    void addTexture(const std::string& file, std::function<void(const TextureImage&)> upload)
+    {
+        textures.push_back({ file, upload });
+    }
+
+    // the last reloads, newest last
+    const std::vector<Reload>& history() const
+    {
+        return done;
+    }
+
+    int reloading() const
+    {
+        return (int)pending.size();
+    }
+
+    // reads the changes and applies the reloads that are ready, once a frame on the render thread
+    void update()
+    {
+        TRACE_SCOPE("Hot reload");
+        for (const auto& change : readChanges())
+            changed(change.first, change.second);
+
+        std::vector<std::string> again;
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (!progress(pending[i]))
+            {
+                i++;
+                continue;
+            }
+            Pending& finished = pending[i];
+            finished.reload.latencyMs = millisecondsSince(finished.written);
+            report(finished.reload);
+            if (finished.writtenAgain)
+                again.push_back(finished.reload.file);
+            done.push_back(finished.reload);
+            if ((int)done.size() > HISTORY)
+                done.erase(done.begin());
+            pending.erase(pending.begin() + i);
+        }
+        // written while it was reloading, what was read may have been the old version
+        for (const std::string& file : again)
+            changed(file, std::chrono::steady_clock::now());
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending
+    {
+        Reload reload;
+        Clock::time_point written;
+        bool writtenAgain = false;
+        std::vector<Shader*> shaders;
+        std::vector<std::pair<Model*, std::future<Model::Data>>> models;
+        std::future<std::shared_ptr<TextureImage>> image;
+    };
+
+    int watcher = -1;
+    std::vector<std::pair<int, std::string>> watches;
+    std::vector<Model*> models;
+    std::vector<std::pair<std::string, std::function<void(const TextureImage&)>>> textures;
+    std::vector<Pending> pending;
+    std::vector<Reload> done;
+
+    static float millisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+    }
+
+    template <typename T>
+    static bool ready(const std::future<T>& result)
+    {
+        return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // the files written since the last call, each once, with when they were written
+    std::vector<std::pair<std::string, Clock::time_point>> readChanges()
+    {
+        std::vector<std::pair<std::string, Clock::time_point>> changes;
+#ifdef __linux__
+        if (watcher < 0)
+            return changes;
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(watcher, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* entry = buffer; entry < buffer + length; entry += sizeof(inotify_event) + ((inotify_event*)entry)->len)
+            {
+                const inotify_event* event = (const inotify_event*)entry;
+                if (!event->len)
+                    continue;
+                std::string file;
+                for (const auto& watch : watches)
+                    if (watch.first == event->wd)
+                        file = watch.second + '/' + event->name;
+                bool seen = false;
+                for (const auto& change : changes)
+                    seen |= change.first == file;
+                if (!file.empty() && !seen)
+                    changes.push_back({ file, writeTime(file) });
+            }
+        }
+#endif
+        return changes;
+    }
+
+    // the modification time of file on the steady clock, so the latency includes the wait for the next frame
+    static Clock::time_point writeTime(const std::string& file)
+    {
+        Clock::time_point now = Clock::now();
+#ifdef __linux__
+        struct stat status;
+        if (stat(file.c_str(), &status) == 0)
+        {
+            auto modified = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::seconds(status.st_mtim.tv_sec) + std::chrono::nanoseconds(status.st_mtim.tv_nsec)));
+            auto age = std::chrono::system_clock::now() - modified;
+            if (age > std::chrono::system_clock::duration::zero() && age < std::chrono::seconds(10))
+                return now - std::chrono::duration_cast<Clock::duration>(age);
+        }
+#endif
+        return now;
+    }
+
+    // starts reloading what is read from file
+    void changed(const std::string& file, Clock::time_point written)
+    {
+        for (Pending& reload : pending)
+            if (reload.reload.file == file)
+            {
+                reload.writtenAgain = true;
+                return;
+            }
+
+        Pending reload;
+        reload.reload.file = file;
+        reload.written = written;
+        reload.reload.seenMs = millisecondsSince(written);
+        for (Shader* shader : Shader::all())
+            if (shader->uses(file))
+                reload.shaders.push_back(shader);
+        // a material file is read by the models next to it
+        bool material = file.size() > 4 && file.compare(file.size() - 4, 4, ".mtl") == 0;
+        std::string directory = file.substr(0, file.find_last_of('/'));
+        for (Model* model : models)
+            if (model->path == file || (material && model->directory == directory))
+                reload.models.push_back({ model, std::async(std::launch::async, Model::import, model->path) });
+        bool image = false;
+        for (Model* model : models)
+            image |= model->usesTexture(file);
+        for (const auto& texture : textures)
+            image |= texture.first == file;
+        if (image)
+            reload.image = std::async(std::launch::async, [file]() { return std::make_shared<TextureImage>(file); });
+        if (reload.shaders.empty() && reload.models.empty() && !image)
+            return;     // nothing reads it, like the backups of editors
+
+        for (Shader* shader : reload.shaders)
+            shader->reload();
+        pending.push_back(std::move(reload));
+    }
+
+    // applies what is ready, true once everything is
+    bool progress(Pending& reload)
+    {
+        for (size_t i = 0; i < reload.shaders.size();)
+        {
+            if (!reload.shaders[i]->applyReload())
+            {
+                i++;
+                continue;
+            }
+            reload.reload.programs++;
+            reload.reload.failed += reload.shaders[i]->reloadFailed;
+            reload.shaders.erase(reload.shaders.begin() + i);
+        }
+
+        for (size_t i = 0; i < reload.models.size();)
+        {
+            if (!ready(reload.models[i].second))
+            {
+                i++;
+                continue;
+            }
+            Model* model = reload.models[i].first;
+            Model::Data data = reload.models[i].second.get();
+            reload.reload.models++;
+            if (data.loaded)
+            {
+                model->upload(data);
+                if (modelReloaded)
+                    modelReloaded(model);
+            }
+            else
+                reload.reload.failed++;
+            reload.models.erase(reload.models.begin() + i);
+        }
+
+        if (reload.image.valid() && ready(reload.image))
+        {
+            std::shared_ptr<TextureImage> image = reload.image.get();
+            for (Model* model : models)
+                if (model->usesTexture(reload.reload.file))
+                {
+                    reload.reload.textures++;
+                    if (image->data)
+                        model->reloadTexture(reload.reload.file, *image);
+                    else
+                        reload.reload.failed++;
+                }
+            for (const auto& texture : textures)
+                if (texture.first == reload.reload.file)
+                {
+                    reload.reload.textures++;
+                    if (image->data)
+                        texture.second(*image);
+                    else
+                        reload.reload.failed++;
+                }
+        }
+
+        return reload.shaders.empty() && reload.models.empty() && !reload.image.valid();
+    }
+
+    static void report(const Reload& reload)
+    {
+        std::string what;
+        auto add = [&what](int count, const char* name) {
+            if (count)
+                what += (what.empty() ? "" : ", ") + std::to_string(count) + " " + name + (count > 1 ? "s" : "");
+        };
+        add(reload.programs, "program");
+        add(reload.textures, "texture");
+        add(reload.models, "model");
+        printf("Hot reload: %s, %s done %.1f ms after the write (seen after %.1f ms)", reload.file.c_str(), what.c_str(),
+               reload.latencyMs, reload.seenMs);
+        if (reload.failed)
+            printf(", %d failed and kept the old one", reload.failed);
+        printf("\n");
+        fflush(stdout);
+    }
+};
+
+#endif
@@ -0,0 +1,123 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <algorithm>
+
+// Measures how long it takes for input to show up on screen.
+// The first input event after a latch is timestamped on the CPU, latch() hands it to the frame that is about
+// to use the camera, and a GL timestamp query issued after the swap tells when the GPU finished that frame.
+// GL timestamps are converted to CPU time with the offset between the two clocks sampled at the latch.
+// GLFW does not report when the OS received an event, so the time starts when glfwPollEvents delivers it.
+class LatencyProbe
+{
+public:
+    float averageMs = 0.0f;     // input to swap completion
+    float maxMs = 0.0f;         // largest over the last SAMPLE_COUNT frames with input
+    float inputAgeMs = 0.0f;    // how old the input was when the camera was latched
+
+    LatencyProbe()
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    ~LatencyProbe()
+    {
+        glDeleteQueries(QUERY_COUNT, queries);
+    }
+
+    // call for every event that moves the camera
+    void inputEvent()
+    {
+        if (!hasPendingInput)
+        {
+            pendingInput = now();
+            hasPendingInput = true;
+        }
+    }
+
+    // call when the camera of the frame is written, the input received until now is what the frame shows
+    void latch()
+    {
+        frameHasInput = hasPendingInput;
+        if (!hasPendingInput)
+            return;
+        hasPendingInput = false;
+        frameInput = pendingInput;
+
+        GLint64 gpuTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        long long cpuTime = now();
+        clockOffset = gpuTime - cpuTime;
+        inputAgeMs = (cpuTime - frameInput) / 1e6f;
+    }
+
+    // call right after glfwSwapBuffers
+    void frameSwapped()
+    {
+        if (frameHasInput && !pending[current])
+        {
+            glQueryCounter(queries[current], GL_TIMESTAMP);
+            inputTime[current] = frameInput;
+            offset[current] = clockOffset;
+            pending[current] = true;
+            current = (current + 1) % QUERY_COUNT;
+        }
+        frameHasInput = false;
+
+        for (int i = 0; i < QUERY_COUNT; i++)
+            if (pending[i])
+                collect(i);
+    }
+
+private:
+    static const int QUERY_COUNT = 4;
+    static const int SAMPLE_COUNT = 64;
+
+    unsigned int queries[QUERY_COUNT];
+    bool pending[QUERY_COUNT] = {};
+    long long inputTime[QUERY_COUNT] = {};
+    long long offset[QUERY_COUNT] = {};
+    int current = 0;
+
+    bool hasPendingInput = false, frameHasInput = false;
+    long long pendingInput = 0, frameInput = 0;
+    long long clockOffset = 0;
+
+    float samples[SAMPLE_COUNT] = {};
+    int sampleCount = 0, nextSample = 0;
+
+    static long long now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void collect(int i)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint64 gpuDone = 0;
+        glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &gpuDone);
+        pending[i] = false;
+
+        float latencyMs = ((long long)gpuDone - offset[i] - inputTime[i]) / 1e6f;
+        samples[nextSample] = latencyMs;
+        nextSample = (nextSample + 1) % SAMPLE_COUNT;
+        sampleCount = std::min(sampleCount + 1, (int)SAMPLE_COUNT);
+
+        float sum = 0.0f;
+        maxMs = 0.0f;
+        for (int s = 0; s < sampleCount; s++)
+        {
+            sum += samples[s];
+            maxMs = std::max(maxMs, samples[s]);
+        }
+        averageMs = sum / sampleCount;
+    }
+};
+
+#endif
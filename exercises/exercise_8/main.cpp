@@ -10,8 +10,29 @@
 //  I recommend that you read through the camera.h and model.h files to see if you can map the the previous
 //  lessons to this implementation
 #include "shader.h"
+#include "shader_variants.h"
 #include "camera.h"
 #include "model.h"
+#include "wetness.h"
+#include "rain_sheets.h"
+#include "rain_simulation.h"
+#include "cpu_rain.h"
+#include "thread_pool.h"
+#include "gpu_timer.h"
+#include "frame_pacer.h"
+#include "latency_probe.h"
+#include "simulation.h"
+#include "stress_scene.h"
+#include "streaming_buffer.h"
+#include "profiler.h"
+#include "gl_stats.h"
+#include "gl_capture.h"
+#include "trace.h"
+#include "bench_report.h"
+#include "camera_path.h"
+#include "hot_reload.h"
+#include "sky_irradiance.h"
+#include "validation.h"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -37,11 +58,20 @@ const unsigned int RAINSPLASH_WIDTH = 2048, RAINSPLASH_HEIGHT = 2048;
 // global variables used for rendering
 // -----------------------------------
 Shader* shader;
-Shader* pbr_shading;
+ShaderVariants* pbrVariants;        // pbr_shading.frag compiled for the features of each material and lighting pass
+std::vector<uint32_t> pbrMaterials; // the material features of the scene's meshes, one variant per lighting pass each
+uint32_t drawnMaterial = 0;         // drawObjects only draws the meshes with these material features
 Shader* shadowMap_shader;
 Shader* rainSplash_shader;
 Shader* particle_shader;
 Shader* splash_shader;
+Shader* rain_shader;
+Shader* rainStreamed_shader;
+Shader* depthDownsample_shader;
+Shader* particleComposite_shader;
+Shader* depthPrepass_shader;
+Shader* visibilityMask_shader;
+Shader* composite_shader;
 
 
 Model* carBodyModel;
@@ -69,24 +99,157 @@ GLuint splashTexture;
 
 Camera camera(glm::vec3(0.0f, 1.6f, 5.0f));
 
-// -- particle taken from ex 4
-const unsigned int particleSize = 3;            // particle attributes
-const unsigned int sizeOfFloat = 4;             // bytes in a float
-unsigned int particleId = 0;                    // keep track of last particle to be updated
-unsigned int particleVAO, particleVBO;
-const unsigned int numberOfparticles = 10000;
-const unsigned int vertexBufferSize = particleSize*sizeOfFloat*numberOfparticles;
+// -- particles, the drop positions are generated in the vertex shaders from gl_VertexID,
+// so no vertex buffer is needed. The VAO only holds the indices of one batch of rain quads.
+const int rainQuadsPerInstance = 64;
+unsigned int particleVAO, rainQuadEBO;
+
+// far field rain beyond the rain box
+RainSheets* rainSheets;
+
+// compute simulation with compacted indirect draws, null when the context is older than GL 4.3
+RainSimulation* rainSimulation = nullptr;
+const char* rainPathNames[] = { "vertex shader", "geometry shaders", "compute", "CPU" };
+
+// rain simulated on the CPU, as a reference for the GPU paths and as a fallback that streams the
+// visible drops into a buffer texture every frame
+ThreadPool* threadPool;
+CpuRain cpuRain;
+unsigned int cpuRainTexture;    // buffer texture over the streaming buffer
+float cpuRainUpdateMs = 0.0f;
+struct CpuRainBenchmarkResult
+{
+    int drops;
+    bool simd;
+    int threads;
+    float updateMs;
+};
+std::vector<CpuRainBenchmarkResult> cpuRainBenchmarkResults;
+
+// synthetic scene of many objects, recorded into command buffers on the thread pool and submitted here
+CommandSubmitter* commandSubmitter;
+StressScene* stressScene;
+struct StressBenchmarkResult
+{
+    int threads;
+    float recordMs;
+    bool identical;     // recorded the same commands as with one thread
+};
+std::vector<StressBenchmarkResult> stressBenchmarkResults;
+float stressBenchmarkSubmitMs = 0.0f;
+
+// rain benchmark, steps through increasing drop counts and measures the rain and splash passes,
+// every count is measured with each of the available rain paths
+const int rainBenchmarkCounts[] = { 10000, 30000, 100000, 300000, 1000000, 3000000 };
+const int rainBenchmarkCountSteps = sizeof(rainBenchmarkCounts) / sizeof(rainBenchmarkCounts[0]);
+int rainBenchmarkPaths = 2;     // the compute path is only measured when it is available
+const int rainBenchmarkWarmupFrames = 30;
+const int rainBenchmarkFrames = 60;
+struct RainBenchmarkResult
+{
+    int drops;
+    int path;         // config.rainPath
+    float rainMs;     // GPU time of the rain and splash passes
+    float frameMs;    // whole frame, measured on the CPU
+};
+std::vector<RainBenchmarkResult> rainBenchmarkResults;
+int rainBenchmarkStep = -1;     // count index * rainBenchmarkPaths + path, negative when no benchmark is running
+int rainBenchmarkFrame = 0;
+int rainBenchmarkRestoreCount = 0;
+int rainBenchmarkRestorePath = 0;
+float rainBenchmarkRainMs = 0.0f, rainBenchmarkFrameMs = 0.0f;
+GpuTimer* rainTimer;
+
+// when the next frame starts, 50 fps by default
+FramePacer framePacer;
+
+// GPU and CPU time of the passes, shown in the settings panel
+Profiler* profiler;
+
+// GL calls of the last frame by category and pass, shown in the settings panel and written to the benchmark report
+GlStats* glStats;
+
+// --bench renders a fixed number of frames on a fixed clock into a hidden window and writes a report
+BenchOptions benchOptions;
+BenchReport* benchReport = nullptr;
+int benchFrame = 0;
+const float BENCH_FRAME_SECONDS = 1.0f / 60.0f;
+
+// camera path being recorded or played back and how far in they are, in seconds
+CameraPathRecorder* pathRecorder = nullptr;
+CameraPathPlayer* pathPlayer = nullptr;
+float recordTime = 0.0f, playTime = 0.0f;
+bool playbackRestoresSimulation = false;
+
+// reloads the shaders and assets whose files are written while it runs, null with --bench or --no-hot-reload
+HotReload* hotReload = nullptr;
+
+// frames left in the running CPU trace capture, and how many were written so far
+int traceFramesLeft = 0;
+int traceCaptures = 0;
+
+// everything written again each frame: the camera, the uniforms of the command buffers and the CPU rain
+StreamingBuffer* streamingBuffer;
+
+// camera of the current frame, laid out like the Camera uniform block of shaders/camera.glsl (std140) and written
+// into the streaming buffer once per frame by latchCamera, as late as possible so the frame shows the freshest input.
+// The block also carries the sky irradiance, set when the skybox is loaded
+struct FrameCamera
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    glm::vec4 position;
+    glm::vec4 irradiance[9];
+} frameCamera;
+const unsigned int cameraBlockBinding = 0;
+LatencyProbe* latencyProbe;
+
+// camera movement, light animation and time on their own thread at a fixed tick, null when turned off
+Simulation* simulation = nullptr;
 
 
 Shader* skyboxShader;
 unsigned int skyboxVAO; // skybox handle
 unsigned int cubemapTexture; // skybox texture handle
+SkyIrradiance skyIrradiance; // ambient light of the skybox, for pbr_shading.frag
 
 unsigned int shadowMap, shadowMapFBO;
 unsigned int rainMap, rainMapFBO;
 glm::mat4 lightSpaceMatrix;
 glm::mat4 rainSpaceMatrix;
 
+// rain exposure baked from the rain map, only redone when the rain direction changes
+WetnessVolume* wetnessVolume;
+glm::vec3 bakedRainVelocity = glm::vec3(0.0f);
+bool rainMapOutdated = false;   // a model was reloaded, the rain map and the wetness need a new bake
+bool rainMapDirty = true;
+float wetnessSettle = -1.0f;    // weight of the previous bake still left in the volume, negative once it is up to date
+
+// the scene is rendered offscreen, so its depth can be laid down once and sampled by later passes
+int screenWidth = SCR_WIDTH, screenHeight = SCR_HEIGHT;
+unsigned int sceneColor, sceneDepth, sceneFBO;
+unsigned int fullscreenVAO;
+
+// screen space shadow and wetness, evaluated once per pixel and shared by all lighting passes
+unsigned int visibilityMask, visibilityMaskDepth, visibilityMaskFBO;
+int visibilityMaskScale = 0;    // resolution divider the mask textures were created with
+bool visibilityMaskDrawn = false;   // this frame, the mask is skipped while its programs are still compiling
+GpuTimer* visibilityMaskTimer;
+GpuTimer* additionalLightsTimer;
+float additionalLightMs[2] = {0.0f, 0.0f};  // per additional light, without and with the mask
+
+// rain drawn into a reduced resolution target and blended back over the scene
+unsigned int particleColor, particleDepth, particleFBO;
+unsigned int particleCompositeFBO;  // scene color only, the composite samples the scene depth
+int particleTargetScale = 0;        // resolution divider the particle target was created with
+float rainPassMs[3] = {0.0f, 0.0f, 0.0f};  // at full, half and quarter resolution
+
+// fragment counts of the main PBR pass and the skybox, to check the overdraw of the main pass
+GpuQuery* pbrFragmentsQuery;
+GpuQuery* skyFragmentsQuery;
+
 // global variables used for control
 // ---------------------------------
 float lastX = (float)SCR_WIDTH / 2.0;
@@ -95,6 +258,7 @@ float deltaTime;
 bool isPaused = false; // stop camera movement when GUI is open
 
 float lightRotationSpeed = 1.0f;
+float lightAngle = 0.0f; // how far the additional lights have turned around the y axis
 
 
 // structure to hold particle info
@@ -148,12 +312,49 @@ struct Config
     std::vector<Light> lights;
 
     // Rain
-    float rainCount = 10000;
+    int rainCount = 10000;
     float rainBoxSize = 30.0f;
     float splashQuadSize = 0.05f;
     float splashSpeed = 0.255f;
     glm::vec3 forward = {2.0f,0.0f,-0.01f};
     glm::vec3 velocity = glm::vec3(-1.0f,-9.82f,0.0f);
+    int rainPath = 2;                 // 0 vertex shader, 1 geometry shaders (old path), 2 compute simulation, needs GL 4.3, 3 CPU
+    int rainResolution = 0;           // 0 full, 1 half, 2 quarter resolution
+    bool rainSheets = true;           // far field layers, the drops then fade out towards the edge of the rain box
+
+    // Wetness
+    int wetnessBlurRadius = 1;
+    float wetnessResponse = 1.5f; // seconds for surfaces to get wet or dry after the rain direction changes
+
+    // Visibility mask
+    bool visibilityMask = true;
+    bool halfResolutionMask = false;
+
+    // Depth pre-pass, the main pass then only shades the visible fragments
+    bool depthPrepass = true;
+
+    // poll the input right before the camera is latched, instead of at the end of the previous frame
+    bool lowLatencyInput = true;
+
+    // advance the camera, the lights and the rain on the simulation thread, the frame interpolates its ticks
+    bool simulationThread = true;
+    bool animateLights = false;
+
+    // synthetic scene to load the CPU side of rendering, recorded in parallel when multithreaded
+    bool stressScene = false;
+    int stressObjects = 10000;
+    bool stressMultithreaded = true;
+
+    // frames in a CPU trace capture started from the settings panel
+    int traceFrames = 120;
+
+    // camera path played or recorded from the settings panel, a standard path or the file
+    int cameraPath = 0;
+    char cameraPathFile[128] = "recording.campath";
+
+    // count the GL calls of every frame, always on in the benchmark, and collect the KHR_debug performance messages
+    bool glStats = false;
+    bool glDebugMessages = false;
 
 } config;
 
@@ -162,24 +363,35 @@ struct Config
 // ---------------------
 void setAmbientUniforms(glm::vec3 ambientLightColor);
 void setLightUniforms(Light &light);
+uint32_t pbrLightFeatures(const Light& light);
+void setupPbrMaterials();
+void setPbrMaterial(Model* model);
+void drawPbrObjects(uint32_t passFeatures, Light& light);
 
 // Taken inspiration from ex 4
-void emitParticle(glm::vec3 start);
-void createRainBox();
-float getRandomOffset();
-glm::vec3 getPostionVec(int index);
+void createRainQuadBatch();
+void drawRain();
+bool rainReady();
+void createParticleTarget();
+void drawRainReducedResolution();
+void startRainBenchmark();
+void updateRainBenchmark();
+CpuRain::Params cpuRainParams();
+void updateCpuRainMap();
+int updateCpuRain();
+void validateCpuRain();
+void runCpuRainBenchmark();
+void recordStressScene(ThreadPool* pool);
+void drawStressScene();
+void runStressBenchmark();
 
 void createShadowMap();
+void createSceneFramebuffer();
+void createVisibilityMask();
 
 // Taken from ex 8
 void createRainMap();
 
-// Taken from ex 4
-void createParticleVertexBufferObject();
-
-// Taken from ex 4
-void bindParticleAttributes();
-
 void setRainUniforms();
 void setShadowUniforms();
 void setRainMapUniforms();
@@ -187,27 +399,62 @@ void setSplashUniforms();
 
 void drawSkybox();
 void drawShadowMap();
+void drawDepthPrepass();
+void drawVisibilityMask();
+void setupDepthPrepassEqual();
+void drawSceneToScreen();
+void latchCamera();
+void updateSimulation();
+Light animatedLight(const Light& light);
 
 // Taken from ex 8
 void drawRainMap();
+void updateWetness();
+void validateWetnessBake();
 
-void drawObjects();
+void drawObjects(bool depthOnly = false);
 void drawGui();
+void drawProfilerGraph();
+void drawGlStats();
+void startTraceCapture();
+void updateTraceCapture();
+std::vector<CameraPath::Setting> cameraPathSettings();
+bool startPathPlayback(const std::string& nameOrFile);
+void stopPathPlayback();
+void startPathRecording();
+void stopPathRecording(const std::string& file);
+void updateCameraPath();
 
 void setupForwardAdditionalPass();
 void resetForwardAdditionalPass();
 unsigned int initSkyboxBuffers();
 unsigned int loadCubemap(vector<std::string> faces);
+void updateSkyIrradiance(const vector<std::string>& faces, bool reprojected);
+void uploadCubemapFace(unsigned int textureID, int face, const TextureImage& image);
 
 
 
 
-int main()
+int main(int argc, char** argv)
 {
+    TRACE_THREAD_NAME("Main");
+    int64_t startupStart = TRACE_NOW();
+    auto launch = std::chrono::steady_clock::now();
+    auto millisecondsSince = [](std::chrono::steady_clock::time_point start) {
+        return (int)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+    if (!benchOptions.parse(argc, argv))
+        return 1;
+    if (benchOptions.validate)
+        return Validation::run() ? 0 : 1;
+    if (benchOptions.enabled)
+        benchReport = new BenchReport(benchOptions);
+
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // GL 4.3 for the compute rain, everything else runs on 3.3
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
@@ -218,7 +465,30 @@ int main()
     // glfw window creation
     // --------------------
 
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Rainy day", NULL, NULL);
+    // the benchmark window is never shown, it only holds the context and the final image
+    int windowWidth = benchReport ? benchOptions.width : SCR_WIDTH;
+    int windowHeight = benchReport ? benchOptions.height : SCR_HEIGHT;
+    if (benchReport)
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    // drivers mostly only send performance messages to debug contexts
+    if (benchOptions.glDebug)
+    {
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+        config.glDebugMessages = true;
+    }
+    GLFWwindow* window = glfwCreateWindow(windowWidth, windowHeight, "Rainy day", NULL, NULL);
+    if (window == NULL && benchOptions.glDebug)
+    {
+        std::cout << "No debug context, only the performance messages sent without one are collected" << std::endl;
+        glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_FALSE);
+        window = glfwCreateWindow(windowWidth, windowHeight, "Rainy day", NULL, NULL);
+    }
+    if (window == NULL)
+    {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(windowWidth, windowHeight, "Rainy day", NULL, NULL);
+    }
     if (window == NULL)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -240,12 +510,29 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    if (benchReport)
+    {
+        benchReport->startupStage("context");
+        config.glStats = true;
+    }
+    if (!benchOptions.capturePath.empty())
+    {
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        GlCapture::start(benchOptions.capturePath.c_str(), framebufferWidth, framebufferHeight);
+    }
+    // a capture has to see the shaders compiled from their sources for the replay, in order
+    ProgramCache::enabled() = benchOptions.programCache && !GlCapture::capturing();
+    ShaderCompiler::start(window, GlCapture::capturing() ? ShaderCompiler::SYNCHRONOUS : benchOptions.shaderCompile);
+    auto shadersIssued = std::chrono::steady_clock::now();
+    glStats = new GlStats();
+    glStats->setEnabled(config.glStats);
+    config.glDebugMessages = glStats->setDebugMessages(config.glDebugMessages) && config.glDebugMessages;
 
     // load the shaders and the 3D models
     // ----------------------------------
 
-    pbr_shading = new Shader("shaders/common_shading.vert", "shaders/pbr_shading.frag");
-    shader = pbr_shading;
+    pbrVariants = new ShaderVariants("shaders/common_shading.vert", "shaders/pbr_shading.frag", pbrFeatureNames());
 
     carBodyModel = new Model("car/Body_LOD0.obj");
     carPaintModel = new Model("car/Paint_LOD0.obj");
@@ -259,6 +546,9 @@ int main()
     houseRoofModel = new Model("house/Roof_LOD0.obj");
     houseDetailsModel = new Model("house/Detail_LOD0.obj");
     stoneModel = new Model("house/Stone_LOD0.obj");
+    setupPbrMaterials();
+    if (benchReport)
+        benchReport->startupStage("models");
 
     splashTexture = TextureFromFileMod("splashAlbedo.png","rain",1);
     // init skybox
@@ -272,8 +562,12 @@ int main()
             "skybox/back.tga"
     };
     cubemapTexture = loadCubemap(faces);
+    threadPool = new ThreadPool();
+    updateSkyIrradiance(faces, false);
     skyboxVAO = initSkyboxBuffers();
     skyboxShader = new Shader("shaders/skybox.vert", "shaders/skybox.frag");
+    if (benchReport)
+        benchReport->startupStage("skybox");
 
     // --- Shadow map
     createShadowMap();
@@ -286,16 +580,78 @@ int main()
 
     // --- rain splash
     createRainMap();
-    rainSplash_shader = new Shader("shaders/rainsplash.vert", "shaders/rainsplash.frag");
+    rainSplash_shader = new Shader("shaders/rainmap.vert", "shaders/rainmap.frag");
+
+    // the volume covers the area seen by the rain map, from just below the floor to above the roof
+    wetnessVolume = new WetnessVolume(glm::ivec3(256, 32, 256), glm::vec3(-12.5f, -0.5f, -12.5f), glm::vec3(12.5f, 7.5f, 12.5f));
+
+    // --- visibility mask
+    glfwGetFramebufferSize(window, &screenWidth, &screenHeight);
+    glGenVertexArrays(1, &fullscreenVAO);
+    createSceneFramebuffer();
+    createVisibilityMask();
+    depthPrepass_shader = new Shader("shaders/depth_prepass.vert", "shaders/shadowmap.frag");
+    visibilityMask_shader = new Shader("shaders/fullscreen.vert", "shaders/visibility_mask.frag");
+    composite_shader = new Shader("shaders/fullscreen.vert", "shaders/composite.frag");
+
+    // shaders reading the camera from the uniform block
+    streamingBuffer = new StreamingBuffer(1 << 20, !GlCapture::capturing());
+    profiler = new Profiler();
+    profiler->glStats = glStats;
+    pbrVariants->bindUniformBlock("Camera", cameraBlockBinding);
+    for (Shader* cameraShader : { skyboxShader, depthPrepass_shader, visibilityMask_shader })
+        cameraShader->bindUniformBlock("Camera", cameraBlockBinding);
+    latencyProbe = new LatencyProbe();
+    visibilityMaskTimer = new GpuTimer();
+    additionalLightsTimer = new GpuTimer();
+    pbrFragmentsQuery = new GpuQuery(GL_SAMPLES_PASSED);
+    skyFragmentsQuery = new GpuQuery(GL_SAMPLES_PASSED);
 
 
     particle_shader = new Shader("shaders/particle.vert", "shaders/particle.frag","shaders/particle.geo");
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    createParticleVertexBufferObject();
-    glDisable(GL_BLEND);
+    createRainQuadBatch();
+    rainTimer = new GpuTimer();
 
     splash_shader = new Shader("shaders/splash.vert", "shaders/splash.frag","shaders/splash.geo");
+    rain_shader = new Shader("shaders/rain.vert", "shaders/rain.frag");
+    rainSheets = new RainSheets();
+    if (GLAD_GL_VERSION_4_3)
+        rainSimulation = new RainSimulation();
+    else if (config.rainPath == 2)
+        config.rainPath = 0;
+    rainStreamed_shader = new Shader("shaders/rain_streamed.vert", "shaders/rain.frag");
+    commandSubmitter = new CommandSubmitter(streamingBuffer);
+    stressScene = new StressScene(commandSubmitter->uniformAlignment());
+    stressScene->shader->bindUniformBlock("Camera", cameraBlockBinding);
+    stressScene->setCount(config.stressObjects);
+    glGenTextures(1, &cpuRainTexture);
+    depthDownsample_shader = new Shader("shaders/fullscreen.vert", "shaders/depth_downsample.frag");
+    particleComposite_shader = new Shader("shaders/fullscreen.vert", "shaders/particle_composite.frag");
+    // edited shaders and assets are reloaded while it runs, not while it is measured
+    if (benchOptions.hotReload && !benchReport)
+    {
+        hotReload = new HotReload({ "shaders", "car", "floor", "house", "rain", "skybox" });
+        for (Model* model : { carBodyModel, carPaintModel, carInteriorModel, carLightModel, carWindowsModel, carWheelModel,
+                              floorModel, houseBodyModel, houseRoofModel, houseDetailsModel, stoneModel })
+            hotReload->addModel(model);
+        hotReload->addTexture("rain/splashAlbedo.png", [](const TextureImage& image) { uploadTexture(splashTexture, image, true); });
+        for (int i = 0; i < (int)faces.size(); i++)
+            hotReload->addTexture(faces[i], [i, faces](const TextureImage& image) {
+                uploadCubemapFace(cubemapTexture, i, image);
+                glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+                updateSkyIrradiance(faces, true);
+            });
+        hotReload->modelReloaded = [](Model* model) {
+            setPbrMaterial(model);
+            rainMapOutdated = true;
+        };
+    }
+    int compilingShaders = Shader::pollPending();
+    std::cout << "Shaders: " << compilingShaders << " programs still compiling (" << ShaderCompiler::modeName(ShaderCompiler::mode())
+              << ") " << millisecondsSince(shadersIssued) << " ms after the first one was issued" << std::endl;
+
+    if (benchReport)
+        benchReport->startupStage("renderer");
 
     // Dear IMGUI init
     // ---------------
@@ -309,107 +665,212 @@ int main()
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 330 core");
 
-    float loopInterval = 0.02f;
-    auto begin = std::chrono::high_resolution_clock::now();
+    // the benchmark does not take input and the simulation thread runs on the wall clock, frames are not paced
+    if (benchReport)
+    {
+        benchReport->startupStage("gui");
+        // every frame of the benchmark draws all passes
+        Shader::waitAll();
+        compilingShaders = 0;
+        benchReport->startupStage("programs");
+        config.simulationThread = false;
+        framePacer.mode = FramePacer::UNCAPPED;
+    }
+    if (!benchOptions.cameraPath.empty() && !startPathPlayback(benchOptions.cameraPath))
+        glfwSetWindowShouldClose(window, true);
+    if (!benchOptions.recordPath.empty())
+        startPathRecording();
 
+    auto begin = std::chrono::high_resolution_clock::now();
 
-    createRainBox();
+    // everything up to here was recorded, the rest is only recorded in captures
+    TRACE_EVENT("Startup", startupStart);
+    TRACE_STOP("startup_trace.json");
+    if (!compilingShaders)
+    {
+        ProgramCache::printStats();
+        pbrVariants->printStats("PBR variants");
+    }
+    else
+        std::cout << "Shaders: first frame " << millisecondsSince(launch) << " ms after launch" << std::endl;
 
     // render loop
     // -----------
+    int frameNumber = 0;
     while (!glfwWindowShouldClose(window))
     {
-        static float lastFrame = 0.0f;
-        float currentFrame = (float)glfwGetTime();
+        TRACE_SCOPE("Frame");
+        if (frameNumber++ == benchOptions.captureAfter)
+            GlCapture::beginWindow(benchOptions.captureFrames);
+        GlCapture::beginFrame();
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        if (compilingShaders && !(compilingShaders = Shader::pollPending()))
+        {
+            std::cout << "Shaders: all programs linked " << millisecondsSince(launch) << " ms after launch, "
+                      << frameNumber - 1 << " frames drawn without some of them" << std::endl;
+            ProgramCache::printStats();
+            pbrVariants->printStats("PBR variants");
+        }
+        if (hotReload)
+            hotReload->update();
+        // the benchmark renders the same frames every run
+        float currentFrame = benchReport ? benchFrame * BENCH_FRAME_SECONDS : (float)glfwGetTime();
+        static float lastFrame = currentFrame;    // the first frame does not count the startup as its delta
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        framePacer.beginFrame();
+        streamingBuffer->beginFrame();
+        profiler->beginFrame();
+        glStats->setEnabled(config.glStats);
+        config.glDebugMessages = glStats->setDebugMessages(config.glDebugMessages) && config.glDebugMessages;
 
-        auto frameStart = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float> appTime = frameStart - begin;
-        currentTime = appTime.count();
-
+        currentTime = benchReport ? currentFrame : appTime.count();
 
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 viewProjection = projection * view;
+        // these do not depend on the camera, so they go before the input is read
+        profiler->begin("Shadow map");
+        drawShadowMap();
+        profiler->end();
+        profiler->begin("Wetness");
+        updateWetness();
+        profiler->end();
 
+        if (config.lowLatencyInput)
+            glfwPollEvents();
         processInput(window);
+        updateSimulation();
+        updateCameraPath();
+        latchCamera();
 
-
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
         glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        drawSkybox();
-        drawShadowMap();
-        drawRainMap();
-
+        // passes whose programs are still compiling are left out, the PBR shader then does the mask's lookups itself
+        bool maskReady = config.visibilityMask && visibilityMask_shader->ready();
+        bool depthPrepass = (config.depthPrepass || maskReady) && depthPrepass_shader->ready();
+        visibilityMaskDrawn = maskReady && depthPrepass;
+        if (depthPrepass)
+        {
+            profiler->begin("Depth prepass");
+            drawDepthPrepass();
+            profiler->end();
+        }
+        if (visibilityMaskDrawn)
+        {
+            profiler->begin("Visibility mask");
+            drawVisibilityMask();
+            profiler->end();
+        }
+        if (config.depthPrepass && depthPrepass)
+            setupDepthPrepassEqual();
+        else if (depthPrepass)
+            glClear(GL_DEPTH_BUFFER_BIT); // the mask needed the depth, the main pass starts over without it
 
-        shader->use();
 
         // First light + ambient
-        setAmbientUniforms(config.ambientLightColor * config.ambientLightIntensity);
-        setLightUniforms(config.lights[0]);
-        setShadowUniforms();
-
-
-
-        drawObjects();
+        uint32_t maskFeature = visibilityMaskDrawn ? PBR_VISIBILITY_MASK : 0;
+        profiler->begin("Main PBR");
+        pbrFragmentsQuery->begin();
+        drawPbrObjects(PBR_INDIRECT_LIGHT | pbrLightFeatures(config.lights[0]) | maskFeature, config.lights[0]);
+        pbrFragmentsQuery->end();
+        profiler->end();
 
         // Additional additive lights
+        profiler->begin("Additional lights");
         setupForwardAdditionalPass();
+        additionalLightsTimer->begin();
         for (int i = 1; i < config.lights.size(); ++i)
         {
-            setLightUniforms(config.lights[i]);
-            drawObjects();
+            Light light = animatedLight(config.lights[i]);
+            drawPbrObjects(pbrLightFeatures(light) | maskFeature, light);
         }
+        additionalLightsTimer->end();
+        if (config.lights.size() > 1)
+            additionalLightMs[visibilityMaskDrawn] = additionalLightsTimer->milliseconds() / (config.lights.size() - 1);
         resetForwardAdditionalPass();
+        profiler->end();
+        // the default depth state again after the pre-pass' GL_EQUAL, whether or not a PBR program was ready to draw
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
 
-        shader = particle_shader;
-        particle_shader->use();
-        setRainMapUniforms();
-        setRainUniforms();
-
-
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glBindVertexArray(particleVAO);
-        glDrawArrays(GL_POINTS,0,numberOfparticles);
-        glBindVertexArray(0);
-        glDisable(GL_BLEND);
+        if (config.stressScene && stressScene->shader->ready())
+        {
+            profiler->begin("Stress scene");
+            drawStressScene();
+            profiler->end();
+        }
 
+        // drawn after the opaque objects, so it only covers the pixels still at the far plane
+        profiler->begin("Skybox");
+        skyFragmentsQuery->begin();
+        drawSkybox();
+        skyFragmentsQuery->end();
+        profiler->end();
 
-        shader = splash_shader;
-        splash_shader->use();
-        setSplashUniforms();
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glBindVertexArray(particleVAO);
-        glDrawArrays(GL_POINTS,0,numberOfparticles);
-        glBindVertexArray(0);
-        glDisable(GL_BLEND);
+        profiler->begin("Rain");
+        rainTimer->begin();
+        if (rainReady())
+        {
+            if (config.rainResolution == 0)
+                drawRain();
+            else
+                drawRainReducedResolution();
+        }
+        rainTimer->end();
+        profiler->end();
+        rainPassMs[config.rainResolution] = rainTimer->milliseconds();
 
-        shader = pbr_shading;
+        profiler->begin("Composite");
+        drawSceneToScreen();
+        profiler->end();
 
         if (isPaused) {
+            profiler->begin("GUI");
             drawGui();
+            profiler->end();
         }
 
+        profiler->endFrame();
+        int64_t swapStart = TRACE_NOW();
         glfwSwapBuffers(window);
-        glfwPollEvents();
-
-        std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now()-frameStart;
-        while (loopInterval > elapsed.count()) {
-            // busy waiting
-            elapsed = std::chrono::high_resolution_clock::now() - frameStart;
-        }
+        TRACE_EVENT("Swap buffers", swapStart);
+        streamingBuffer->endFrame();
+        glStats->endFrame();
+        GlCapture::endFrame();
+        if (benchReport && benchFrame >= benchOptions.warmupFrames)
+            benchReport->endFrame(std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count(),
+                                  *profiler, *glStats);
+        latencyProbe->frameSwapped();
+        if (!config.lowLatencyInput)
+            glfwPollEvents();
+
+        updateRainBenchmark();
+        updateTraceCapture();
+
+        // the benchmark runs uncapped so the frame time reflects the rain cost
+        framePacer.endFrame(rainBenchmarkStep >= 0);
+
+        if (benchReport && ++benchFrame == benchOptions.warmupFrames + benchOptions.frames)
+            glfwSetWindowShouldClose(window, true);
     }
 
+    int exitCode = 0;
+    if (benchReport && !benchReport->write(profiler->droppedFrames, *pbrVariants))
+        exitCode = 1;
+    if (pathRecorder)
+        stopPathRecording(benchOptions.recordPath.empty() ? config.cameraPathFile : benchOptions.recordPath);
+    delete pathPlayer;
+    GlCapture::stop();
+
     // Cleanup
     // -------
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
+    // before the models and shaders it reloads
+    delete hotReload;
     delete carBodyModel;
     delete houseBodyModel;
     delete carPaintModel;
@@ -418,60 +879,508 @@ int main()
     delete carWindowsModel;
     delete carWheelModel;
     delete floorModel;
-    delete pbr_shading;
+    delete pbrVariants;
     delete shadowMap_shader;
+    delete wetnessVolume;
+    delete depthPrepass_shader;
+    delete visibilityMask_shader;
+    delete composite_shader;
+    delete visibilityMaskTimer;
+    delete additionalLightsTimer;
+    delete pbrFragmentsQuery;
+    delete skyFragmentsQuery;
     glDeleteVertexArrays(1, &particleVAO);
-    glDeleteBuffers(1, &particleVBO);
+    glDeleteBuffers(1, &rainQuadEBO);
+    delete rainTimer;
+    delete rain_shader;
+    delete rainSheets;
+    delete rainSimulation;
+    delete latencyProbe;
+    delete simulation;
+    delete streamingBuffer;
+    delete profiler;
+    delete rainStreamed_shader;
+    delete stressScene;
+    delete commandSubmitter;
+    delete threadPool;
+    glDeleteTextures(1, &cpuRainTexture);
+    delete depthDownsample_shader;
+    delete particleComposite_shader;
+    delete benchReport;
+    delete glStats;
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
+    ShaderCompiler::stop();
     glfwTerminate();
-    return 0;
+    return exitCode;
 }
 
 
 
-// Taken inspiration from ex 4
-void emitParticle(glm::vec3 start){
+// Index buffer of rainQuadsPerInstance quads, the vertex shader builds every corner from gl_VertexID
+void createRainQuadBatch()
+{
+    std::vector<unsigned short> indices;
+    for (unsigned short quad = 0; quad < rainQuadsPerInstance; quad++)
+    {
+        unsigned short corner = quad * 4;
+        unsigned short quadIndices[6] = { corner, (unsigned short)(corner + 1), (unsigned short)(corner + 2),
+                                          (unsigned short)(corner + 2), (unsigned short)(corner + 1), (unsigned short)(corner + 3) };
+        indices.insert(indices.end(), quadIndices, quadIndices + 6);
+    }
+
+    glGenVertexArrays(1, &particleVAO);
+    glGenBuffers(1, &rainQuadEBO);
+    glBindVertexArray(particleVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rainQuadEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+    glBindVertexArray(0);
+}
+
+// Whether the programs of the rain path and resolution are linked, the rain is left out until they are
+bool rainReady()
+{
+    bool ready;
+    if (config.rainPath == 1)
+        ready = particle_shader->ready() && splash_shader->ready();
+    else if (config.rainPath == 2)
+        ready = rainSimulation->simulateShader->ready() && rainSimulation->drawShader->ready();
+    else if (config.rainPath == 3)
+        ready = rainStreamed_shader->ready();
+    else
+        ready = rain_shader->ready();
+    if (config.rainResolution != 0)
+        ready = ready && depthDownsample_shader->ready() && particleComposite_shader->ready();
+    return ready;
+}
+
+// Draws the rain streaks and the splashes, both generated from the drop index
+void drawRain()
+{
+    // the alpha channel accumulates the coverage, so the particle target holds premultiplied color
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
+    // transparent, so it must not hide the drops behind it, this also lets invisible drops be skipped
+    glDepthMask(GL_FALSE);
+
+    // farthest first
+    if (config.rainSheets)
+    {
+        rainSheets->draw(frameCamera.viewProjection, camera.Position, config.velocity, currentTime, config.rainBoxSize);
+    }
+
+    if (config.rainPath == 1)
+    {
+        shader = particle_shader;
+        particle_shader->use();
+        setRainMapUniforms();
+        setRainUniforms();
+        glDrawArrays(GL_POINTS, 0, config.rainCount);
+
+        profiler->begin("Splashes");
+        shader = splash_shader;
+        splash_shader->use();
+        setSplashUniforms();
+        glDrawArrays(GL_POINTS, 0, config.rainCount);
+        profiler->end();
+    }
+    else if (config.rainPath == 2)
+    {
+        // one compute pass picks the visible streaks and splashes, the two indirect draws only process those
+        shader = rainSimulation->simulateShader;
+        shader->use();
+        setSplashUniforms();
+        rainSimulation->simulate(config.rainCount, frameCamera.viewProjection);
+
+        shader = rainSimulation->drawShader;
+        shader->use();
+        setSplashUniforms();
+        rainSimulation->drawStreaks();
+        profiler->begin("Splashes");
+        rainSimulation->drawSplashes();
+        profiler->end();
+    }
+    else if (config.rainPath == 3)
+    {
+        int firstDrop = updateCpuRain();
+
+        shader = rainStreamed_shader;
+        shader->use();
+        setSplashUniforms();
+        shader->setInt("drops", 2);
+        shader->setInt("firstDrop", firstDrop);
+        shader->setInt("splashOffset", firstDrop + (int)cpuRain.streaks.size());
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_BUFFER, cpuRainTexture);
+
+        shader->setBool("splashes", false);
+        glDrawArrays(GL_LINES, 0, 2 * (int)cpuRain.streaks.size());
+        profiler->begin("Splashes");
+        shader->setBool("splashes", true);
+        glDrawArrays(GL_TRIANGLES, 0, 6 * (int)cpuRain.splashes.size());
+        profiler->end();
+
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    else
+    {
+        // the same program and VAO for both draws, streaks as lines and splashes as batches of quads
+        shader = rain_shader;
+        rain_shader->use();
+        setSplashUniforms();
+        shader->setInt("quadsPerInstance", rainQuadsPerInstance);
+
+        shader->setBool("splashes", false);
+        glDrawArrays(GL_LINES, 0, 2 * config.rainCount);
+
+        profiler->begin("Splashes");
+        shader->setBool("splashes", true);
+        int instances = (config.rainCount + rainQuadsPerInstance - 1) / rainQuadsPerInstance;
+        glDrawElementsInstanced(GL_TRIANGLES, rainQuadsPerInstance * 6, GL_UNSIGNED_SHORT, 0, instances);
+        profiler->end();
+    }
 
-    float data[particleSize];
+    glBindVertexArray(0);
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+}
+
+// Reduced resolution target for the rain, created again when the window or the resolution changes
+void createParticleTarget()
+{
+    if (particleTargetScale == 0)
+    {
+        glGenTextures(1, &particleColor);
+        glGenTextures(1, &particleDepth);
+        glGenFramebuffers(1, &particleFBO);
+        glGenFramebuffers(1, &particleCompositeFBO);
+    }
+    particleTargetScale = 1 << config.rainResolution;
+
+    int width = (screenWidth + particleTargetScale - 1) / particleTargetScale;
+    int height = (screenHeight + particleTargetScale - 1) / particleTargetScale;
+    glBindTexture(GL_TEXTURE_2D, particleColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, particleDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, particleFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, particleColor, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, particleDepth, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, particleCompositeFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneColor, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-    data[0] = start.x;
-    data[1] = start.y;
-    data[2] = start.z;
+// Draws the rain into the reduced resolution target, depth tested against a downsampled copy of the
+// scene depth, and blends it back over the scene with a depth aware upsampling.
+// Fewer pixels are blended, at the cost of softer streaks and a little bleeding along depth edges.
+void drawRainReducedResolution()
+{
+    if (particleTargetScale != 1 << config.rainResolution)
+        createParticleTarget();
 
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int width = (screenWidth + particleTargetScale - 1) / particleTargetScale;
+    int height = (screenHeight + particleTargetScale - 1) / particleTargetScale;
 
-    glBufferSubData(GL_ARRAY_BUFFER, particleId * particleSize * sizeOfFloat, particleSize * sizeOfFloat, data);
-    particleId = (particleId + 1) % vertexBufferSize;
+    // downsample the scene depth straight into the depth buffer of the particle target
+    glBindFramebuffer(GL_FRAMEBUFFER, particleFBO);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthFunc(GL_ALWAYS);
+    depthDownsample_shader->use();
+    depthDownsample_shader->setInt("scale", particleTargetScale);
+    depthDownsample_shader->setInt("sceneDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sceneDepth);
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthFunc(GL_LESS);
+
+    drawRain();
 
+    // composite, the scene depth is sampled so only the scene color is attached
+    glBindFramebuffer(GL_FRAMEBUFFER, particleCompositeFBO);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    particleComposite_shader->use();
+    particleComposite_shader->setInt("scale", particleTargetScale);
+    particleComposite_shader->setFloat("nearPlane", 0.1f);
+    particleComposite_shader->setFloat("farPlane", 100.0f);
+    particleComposite_shader->setInt("particleColor", 0);
+    particleComposite_shader->setInt("particleDepth", 1);
+    particleComposite_shader->setInt("sceneDepth", 2);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, particleColor);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, particleDepth);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, sceneDepth);
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
     glBindVertexArray(0);
+    glBlendFunc(GL_ONE, GL_ZERO);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+    glActiveTexture(GL_TEXTURE0);
 }
 
+// Starts stepping through rainBenchmarkCounts, one measurement per count and rain path
+void startRainBenchmark()
+{
+    rainBenchmarkResults.clear();
+    rainBenchmarkRestoreCount = config.rainCount;
+    rainBenchmarkRestorePath = config.rainPath;
+    rainBenchmarkPaths = rainSimulation ? 3 : 2;
+    rainBenchmarkStep = 0;
+    rainBenchmarkFrame = 0;
+    config.rainCount = rainBenchmarkCounts[0];
+    config.rainPath = 0;
+}
+
+// Called once per frame, averages the rain pass and frame times of each step after letting them settle
+void updateRainBenchmark()
+{
+    if (rainBenchmarkStep < 0)
+        return;
+
+    if (rainBenchmarkFrame == rainBenchmarkWarmupFrames)
+        rainBenchmarkRainMs = rainBenchmarkFrameMs = 0.0f;
+    if (rainBenchmarkFrame >= rainBenchmarkWarmupFrames)
+    {
+        rainBenchmarkRainMs += rainTimer->milliseconds();
+        rainBenchmarkFrameMs += deltaTime * 1000.0f;
+    }
+
+    if (++rainBenchmarkFrame < rainBenchmarkWarmupFrames + rainBenchmarkFrames)
+        return;
 
-float getRandomOffset(){
+    RainBenchmarkResult result;
+    result.drops = config.rainCount;
+    result.path = config.rainPath;
+    result.rainMs = rainBenchmarkRainMs / rainBenchmarkFrames;
+    result.frameMs = rainBenchmarkFrameMs / rainBenchmarkFrames;
+    rainBenchmarkResults.push_back(result);
+    std::cout << "Rain benchmark: " << result.drops << " drops (" << rainPathNames[result.path] << "), rain " << result.rainMs << " ms ("
+              << result.drops / (result.rainMs * 1000.0f) << " M drops/s), frame " << result.frameMs << " ms" << std::endl;
+
+    rainBenchmarkFrame = 0;
+    if (++rainBenchmarkStep < rainBenchmarkCountSteps * rainBenchmarkPaths)
+    {
+        config.rainCount = rainBenchmarkCounts[rainBenchmarkStep / rainBenchmarkPaths];
+        config.rainPath = rainBenchmarkStep % rainBenchmarkPaths;
+    }
+    else
+    {
+        rainBenchmarkStep = -1;
+        config.rainCount = rainBenchmarkRestoreCount;
+        config.rainPath = rainBenchmarkRestorePath;
+    }
+}
 
-    return rand()/(float) RAND_MAX;
+// The rain uniforms of this frame, for CpuRain
+CpuRain::Params cpuRainParams()
+{
+    CpuRain::Params params;
+    params.currentTime = currentTime;
+    params.boxSize = config.rainBoxSize;
+    params.cameraPosition = camera.Position;
+    params.forward = config.forward;
+    params.velocity = config.velocity;
+    params.nearFieldFadeStart = config.rainSheets ? config.rainBoxSize * 0.35f : config.rainBoxSize;
+    params.nearFieldFadeEnd = config.rainSheets ? config.rainBoxSize * 0.5f : config.rainBoxSize * 2.0f;
+    params.splashSpeed = config.splashSpeed;
+    params.splashQuadSize = config.splashQuadSize;
+    params.viewProjection = frameCamera.viewProjection;
+    return params;
+}
+
+// Gives the CPU rain a copy of the rain map when it changed
+void updateCpuRainMap()
+{
+    if (cpuRain.rainMapMatrix() == rainSpaceMatrix)
+        return;
+    std::vector<float> rainDepth(RAINSPLASH_WIDTH * RAINSPLASH_HEIGHT);
+    glBindTexture(GL_TEXTURE_2D, rainMap);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &rainDepth[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    cpuRain.setRainMap(rainDepth, RAINSPLASH_WIDTH, RAINSPLASH_HEIGHT, rainSpaceMatrix);
 }
 
+// Simulates the rain on the CPU and streams the visible streaks and splashes to the GPU,
+// returns the index of the first drop in the buffer texture
+int updateCpuRain()
+{
+    TRACE_SCOPE("Update CPU rain");
+    updateCpuRainMap();
+    cpuRain.setCount(config.rainCount);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    cpuRain.update(cpuRainParams(), threadPool);
+    std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    cpuRainUpdateMs = cpuRainUpdateMs * 0.9f + elapsed.count() * 0.1f;
+
+    size_t streakBytes = cpuRain.streaks.size() * sizeof(glm::vec4);
+    size_t splashBytes = cpuRain.splashes.size() * sizeof(glm::vec4);
+    if (streakBytes + splashBytes == 0)
+        return 0;
+    size_t offset;
+    char* mapped = (char*)streamingBuffer->map(streakBytes + splashBytes, sizeof(glm::vec4), offset);
+    if (streakBytes)
+        memcpy(mapped, &cpuRain.streaks[0], streakBytes);
+    if (splashBytes)
+        memcpy(mapped + streakBytes, &cpuRain.splashes[0], splashBytes);
+    streamingBuffer->unmap();
+
+    // the texture covers the whole buffer, which changes when it grows
+    glBindTexture(GL_TEXTURE_BUFFER, cpuRainTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, streamingBuffer->id);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    return (int)(offset / sizeof(glm::vec4));
+}
 
-glm::vec3 getPostionVec(int index){
-    float fragment = cbrt(config.rainCount);
+// Checks the SIMD kernel against the scalar one and, with a GL 4.3 context, against the compute shader
+void validateCpuRain()
+{
+    updateCpuRainMap();
+    cpuRain.setCount(config.rainCount);
+    CpuRain::Params params = cpuRainParams();
+
+    cpuRain.simd = false;
+    cpuRain.update(params);
+    std::vector<glm::vec4> referenceStreaks = cpuRain.streaks, referenceSplashes = cpuRain.splashes;
+    cpuRain.simd = true;
+    cpuRain.update(params, threadPool);
+    std::cout << "CPU rain: SIMD kernel against the scalar one" << std::endl;
+    Validation::compareDrops("streaks", cpuRain.streaks, referenceStreaks);
+    Validation::compareDrops("splashes", cpuRain.splashes, referenceSplashes);
+
+    if (!rainSimulation)
+        return;
+    shader = rainSimulation->simulateShader;
+    shader->use();
+    setSplashUniforms();
+    rainSimulation->simulate(config.rainCount, params.viewProjection);
+    std::vector<glm::vec4> gpuStreaks, gpuSplashes;
+    rainSimulation->readBack(gpuStreaks, gpuSplashes);
+    std::cout << "CPU rain: against the compute shader" << std::endl;
+    Validation::compareDrops("streaks", cpuRain.streaks, gpuStreaks);
+    Validation::compareDrops("splashes", cpuRain.splashes, gpuSplashes);
+}
 
-    float x = getRandomOffset()+ fmod(index, fragment);
-    float y = fmod(getRandomOffset()+ index/fragment,fragment);
-    float z = (index/(fragment*fragment) + getRandomOffset());
+// Times CpuRain::update for a few drop counts, scalar and SIMD on one thread and SIMD on all of them
+void runCpuRainBenchmark()
+{
+    const int counts[] = { 100000, 1000000, 4000000 };
+    const int repeats = 5;
+    updateCpuRainMap();
+    CpuRain::Params params = cpuRainParams();
+    cpuRainBenchmarkResults.clear();
+    for (int drops : counts)
+    {
+        cpuRain.setCount(drops);
+        for (int variant = 0; variant < 3; variant++)
+        {
+            CpuRainBenchmarkResult result;
+            result.drops = drops;
+            result.simd = variant > 0;
+            ThreadPool* pool = variant == 2 ? threadPool : nullptr;
+            result.threads = pool ? pool->size() : 1;
+
+            cpuRain.simd = result.simd;
+            cpuRain.update(params, pool);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < repeats; i++)
+                cpuRain.update(params, pool);
+            std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            result.updateMs = elapsed.count() / repeats;
+            cpuRainBenchmarkResults.push_back(result);
+
+            float dropsPerSecond = drops / (result.updateMs * 1000.0f);
+            std::cout << "CPU rain benchmark: " << drops << " drops, " << (result.simd ? "SIMD" : "scalar") << ", " << result.threads << " threads: "
+                      << result.updateMs << " ms, " << dropsPerSecond << " M drops/s, " << dropsPerSecond / result.threads << " M drops/s per core" << std::endl;
+        }
+    }
+    cpuRain.simd = true;
+    cpuRain.setCount(config.rainCount);
+}
 
-    return (glm::vec3( x,y,z )/fragment)*config.rainBoxSize;
+// Records the stress scene on the thread pool and submits it. Drawn after the lights, with its own
+// state and the depth test against the scene
+void drawStressScene()
+{
+    recordStressScene(config.stressMultithreaded ? threadPool : nullptr);
+    stressScene->submit(*commandSubmitter);
 }
 
+void recordStressScene(ThreadPool* pool)
+{
+    TRACE_SCOPE("Record stress scene");
+    if (stressScene->count() != config.stressObjects)
+        stressScene->setCount(config.stressObjects);
+    stressScene->record(frameCamera.viewProjection, currentTime, config.lights[0].position,
+                        config.lights[0].color * config.lights[0].intensity, config.ambientLightColor * config.ambientLightIntensity, pool);
+}
 
-void createRainBox(){
+// Records the stress scene with 1, 2, 4 and 8 threads and checks that every thread count records the
+// same commands. Submitting is measured once, it always runs on this thread
+void runStressBenchmark()
+{
+    const int threadCounts[] = { 1, 2, 4, 8 };
+    const int repeats = 20;
 
-    for (int i =0; i<config.rainCount; i+=2) {
-        emitParticle( getPostionVec(i));
+    recordStressScene(nullptr);
+    std::vector<CommandBuffer> reference = stressScene->recorded();
+    stressBenchmarkResults.clear();
+    for (int threads : threadCounts)
+    {
+        ThreadPool pool(threads);
+        recordStressScene(&pool);
+        StressBenchmarkResult result;
+        result.threads = threads;
+        result.identical = true;
+        for (size_t i = 0; i < reference.size(); i++)
+            result.identical = result.identical && reference[i].equals(stressScene->recorded()[i]);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < repeats; i++)
+            recordStressScene(&pool);
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+        result.recordMs = elapsed.count() / repeats;
+        stressBenchmarkResults.push_back(result);
+
+        std::cout << "Stress benchmark: " << stressScene->count() << " objects, " << stressScene->visibleObjects << " visible, "
+                  << threads << " threads: record " << result.recordMs << " ms, " << stressBenchmarkResults[0].recordMs / result.recordMs
+                  << "x, " << (result.identical ? "identical" : "DIFFERENT") << std::endl;
     }
+
+    // into the scene target, which the next frame clears anyway
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+    stressScene->submit(*commandSubmitter);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    stressBenchmarkSubmitMs = stressScene->submitMs;
+    std::cout << "Stress benchmark: submit " << stressBenchmarkSubmitMs << " ms, " << commandSubmitter->commandCount << " commands, "
+              << commandSubmitter->drawCount << " draws" << std::endl;
 }
 
 // Taken from ex 8
@@ -517,37 +1426,69 @@ void createShadowMap()
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
-// Taken from ex 4
-void createParticleVertexBufferObject(){
-    glGenVertexArrays(1, &particleVAO);
-    glGenBuffers(1, &particleVBO);
-
-    glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-
-    std::vector<float> data(vertexBufferSize * particleSize);
-    for(unsigned int i = 0; i < data.size(); i++)
-        data[i] = 0.0f;
+// Color and depth of the main view. Called again whenever the window size changes.
+void createSceneFramebuffer()
+{
+    if (sceneFBO == 0)
+    {
+        glGenTextures(1, &sceneColor);
+        glGenTextures(1, &sceneDepth);
+        glGenFramebuffers(1, &sceneFBO);
+    }
 
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize * particleSize * sizeOfFloat, &data[0], GL_DYNAMIC_DRAW);
-    bindParticleAttributes();
+    // sRGB, so blending still happens in linear space like it did in the window framebuffer
+    glBindTexture(GL_TEXTURE_2D, sceneColor);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, screenWidth, screenHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, sceneDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, screenWidth, screenHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneColor, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, sceneDepth, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-// Taken from ex 4
-void bindParticleAttributes(){
-    glBindVertexArray(particleVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, particleVBO);
-
-    int posSize = 3;
-    GLuint vertexLocation = glGetAttribLocation(particle_shader->ID, "pos");
-    glEnableVertexAttribArray(vertexLocation);
-    glVertexAttribPointer(vertexLocation, posSize, GL_FLOAT, GL_FALSE,
-                          particleSize * sizeOfFloat, (void*)0);
-
-    glBindVertexArray(0);
+// Two channel (shadow, wetness) mask computed from the scene depth, plus the depth each texel
+// was evaluated at for the upsampling. Called again whenever the window or the mask resolution changes.
+void createVisibilityMask()
+{
+    if (visibilityMaskScale == 0)
+    {
+        glGenTextures(1, &visibilityMask);
+        glGenTextures(1, &visibilityMaskDepth);
+        glGenFramebuffers(1, &visibilityMaskFBO);
+    }
+    visibilityMaskScale = config.halfResolutionMask ? 2 : 1;
+
+    int maskWidth = (screenWidth + visibilityMaskScale - 1) / visibilityMaskScale;
+    int maskHeight = (screenHeight + visibilityMaskScale - 1) / visibilityMaskScale;
+    glBindTexture(GL_TEXTURE_2D, visibilityMask);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, maskWidth, maskHeight, 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, visibilityMaskDepth);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, maskWidth, maskHeight, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, visibilityMaskFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, visibilityMask, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, visibilityMaskDepth, 0);
+    unsigned int attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, attachments);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-
 void setShadowUniforms()
 {
     shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
@@ -555,10 +1496,21 @@ void setShadowUniforms()
     glActiveTexture(GL_TEXTURE6);
     glBindTexture(GL_TEXTURE_2D, shadowMap);
 
-    shader->setMat4("rainSpaceMatrix", rainSpaceMatrix);
-    shader->setInt("rainMap", 7);
+    shader->setVec3("wetnessVolumeMin", wetnessVolume->boundsMin);
+    shader->setVec3("wetnessVolumeSize", wetnessVolume->boundsSize);
+    shader->setFloat("wetnessNormalOffset", glm::length(wetnessVolume->voxelSize()) * 0.5f);
+    shader->setInt("wetnessVolume", 7);
     glActiveTexture(GL_TEXTURE7);
-    glBindTexture(GL_TEXTURE_2D, rainMap);
+    glBindTexture(GL_TEXTURE_3D, wetnessVolume->texture);
+
+    // the VISIBILITY_MASK variants read shadow and wetness from the mask instead
+    shader->setInt("visibilityMaskScale", visibilityMaskScale);
+    shader->setInt("visibilityMask", 8);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, visibilityMask);
+    shader->setInt("visibilityMaskDepth", 9);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, visibilityMaskDepth);
 
 }
 void setRainMapUniforms()
@@ -572,14 +1524,14 @@ void setRainMapUniforms()
 
 void setRainUniforms() {
 
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 viewProjection = projection * view;
-
-    shader->setMat4("viewProjection", viewProjection);
+    shader->setMat4("viewProjection", frameCamera.viewProjection);
 
     shader->setFloat("currentTime", currentTime);
     shader->setFloat("boxSize", config.rainBoxSize);
+    shader->setInt("rainCount", config.rainCount);
+    // without the sheets the fade starts beyond the corners of the rain box
+    shader->setFloat("nearFieldFadeStart", config.rainSheets ? config.rainBoxSize * 0.35f : config.rainBoxSize);
+    shader->setFloat("nearFieldFadeEnd", config.rainSheets ? config.rainBoxSize * 0.5f : config.rainBoxSize * 2.0f);
     shader->setFloat("deltaTime", deltaTime);
 
     shader->setVec3("cameraPosition", camera.Position);
@@ -590,13 +1542,14 @@ void setRainUniforms() {
 }
 
 void setSplashUniforms(){
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 viewProjection = projection * view;
-    shader->setMat4("viewProjection", viewProjection);
+    shader->setMat4("viewProjection", frameCamera.viewProjection);
 
     shader->setFloat("currentTime", currentTime);
     shader->setFloat("boxSize", config.rainBoxSize);
+    shader->setInt("rainCount", config.rainCount);
+    // without the sheets the fade starts beyond the corners of the rain box
+    shader->setFloat("nearFieldFadeStart", config.rainSheets ? config.rainBoxSize * 0.35f : config.rainBoxSize);
+    shader->setFloat("nearFieldFadeEnd", config.rainSheets ? config.rainBoxSize * 0.5f : config.rainBoxSize * 2.0f);
     shader->setFloat("deltaTime", deltaTime);
 
     shader->setVec3("cameraPosition", camera.Position);
@@ -608,6 +1561,7 @@ void setSplashUniforms(){
 
     shader->setFloat("splashQuadSize",config.splashQuadSize);
     shader->setMat4("rainSpaceMatrix", rainSpaceMatrix);
+    shader->setMat4("inverseRainSpaceMatrix", glm::inverse(rainSpaceMatrix));
     shader->setInt("rainMap", 0);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, rainMap);
@@ -626,12 +1580,76 @@ void setAmbientUniforms(glm::vec3 ambientLightColor)
     // ambient uniforms
     shader->setVec4("ambientLightColor", glm::vec4(ambientLightColor, glm::length(ambientLightColor) > 0.0f ? 1.0f : 0.0f));
 }
+// the light part of a pbr variant: positional lights are attenuated, the directional ones shadowed
+uint32_t pbrLightFeatures(const Light& light)
+{
+    return light.radius > 0.0f ? PBR_POINT_LIGHT : PBR_SHADOW;
+}
+
+// Gives every mesh of the scene its material features and compiles the variants the lights need
+void setupPbrMaterials()
+{
+    for (Model* model : { carBodyModel, carPaintModel, carInteriorModel, carLightModel, carWindowsModel, carWheelModel,
+                          floorModel, houseBodyModel, houseRoofModel, houseDetailsModel, stoneModel })
+        setPbrMaterial(model);
+
+    // the lighting passes of the configured lights, toggling the mask or adding lights compiles the rest when needed
+    uint32_t maskFeature = config.visibilityMask ? PBR_VISIBILITY_MASK : 0;
+    std::vector<uint32_t> passes = { PBR_INDIRECT_LIGHT | pbrLightFeatures(config.lights[0]) | maskFeature };
+    for (size_t i = 1; i < config.lights.size(); i++)
+        passes.push_back(pbrLightFeatures(config.lights[i]) | maskFeature);
+    for (uint32_t pass : passes)
+        for (uint32_t material : pbrMaterials)
+            pbrVariants->get(pass | material);
+}
+
+// The material features of the meshes of a model, from their textures. Also for models that were reloaded, new
+// combinations compile their variants when they are first drawn
+void setPbrMaterial(Model* model)
+{
+    // pbr_shading.frag always shaded with a metalness of 0, whatever drawObjects set, so no material is METALNESS yet.
+    // Only the interior is under the roof of the car
+    uint32_t features = model == carInteriorModel ? 0 : PBR_WETNESS;
+    for (Mesh& mesh : model->meshes)
+    {
+        mesh.variantFeatures = features;
+        for (const Texture& texture : mesh.textures)
+        {
+            if (texture.type == "texture_normal")
+                mesh.variantFeatures |= PBR_NORMAL_MAP;
+            else if (texture.type == "texture_ambient")
+                mesh.variantFeatures |= PBR_AMBIENT_OCCLUSION_MAP;
+        }
+        if (std::find(pbrMaterials.begin(), pbrMaterials.end(), mesh.variantFeatures) == pbrMaterials.end())
+            pbrMaterials.push_back(mesh.variantFeatures);
+    }
+}
+
+// Draws the objects once per material variant of the pass, each variant gets the uniforms of the pass and draws
+// the meshes with its material features. Variants that are still compiling leave their meshes out
+void drawPbrObjects(uint32_t passFeatures, Light& light)
+{
+    for (uint32_t material : pbrMaterials)
+    {
+        Shader* variant = pbrVariants->get(passFeatures | material);
+        if (!variant->ready())
+            continue;
+        shader = variant;
+        shader->use();
+        setAmbientUniforms(passFeatures & PBR_INDIRECT_LIGHT ? config.ambientLightColor * config.ambientLightIntensity : glm::vec3(0.0f));
+        setLightUniforms(light);
+        setShadowUniforms();
+        drawnMaterial = material;
+        drawObjects();
+    }
+}
+
 void setLightUniforms(Light& light)
 {
     glm::vec3 lightEnergy = light.color * light.intensity;
 
 
-    if (shader->ID==pbr_shading->ID){
+    if (pbrVariants->contains(shader)){
         lightEnergy *= PI;
     }
 
@@ -644,6 +1662,8 @@ void setLightUniforms(Light& light)
 
 void drawShadowMap()
 {
+    if (!shadowMap_shader->ready())
+        return;
     Shader* currShader = shader;
     shader = shadowMap_shader;
 
@@ -676,7 +1696,7 @@ void drawShadowMap()
     glClear(GL_DEPTH_BUFFER_BIT);
 
     // draw scene from the light's perspective into the depth texture
-    drawObjects();
+    drawObjects(true);
 
     // unbind the depth texture from the frame buffer, now we can render to the screen (frame buffer) again
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -686,9 +1706,153 @@ void drawShadowMap()
     shader = currShader;
 }
 
+// Lays down the depth of the main view into the scene framebuffer, position only
+void drawDepthPrepass()
+{
+    Shader* currShader = shader;
+    shader = depthPrepass_shader;
+    shader->use();
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    drawObjects(true);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    shader = currShader;
+}
+
+// Only lets fragments matching the pre-pass depth through, so the expensive PBR shader runs once per pixel.
+// The depth stays in the same buffer, copying it with glBlitFramebuffer is not guaranteed to be bit exact.
+void setupDepthPrepassEqual()
+{
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+}
+
+// Copies the offscreen scene into the window, the GUI is drawn on top afterwards
+void drawSceneToScreen()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // a plain copy until the composite program is linked
+    if (!composite_shader->ready())
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glBlitFramebuffer(0, 0, screenWidth, screenHeight, 0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return;
+    }
+    glDisable(GL_DEPTH_TEST);
+
+    composite_shader->use();
+    composite_shader->setInt("sceneColor", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sceneColor);
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+// Writes the camera of this frame into the Camera uniform block. Everything that depends on the camera is
+// submitted after this, so it is called once the camera independent passes are done and the input was polled
+void latchCamera()
+{
+    TRACE_SCOPE("Latch camera");
+    frameCamera.projection = glm::perspective(glm::radians(camera.Zoom), (float)screenWidth / (float)screenHeight, 0.1f, 100.0f);
+    frameCamera.view = camera.GetViewMatrix();
+    frameCamera.viewProjection = frameCamera.projection * frameCamera.view;
+    frameCamera.inverseViewProjection = glm::inverse(frameCamera.viewProjection);
+    frameCamera.position = glm::vec4(camera.Position, 1.0f);
+
+    size_t offset;
+    memcpy(streamingBuffer->map(sizeof(FrameCamera), streamingBuffer->uniformAlignment, offset), &frameCamera, sizeof(FrameCamera));
+    streamingBuffer->unmap();
+    glBindBufferRange(GL_UNIFORM_BUFFER, cameraBlockBinding, streamingBuffer->id, offset, sizeof(FrameCamera));
+    latencyProbe->latch();
+}
+
+// Takes the camera position, the time and the light animation of this frame from the simulation thread,
+// interpolated between its last two ticks. Without the thread they advance here by the frame time
+void updateSimulation()
+{
+    TRACE_SCOPE("Update simulation");
+    if (config.simulationThread != (simulation != nullptr))
+    {
+        delete simulation;
+        simulation = config.simulationThread ? new Simulation(camera.Position, currentTime) : nullptr;
+    }
+
+    if (!simulation)
+    {
+        if (config.animateLights)
+            lightAngle += lightRotationSpeed * deltaTime;
+        return;
+    }
+
+    SimulationState state = simulation->sample();
+    camera.Position = state.cameraPosition;
+    currentTime = (float)state.time;
+    lightAngle = state.lightAngle;
+}
+
+// the light turned around the y axis by lightAngle, for the additional lights
+Light animatedLight(const Light& light)
+{
+    float c = cos(lightAngle), s = sin(lightAngle);
+    Light turned = light;
+    turned.position = glm::vec3(c * light.position.x - s * light.position.z, light.position.y, s * light.position.x + c * light.position.z);
+    return turned;
+}
+
+// Evaluates the directional shadow and the wetness once per pixel from the scene depth
+void drawVisibilityMask()
+{
+    if (visibilityMaskScale != (config.halfResolutionMask ? 2 : 1))
+        createVisibilityMask();
+
+    visibilityMaskTimer->begin();
+    visibilityMask_shader->use();
+    visibilityMask_shader->setInt("maskScale", visibilityMaskScale);
+    visibilityMask_shader->setMat4("lightSpaceMatrix", lightSpaceMatrix);
+    visibilityMask_shader->setVec3("wetnessVolumeMin", wetnessVolume->boundsMin);
+    visibilityMask_shader->setVec3("wetnessVolumeSize", wetnessVolume->boundsSize);
+    visibilityMask_shader->setFloat("wetnessNormalOffset", glm::length(wetnessVolume->voxelSize()) * 0.5f);
+
+    visibilityMask_shader->setInt("sceneDepth", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, sceneDepth);
+    visibilityMask_shader->setInt("shadowMap", 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, shadowMap);
+    visibilityMask_shader->setInt("wetnessVolume", 2);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_3D, wetnessVolume->texture);
+
+    int viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    int maskSize[2];
+    glBindTexture(GL_TEXTURE_2D, visibilityMask);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &maskSize[0]);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &maskSize[1]);
+    glViewport(0, 0, maskSize[0], maskSize[1]);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, visibilityMaskFBO);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(fullscreenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glActiveTexture(GL_TEXTURE0);
+    visibilityMaskTimer->end();
+}
+
 // Taken from ex 8
 void drawRainMap()
 {
+    profiler->begin("Rain map");
     Shader* currShader = shader;
     shader = rainSplash_shader;
 
@@ -711,21 +1875,85 @@ void drawRainMap()
     glViewport(0, 0, RAINSPLASH_WIDTH, RAINSPLASH_HEIGHT);
     glBindFramebuffer(GL_FRAMEBUFFER, rainMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects();
+    drawObjects(true);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
     shader = currShader;
+    profiler->end();
+}
+// Re-renders the rain map and re-bakes the wetness volume when the rain direction changes.
+// After a change the new exposure is blended in over config.wetnessResponse seconds.
+void updateWetness()
+{
+    // baked once its programs are linked
+    if (!rainSplash_shader->ready() || !wetnessVolume->ready())
+        return;
+    if (config.velocity != bakedRainVelocity || wetnessVolume->kernelRadius != config.wetnessBlurRadius || rainMapOutdated)
+    {
+        drawRainMap();
+        rainMapOutdated = false;
+        // the very first bake has nothing to fade from
+        wetnessSettle = rainMapDirty ? 0.0f : 1.0f;
+        rainMapDirty = false;
+        bakedRainVelocity = config.velocity;
+        wetnessVolume->kernelRadius = config.wetnessBlurRadius;
+    }
+
+    // volume is up to date
+    if (wetnessSettle < 0.0f)
+        return;
+
+    float blend = config.wetnessResponse > 0.0f ? glm::clamp(deltaTime * 4.0f / config.wetnessResponse, 0.0f, 1.0f) : 1.0f;
+    wetnessSettle *= 1.0f - blend;
+
+    // finish with a full bake once what is left of the old one is no longer visible
+    if (wetnessSettle < 0.01f)
+    {
+        wetnessVolume->bake(rainMap, rainSpaceMatrix);
+        wetnessSettle = -1.0f;
+    }
+    else
+        wetnessVolume->bake(rainMap, rainSpaceMatrix, blend);
+}
+// Compares the GPU bake against WetnessVolume::bakeReference and prints the largest difference
+void validateWetnessBake()
+{
+    std::vector<float> rainDepth(RAINSPLASH_WIDTH * RAINSPLASH_HEIGHT);
+    glBindTexture(GL_TEXTURE_2D, rainMap);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, &rainDepth[0]);
+
+    glm::ivec3 res = wetnessVolume->resolution;
+    std::vector<float> baked((size_t)res.x * res.y * res.z);
+    glBindTexture(GL_TEXTURE_3D, wetnessVolume->texture);
+    glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, &baked[0]);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    std::vector<float> reference;
+    WetnessVolume::bakeReference(rainDepth, RAINSPLASH_WIDTH, RAINSPLASH_HEIGHT, rainSpaceMatrix, res,
+                                 wetnessVolume->boundsMin, wetnessVolume->boundsSize,
+                                 wetnessVolume->kernelRadius, wetnessVolume->bias, wetnessVolume->maxWetness, reference);
+
+    float maxError = 0.0f;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < baked.size(); i++)
+    {
+        float error = std::abs(baked[i] - reference[i]);
+        maxError = std::max(maxError, error);
+        // one tap flipping on a depth edge is expected, anything more is a real difference
+        if (error > 1.5f / 15.0f)
+            mismatches++;
+    }
+    std::cout << "Wetness bake: max difference to CPU reference " << maxError << ", "
+              << mismatches << " of " << baked.size() << " voxels differ by more than one tap" << std::endl;
 }
 void drawSkybox()
 {
+    if (!skyboxShader->ready())
+        return;
     // render skybox
     glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
     skyboxShader->use();
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    skyboxShader->setMat4("projection", projection);
-    skyboxShader->setMat4("view", view);
     skyboxShader->setInt("skybox", 0);
 
     // skybox cube
@@ -736,22 +1964,18 @@ void drawSkybox()
     glBindVertexArray(0);
     glDepthFunc(GL_LESS); // set depth function back to default
 }
-void drawObjects()
+void drawObjects(bool depthOnly)
 {
-    // the typical transformation uniforms are already set for you, these are:
-    // projection (perspective projection matrix)
-    // view (to map world space coordinates to the camera space, so the camera position becomes the origin)
-    // model (for each model part we draw)
-
-    // camera parameters
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 viewProjection = projection * view;
+    // depth-only passes use the position stream and skip the material textures
+    auto drawModel = [depthOnly](Model* model) {
+        if (depthOnly)
+            model->DrawDepth();
+        else
+            model->Draw(*shader, drawnMaterial);
+    };
 
-    // camera position
-    shader->setVec3("camPosition", camera.Position);
-    // set viewProjection matrix uniform
-    shader->setMat4("viewProjection", viewProjection);
+    // the camera comes from the Camera uniform block written by latchCamera,
+    // model (for each model part we draw) is set here
 
     // set up skybox texture
     shader->setInt("skybox", 5);
@@ -769,7 +1993,7 @@ void drawObjects()
 
     glm::mat4 model = glm::mat4(1.0f);
     shader->setMat4("model", model);
-    carPaintModel->Draw(*shader);
+    drawModel(carPaintModel);
 
     // material uniforms for other car parts (hardcoded)
     shader->setVec3("reflectionColor", 1.0f, 1.0f, 1.0f);
@@ -780,41 +2004,41 @@ void drawObjects()
     shader->setFloat("roughness", 0.5f);
     shader->setFloat("metalness", 0.5f);
 
-    carBodyModel->Draw(*shader);
+    drawModel(carBodyModel);
 
     // draw car
     shader->setMat4("model", model);
-    carLightModel->Draw(*shader);
-    carInteriorModel->Draw(*shader);
+    drawModel(carLightModel);
+    drawModel(carInteriorModel);
 
     // draw wheel
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, 1.39f));
     shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    drawModel(carWheelModel);
 
     // draw wheel
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-.7432f, .328f, -1.39f));
     shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    drawModel(carWheelModel);
 
     // draw wheel
     model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
     model = glm::translate(model, glm::vec3(-.7432f, .328f, 1.39f));
     shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    drawModel(carWheelModel);
 
     // draw wheel
     model = glm::rotate(glm::mat4(1.0f), glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
     model = glm::translate(model, glm::vec3(-.7432f, .328f, -1.39f));
     shader->setMat4("model", model);
-    carWheelModel->Draw(*shader);
+    drawModel(carWheelModel);
 
     // draw floor
     model = glm::scale(glm::mat4(1.0), glm::vec3(5.f, 5.f, 5.f));
     shader->setMat4("model", model);
 
     shader->setVec4("texCoordTransform", glm::vec4(4.0f, 4.0f, 0, 0));
-    floorModel->Draw(*shader);
+    drawModel(floorModel);
     shader->setVec4("texCoordTransform", glm::vec4(1, 1, 0, 0));
 
 
@@ -822,7 +2046,7 @@ void drawObjects()
     model = glm::mat4(1.0f);
     shader->setMat4("model", model);
 
-    carWindowsModel->Draw(*shader);
+    drawModel(carWindowsModel);
 
 
     // draw house
@@ -830,24 +2054,24 @@ void drawObjects()
     model = glm::rotate(model, glm::pi<float>(), glm::vec3(0.0, 1.0, 0.0));
     model = glm::translate(model, glm::vec3(1.55f, -0.05f, 0.0f));
     shader->setMat4("model", model);
-    houseDetailsModel->Draw(*shader);
+    drawModel(houseDetailsModel);
 
     shader->setVec4("texCoordTransform", glm::vec4(12.0f, 12.0f, 0, 0));
     shader->setFloat("roughness", 0.95f);
     shader->setFloat("specularReflectance", 0.002f);
     shader->setFloat("specularExponent", 0.02f);
-    houseBodyModel->Draw(*shader);
+    drawModel(houseBodyModel);
 
 
     shader->setVec4("texCoordTransform", glm::vec4(4.0f, 4.0f, 0, 0));
     shader->setFloat("roughness", 0.95f);
     shader->setFloat("specularReflectance", 0.05f);
-    houseRoofModel->Draw(*shader);
+    drawModel(houseRoofModel);
 
     shader->setVec4("texCoordTransform", glm::vec4(1, 1, 0, 0));
     shader->setFloat("roughness", 0.95f);
     shader->setFloat("specularReflectance", 0.005f);
-    stoneModel->Draw(*shader);
+    drawModel(stoneModel);
 
 
 }
@@ -865,16 +2089,178 @@ void drawGui(){
         ImGui::Text("Camera: %f, %f, %f",camera.Position.x,camera.Position.y,camera.Position.x);
         ImGui::Separator();
 
+        ImGui::Combo("Frame pacing", &framePacer.mode, "Uncapped\0VSync\0Target FPS\0");
+        if (framePacer.mode == FramePacer::TARGET_FPS)
+        {
+            ImGui::SliderFloat("Target FPS", &framePacer.targetFps, 10.0f, 240.0f, "%.0f");
+            ImGui::Checkbox("Start frames as late as possible", &framePacer.lateStart);
+        }
+        ImGui::Text("Frame %.2f ms median, %.2f ms 95%%, %.2f ms 99%%", framePacer.percentileMs(0.5f),
+                    framePacer.percentileMs(0.95f), framePacer.percentileMs(0.99f));
+        ImGui::Text("CPU %.0f%% of a core, %.2f ms predicted work per frame", framePacer.cpuUtilization * 100.0f, framePacer.predictedWorkMs);
+        ImGui::Text("Streaming buffer %s, %.1f MB per frame, waited %.3f ms for the GPU, %.3f ms max, %d stalled frames",
+                    streamingBuffer->persistent ? "persistent" : "unsynchronized", streamingBuffer->capacity() / 1048576.0f,
+                    streamingBuffer->waitMs, streamingBuffer->maxWaitMs, streamingBuffer->stalledFrames);
+        ImGui::Checkbox("Low latency input", &config.lowLatencyInput);
+        ImGui::Text("Input to swap %.2f ms average, %.2f ms max, input %.2f ms old at the camera latch",
+                    latencyProbe->averageMs, latencyProbe->maxMs, latencyProbe->inputAgeMs);
+        ImGui::Separator();
+
+        ImGui::Text("Profiler: ");
+        ImGui::Text("Frame GPU %.3f ms, CPU %.3f ms, %d frames dropped", profiler->frameGpuMs, profiler->frameCpuMs, profiler->droppedFrames);
+        ImGui::Text("%-20s %-26s %-26s", "", "GPU avg / min / max", "CPU avg / min / max");
+        for (const Profiler::Scope& scope : profiler->scopes())
+            ImGui::Text("%*s%-*s %7.3f %7.3f %7.3f   %7.3f %7.3f %7.3f", scope.depth * 2, "", 20 - scope.depth * 2, scope.name.c_str(),
+                        scope.gpuAverage, scope.gpuMin, scope.gpuMax, scope.cpuAverage, scope.cpuMin, scope.cpuMax);
+        drawProfilerGraph();
+#ifdef RAINY_DAY_TRACE
+        if (traceFramesLeft > 0)
+            ImGui::Text("Capturing the CPU trace, %d frames left", traceFramesLeft);
+        else if (ImGui::Button("Capture CPU trace"))
+            startTraceCapture();
+        ImGui::SliderInt("Trace frames", &config.traceFrames, 1, 1000);
+#else
+        ImGui::Text("CPU trace: built without RAINY_DAY_TRACE");
+#endif
+        ImGui::Separator();
+
+        if (GlCapture::windowFramesLeft() > 0)
+            ImGui::Text("Capturing GL calls, %d frames left", GlCapture::windowFramesLeft());
+        else if (GlCapture::capturing() && ImGui::Button("Capture GL frames"))
+            GlCapture::beginWindow(benchOptions.captureFrames);
+        ImGui::Checkbox("GL call statistics", &config.glStats);
+        if (config.glStats)
+            drawGlStats();
+        ImGui::Separator();
+
+        if (hotReload)
+        {
+            ImGui::Text("Hot reload: watching %d folders, %d reloading", hotReload->watchedDirectories(), hotReload->reloading());
+            for (const HotReload::Reload& reload : hotReload->history())
+                ImGui::Text("  %-36s %2d programs %2d textures %2d models %3d failed, %7.1f ms", reload.file.c_str(), reload.programs,
+                            reload.textures, reload.models, reload.failed, reload.latencyMs);
+            ImGui::Separator();
+        }
+
+        ImGui::Text("Camera path: ");
+        ImGui::Combo("Path", &config.cameraPath, "Car fly-around\0Behind the house\0File\0");
+        ImGui::InputText("Path file", config.cameraPathFile, sizeof(config.cameraPathFile));
+        if (pathPlayer)
+        {
+            if (ImGui::Button("Stop playback"))
+                stopPathPlayback();
+            ImGui::SameLine();
+            ImGui::Text("%.1f / %.1f s", fmod(playTime, pathPlayer->duration()), pathPlayer->duration());
+        }
+        else if (ImGui::Button("Play"))
+        {
+            const std::vector<std::string>& standard = CameraPath::standardNames();
+            startPathPlayback(config.cameraPath < (int)standard.size() ? standard[config.cameraPath] : config.cameraPathFile);
+        }
+        if (pathRecorder)
+        {
+            if (ImGui::Button("Stop recording"))
+                stopPathRecording(config.cameraPathFile);
+            ImGui::SameLine();
+            ImGui::Text("%d ticks, %d setting changes", (int)pathRecorder->path().keys.size(), (int)pathRecorder->path().events.size());
+        }
+        else if (ImGui::Button("Record to the path file"))
+            startPathRecording();
+        ImGui::Separator();
+
+        ImGui::Checkbox("Simulation thread", &config.simulationThread);
+        if (simulation)
+            ImGui::Text("Simulation %.0f ticks/s, %.3f ms per tick, %d ticks dropped", simulation->ticksPerSecond.load(),
+                        simulation->tickMs.load(), simulation->droppedTicks.load());
+        ImGui::Checkbox("Animate lights", &config.animateLights);
+        ImGui::SliderFloat("Light rotation speed", &lightRotationSpeed, -3.0f, 3.0f);
+        ImGui::Separator();
+
         ImGui::Text("Rain: ");
+        ImGui::SliderInt("Rain drops", &config.rainCount, 1000, 4000000, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::Combo("Rain path", &config.rainPath, rainPathNames, 4);
+        if (config.rainPath == 2 && !rainSimulation)
+            config.rainPath = 0;    // needs GL 4.3
+        if (config.rainPath == 2)
+            ImGui::Text("Simulated %d drops, %d streaks visible, %d splashing", config.rainCount,
+                        rainSimulation->visibleStreaks, rainSimulation->activeSplashes);
+        if (config.rainPath == 3)
+            ImGui::Text("Simulated %d drops in %.3f ms on %d threads, %d streaks visible, %d splashing", config.rainCount,
+                        cpuRainUpdateMs, threadPool->size(), (int)cpuRain.streaks.size(), (int)cpuRain.splashes.size());
+        if (ImGui::Button("Validate CPU rain"))
+            validateCpuRain();
+        ImGui::SameLine();
+        if (ImGui::Button("Run CPU rain benchmark"))
+            runCpuRainBenchmark();
+        for (const CpuRainBenchmarkResult& result : cpuRainBenchmarkResults)
+            ImGui::Text("  %8d drops, %s, %2d threads: %8.3f ms (%6.1f M drops/s per core)", result.drops, result.simd ? "SIMD  " : "scalar",
+                        result.threads, result.updateMs, result.drops / (result.updateMs * 1000.0f) / result.threads);
+        ImGui::Combo("Rain resolution", &config.rainResolution, "Full\0Half\0Quarter\0");
+        ImGui::Checkbox("Far field rain sheets", &config.rainSheets);
+        ImGui::SliderFloat("Rain sheet opacity", &rainSheets->opacityScale, 0.0f, 3.0f);
+        ImGui::Text("Rain pass %.3f ms full, %.3f ms half, %.3f ms quarter resolution", rainPassMs[0], rainPassMs[1], rainPassMs[2]);
+        ImGui::Text("Rain and splashes %.3f ms, %.1f M drops/s", rainTimer->milliseconds(),
+                    config.rainCount / std::max(rainTimer->milliseconds() * 1000.0f, 0.001f));
+        if (rainBenchmarkStep >= 0)
+            ImGui::Text("Benchmarking %d drops...", config.rainCount);
+        else if (ImGui::Button("Run rain benchmark"))
+            startRainBenchmark();
+        for (const RainBenchmarkResult& result : rainBenchmarkResults)
+            ImGui::Text("  %8d drops, %s: rain %7.3f ms (%6.1f M drops/s), frame %7.3f ms",
+                        result.drops, rainPathNames[result.path], result.rainMs, result.drops / std::max(result.rainMs * 1000.0f, 0.001f), result.frameMs);
         ImGui::DragFloat3("Rain velocity", (float*)&config.velocity, .1f, -minMaxValue, minMaxValue);
         ImGui::DragFloat("Rain splash size", (float*)&config.splashQuadSize, .01f, 0.01f, 0.1f);
         ImGui::DragFloat("Rain splash speed", (float*)&config.splashSpeed, .01f, 0.1f, 1.0f);
+        ImGui::SliderInt("Wetness blur", &config.wetnessBlurRadius, 0, 4);
+        ImGui::DragFloat("Wetness response (s)", &config.wetnessResponse, .05f, 0.0f, 10.0f);
+        if (ImGui::Button("Validate wetness bake"))
+            validateWetnessBake();
 
         ImGui::Separator();
 
+        ImGui::Text("Stress scene: ");
+        ImGui::Checkbox("Draw stress scene", &config.stressScene);
+        ImGui::SliderInt("Stress objects", &config.stressObjects, 1000, 100000, "%d", ImGuiSliderFlags_Logarithmic);
+        ImGui::Checkbox("Record on the thread pool", &config.stressMultithreaded);
+        if (config.stressScene)
+            ImGui::Text("%d visible, record %.3f ms on %d threads, submit %.3f ms, %d commands, %d binds skipped", stressScene->visibleObjects,
+                        stressScene->recordMs, config.stressMultithreaded ? threadPool->size() : 1, stressScene->submitMs,
+                        commandSubmitter->commandCount, commandSubmitter->skippedBinds);
+        if (ImGui::Button("Run stress benchmark"))
+            runStressBenchmark();
+        for (const StressBenchmarkResult& result : stressBenchmarkResults)
+            ImGui::Text("  %d threads: record %7.3f ms, %4.2fx, %s", result.threads, result.recordMs,
+                        stressBenchmarkResults[0].recordMs / result.recordMs, result.identical ? "identical" : "different commands");
+        if (!stressBenchmarkResults.empty())
+            ImGui::Text("  submit %.3f ms", stressBenchmarkSubmitMs);
+
 
         ImGui::Separator();
 
+        ImGui::Text("Visibility mask: ");
+        ImGui::Checkbox("Shared shadow/wetness mask", &config.visibilityMask);
+        ImGui::Checkbox("Half resolution mask", &config.halfResolutionMask);
+        ImGui::Text("Mask pass %.3f ms", visibilityMaskTimer->milliseconds());
+        ImGui::Text("Additional lights: %d", (int)config.lights.size() - 1);
+        ImGui::SameLine();
+        if (ImGui::Button("Add point light"))
+        {
+            float angle = config.lights.size() * 2.4f;
+            config.lights.emplace_back(glm::vec3(4.0f * cos(angle), 2.0f, 4.0f * sin(angle)), glm::vec3(1.0f, 0.8f, 0.6f), 4.0f, 10.0f);
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Remove") && config.lights.size() > 1)
+            config.lights.pop_back();
+        ImGui::Text("Per additional light %.3f ms without mask, %.3f ms with mask (saved %.3f ms)",
+                    additionalLightMs[0], additionalLightMs[1], additionalLightMs[0] - additionalLightMs[1]);
+        ImGui::Separator();
+
+        ImGui::Text("Depth pre-pass: ");
+        ImGui::Checkbox("Depth pre-pass", &config.depthPrepass);
+        double coveredPixels = std::max((double)screenWidth * screenHeight - skyFragmentsQuery->result, 1.0);
+        ImGui::Text("PBR fragments %.0f, %.2f per covered pixel", pbrFragmentsQuery->result, pbrFragmentsQuery->result / coveredPixels);
+        ImGui::Text("Skybox fragments %.0f", skyFragmentsQuery->result);
+        ImGui::Separator();
 
         ImGui::Text("Light 1: ");
         ImGui::DragFloat3("light 1 direction", (float*)&config.lights[0].position, .1f, -20, 20);
@@ -906,7 +2292,174 @@ void drawGui(){
 
 
 
+// Stacked GPU time of the passes at the top level over the last frames read back, one color per pass.
+// The part of the frame outside of every pass stays grey
+void drawProfilerGraph()
+{
+    const std::vector<Profiler::Scope>& scopes = profiler->scopes();
+    float maxMs = 1.0f;
+    for (float ms : profiler->frameGpuHistory)
+        maxMs = std::max(maxMs, ms);
+
+    ImVec2 size(ImGui::GetContentRegionAvail().x, 100.0f);
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::Dummy(size);
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    drawList->AddRectFilled(origin, ImVec2(origin.x + size.x, origin.y + size.y), IM_COL32(20, 20, 20, 255));
+
+    float barWidth = size.x / Profiler::HISTORY;
+    for (int frame = 0; frame < Profiler::HISTORY; frame++)
+    {
+        int index = profiler->historyIndex(Profiler::HISTORY - 1 - frame);
+        float x = origin.x + frame * barWidth;
+        float bottom = origin.y + size.y;
+        float frameTop = bottom - profiler->frameGpuHistory[index] / maxMs * size.y;
+        drawList->AddRectFilled(ImVec2(x, frameTop), ImVec2(x + barWidth, bottom), IM_COL32(90, 90, 90, 255));
+        for (size_t i = 0; i < scopes.size(); i++)
+        {
+            float ms = scopes[i].gpuHistory[index];
+            if (scopes[i].depth != 0 || ms <= 0.0f)
+                continue;
+            float top = bottom - ms / maxMs * size.y;
+            drawList->AddRectFilled(ImVec2(x, top), ImVec2(x + barWidth, bottom), ImColor::HSV(i * 0.13f, 0.6f, 0.9f));
+            bottom = top;
+        }
+    }
+    ImGui::Text("%.2f ms at the top", maxMs);
+
+    for (size_t i = 0; i < scopes.size(); i++)
+    {
+        if (scopes[i].depth != 0)
+            continue;
+        ImGui::ColorButton(scopes[i].name.c_str(), ImColor::HSV(i * 0.13f, 0.6f, 0.9f), ImGuiColorEditFlags_NoTooltip, ImVec2(10, 10));
+        ImGui::SameLine();
+        ImGui::Text("%s", scopes[i].name.c_str());
+        ImGui::SameLine();
+    }
+    ImGui::NewLine();
+}
+
+// GL calls of the last frame by category and by pass, the redundant ones are those that changed no state
+void drawGlStats()
+{
+    const GlStats::Counts& frame = glStats->frame();
+    ImGui::Text("%d GL calls, %d redundant, %.2f MB uploaded", frame.totalCalls(), frame.totalRedundant(),
+                frame.uploadBytes / 1048576.0f);
+    ImGui::Text("%-14s %6s %9s", "", "calls", "redundant");
+    for (int category = 0; category < GlStats::CATEGORY_COUNT; category++)
+        if (frame.calls[category])
+            ImGui::Text("%-14s %6d %9d", GlStats::categoryName(category), frame.calls[category], frame.redundant[category]);
+    ImGui::Text("%-20s %6s %6s %9s", "", "calls", "draws", "redundant");
+    for (const GlStats::Pass& pass : glStats->passes())
+        if (pass.counts.totalCalls())
+            ImGui::Text("%-20s %6d %6d %9d", pass.name.c_str(), pass.counts.totalCalls(), pass.counts.calls[GlStats::DRAW],
+                        pass.counts.totalRedundant());
+
+    ImGui::Checkbox("KHR_debug performance messages", &config.glDebugMessages);
+    if (config.glDebugMessages)
+    {
+        ImGui::Text("%d this frame, start with --gl-debug for a debug context", frame.debugMessages);
+        for (const GlStats::DebugMessage& message : glStats->debugMessages())
+            ImGui::TextWrapped("%dx %s", message.count, message.text.c_str());
+    }
+}
+
+// records the CPU scopes of all threads for the next config.traceFrames frames
+void startTraceCapture()
+{
+    traceFramesLeft = config.traceFrames;
+    TRACE_START();
+}
+
+// call once per frame, writes the capture to trace_<n>.json after its last frame
+void updateTraceCapture()
+{
+    if (traceFramesLeft <= 0 || --traceFramesLeft > 0)
+        return;
+    char path[64];
+    snprintf(path, sizeof(path), "trace_%d.json", ++traceCaptures);
+    TRACE_STOP(path);
+}
+
+// the settings a camera path records and plays back, by the names they have in the files
+std::vector<CameraPath::Setting> cameraPathSettings()
+{
+    return {
+        { "rainPath", &config.rainPath },
+        { "rainCount", &config.rainCount },
+        { "rainResolution", &config.rainResolution },
+        { "rainSheets", &config.rainSheets },
+        { "wetnessBlurRadius", &config.wetnessBlurRadius },
+        { "visibilityMask", &config.visibilityMask },
+        { "halfResolutionMask", &config.halfResolutionMask },
+        { "depthPrepass", &config.depthPrepass },
+        { "animateLights", &config.animateLights },
+        { "lightRotationSpeed", &lightRotationSpeed },
+        { "stressScene", &config.stressScene },
+        { "stressObjects", &config.stressObjects },
+    };
+}
+
+// a standard path by name, otherwise a file. Playback needs the simulation thread off, the path owns the camera and the clock
+bool startPathPlayback(const std::string& nameOrFile)
+{
+    CameraPath path;
+    if (!CameraPath::standard(nameOrFile, path) && !path.load(nameOrFile))
+        return false;
+    delete pathPlayer;
+    pathPlayer = new CameraPathPlayer(path, cameraPathSettings());
+    playTime = 0.0f;
+    lightAngle = 0.0f;
+    if (!playbackRestoresSimulation)
+        playbackRestoresSimulation = config.simulationThread;
+    config.simulationThread = false;
+    return true;
+}
+
+void stopPathPlayback()
+{
+    delete pathPlayer;
+    pathPlayer = nullptr;
+    config.simulationThread = config.simulationThread || playbackRestoresSimulation;
+    playbackRestoresSimulation = false;
+}
+
+void startPathRecording()
+{
+    delete pathRecorder;
+    pathRecorder = new CameraPathRecorder(cameraPathSettings());
+    recordTime = 0.0f;
+}
+
+void stopPathRecording(const std::string& file)
+{
+    if (pathRecorder->path().save(file))
+        std::cout << "Camera path: recorded " << pathRecorder->path().duration() << " s to " << file << std::endl;
+    delete pathRecorder;
+    pathRecorder = nullptr;
+}
+
+// after the simulation moved the camera and before it is latched. During playback the animation runs on
+// the path clock, so the same time in the path always shows the same frame
+void updateCameraPath()
+{
+    if (pathPlayer)
+    {
+        if (!pathPlayer->update(playTime, camera))
+            stopPathPlayback();
+        else
+            currentTime = playTime;
+        playTime += deltaTime;
+    }
+    if (pathRecorder)
+    {
+        pathRecorder->update(recordTime, camera);
+        recordTime += deltaTime;
+    }
+}
+
 void processInput(GLFWwindow *window) {
+    TRACE_SCOPE("Input");
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
 
@@ -914,6 +2467,23 @@ void processInput(GLFWwindow *window) {
       //  return;
 
     // movement commands
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS ||
+        glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        latencyProbe->inputEvent();
+    if (simulation)
+    {
+        SimulationInput input;
+        input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+        input.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+        input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+        input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+        input.front = camera.Front;
+        input.side = camera.Right;
+        input.movementSpeed = camera.MovementSpeed;
+        input.lightRotationSpeed = config.animateLights ? lightRotationSpeed : 0.0f;
+        simulation->setInput(input);
+        return;
+    }
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
         camera.ProcessKeyboard(FORWARD, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
@@ -930,8 +2500,7 @@ void processInput(GLFWwindow *window) {
 
 void setupForwardAdditionalPass()
 {
-    // Remove ambient from additional passes
-    setAmbientUniforms(glm::vec3(0.0f));
+    // Ambient is removed from additional passes, their variants are without INDIRECT_LIGHT
 
     // Enable additive blending
     glEnable(GL_BLEND);
@@ -966,6 +2535,7 @@ void cursor_input_callback(GLFWwindow* window, double posX, double posY){
 
     // we use the handy camera class from LearnOpenGL to handle our camera
     camera.ProcessMouseMovement(xoffset, yoffset);
+    latencyProbe->inputEvent();
 }
 void key_input_callback(GLFWwindow* window, int button, int other, int action, int mods){
     // controls pause mode
@@ -979,6 +2549,7 @@ void key_input_callback(GLFWwindow* window, int button, int other, int action, i
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 {
     camera.ProcessMouseScroll((float)yoffset);
+    latencyProbe->inputEvent();
 }
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
@@ -986,6 +2557,17 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     // make sure the viewport matches the new window dimensions; note that width and
     // height will be significantly larger than specified on retina displays.
     glViewport(0, 0, width, height);
+
+    // screen sized targets follow the window (minimized windows report 0x0)
+    if (width > 0 && height > 0)
+    {
+        screenWidth = width;
+        screenHeight = height;
+        createSceneFramebuffer();
+        createVisibilityMask();
+        if (particleTargetScale != 0)
+            createParticleTarget();
+    }
 }
 void resetForwardAdditionalPass()
 {
@@ -1074,24 +2656,18 @@ unsigned int initSkyboxBuffers() {
 // -------------------------------------------------------
 unsigned int loadCubemap(vector<std::string> faces)
 {
+    TRACE_SCOPE("Load cubemap");
     unsigned int textureID;
     glGenTextures(1, &textureID);
     glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-    int width, height, nrComponents;
     for (unsigned int i = 0; i < faces.size(); i++)
     {
-        unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_SRGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
+        TextureImage image(faces[i]);
+        if (image.data)
+            uploadCubemapFace(textureID, i, image);
         else
-        {
             std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
     }
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -1106,3 +2682,23 @@ unsigned int loadCubemap(vector<std::string> faces)
     return textureID;
 }
 
+// The ambient light of the skybox for the Camera block, cached unless the faces were just reloaded
+void updateSkyIrradiance(const vector<std::string>& faces, bool reprojected)
+{
+    if (reprojected || !skyIrradiance.load(faces))
+    {
+        skyIrradiance.project(faces, threadPool);
+        skyIrradiance.save(faces);
+    }
+    skyIrradiance.printStats();
+    for (int i = 0; i < 9; i++)
+        frameCamera.irradiance[i] = skyIrradiance.coefficients[i];
+}
+
+// (re)defines one face of the cubemap, leaving it bound. The mipmaps are generated by the caller
+void uploadCubemapFace(unsigned int textureID, int face, const TextureImage& image)
+{
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+}
+
@@ -41,6 +41,8 @@ public:
     vector<unsigned int> indices;
     vector<Texture> textures;
     unsigned int VAO;
+    unsigned int depthVAO; // positions only, for the depth-only passes
+    uint32_t variantFeatures = 0; // material part of the shader variant key it is drawn with (shader_variants.h)
 
     /*  Functions  */
     // constructor
@@ -54,8 +56,37 @@ public:
         setupMesh();
     }
 
+    // replaces the data of the mesh, re-uploading it into the buffers it already has, so the VAOs stay as they are
+    void update(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    {
+        this->vertices = vertices;
+        this->indices = indices;
+        this->textures = textures;
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        vector<glm::vec3> positions = this->positions();
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // the element buffer binding belongs to the VAO
+        glBindVertexArray(VAO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBindVertexArray(0);
+    }
+
+    // deletes the buffers and arrays, the textures belong to the model
+    void release()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &depthVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &positionVBO);
+    }
+
     // render the mesh
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
     {
         // bind appropriate textures
         unsigned int diffuseNr  = 1;
@@ -92,11 +123,28 @@ public:
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // render the mesh positions only, no textures are bound
+    void DrawDepth()
+    {
+        glBindVertexArray(depthVAO);
+        glDrawElements(GL_TRIANGLES, (int)indices.size(), GL_UNSIGNED_INT, 0);
+        glBindVertexArray(0);
+    }
+
 private:
     /*  Render data  */
     unsigned int VBO, EBO;
+    unsigned int positionVBO;
 
     /*  Functions    */
+    vector<glm::vec3> positions() const
+    {
+        vector<glm::vec3> positions(vertices.size());
+        for (unsigned int i = 0; i < vertices.size(); i++)
+            positions[i] = vertices[i].Position;
+        return positions;
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
@@ -134,6 +182,22 @@ private:
         glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
         glBindVertexArray(0);
+
+        // the depth-only passes (shadow map, rain map, depth pre-pass) only read the positions, so they get
+        // their own tightly packed stream that shares the index buffer with the full vertex layout
+        vector<glm::vec3> positions = this->positions();
+
+        glGenVertexArrays(1, &depthVAO);
+        glGenBuffers(1, &positionVBO);
+
+        glBindVertexArray(depthVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+        glBindVertexArray(0);
     }
 };
 #endif
\ No newline at end of file
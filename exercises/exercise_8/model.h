@@ -13,6 +13,7 @@
 
 #include <mesh.h>
 #include <shader.h>
+#include <trace.h>
 
 #include <string>
 #include <fstream>
@@ -24,34 +25,84 @@ using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// the pixels of an image file, decoded without touching GL so it can be done on any thread
+struct TextureImage
+{
+    unsigned char *data;
+    int width = 0, height = 0, nrComponents = 0;
+
+    explicit TextureImage(const string &filename)
+    {
+        data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
+    }
+    ~TextureImage()
+    {
+        stbi_image_free(data);
+    }
+    TextureImage(const TextureImage&) = delete;
+    TextureImage& operator=(const TextureImage&) = delete;
+};
+
+// (re)defines the 2D texture textureID with the image and its mipmaps
+void uploadTexture(unsigned int textureID, const TextureImage &image, bool gamma);
+
 class Model
 {
 public:
+    // a model as read from its file, without any GL objects, so it can be imported on any thread (hot_reload.h)
+    struct Data
+    {
+        struct MeshData
+        {
+            vector<Vertex> vertices;
+            vector<unsigned int> indices;
+            vector<pair<string, string>> textures;  // type and path, relative to the directory of the model
+        };
+        vector<MeshData> meshes;
+        bool loaded = false;
+    };
+
     /*  Model Data */
     vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh> meshes;
     string directory;
+    string path;
     bool gammaCorrection;
 
     /*  Functions   */
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false) : path(path), gammaCorrection(gamma)
     {
-        loadModel(path);
+        upload(import(path));
     }
 
     // draws the model, and thus all its meshes
-    void Draw(Shader shader)
+    void Draw(Shader &shader)
     {
         for(unsigned int i = 0; i < meshes.size(); i++)
             meshes[i].Draw(shader);
     }
 
-private:
-    /*  Functions   */
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+    // draws the meshes drawn with the variant of the given material features, the other variants draw the rest
+    void Draw(Shader &shader, uint32_t variantFeatures)
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            if (meshes[i].variantFeatures == variantFeatures)
+                meshes[i].Draw(shader);
+    }
+
+    // draws only the positions of all meshes, for depth-only passes
+    void DrawDepth()
+    {
+        for(unsigned int i = 0; i < meshes.size(); i++)
+            meshes[i].DrawDepth();
+    }
+
+    // reads a model with supported ASSIMP extensions from file, loaded is false when it could not be read
+    static Data import(string const &path)
     {
+        TRACE_SCOPE("Load model");
+        Data data;
         // read file via ASSIMP
         Assimp::Importer importer;
         const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
@@ -59,17 +110,59 @@ private:
         if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
         {
             cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            return data;
         }
+
+        // process ASSIMP's root node recursively
+        processNode(scene->mRootNode, scene, data);
+        data.loaded = true;
+        return data;
+    }
+
+    // creates the GL objects of the meshes in data. The meshes the model already has are re-uploaded into their
+    // buffers instead, and textures loaded before are kept. A model that could not be read keeps what it had
+    void upload(const Data &data)
+    {
+        if (!data.loaded)
+            return;
         // retrieve the directory path of the filepath
         directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        for (size_t i = 0; i < data.meshes.size(); i++)
+        {
+            const Data::MeshData &mesh = data.meshes[i];
+            vector<Texture> textures = loadMaterialTextures(mesh.textures);
+            if (i < meshes.size())
+                meshes[i].update(mesh.vertices, mesh.indices, textures);
+            else
+                meshes.push_back(Mesh(mesh.vertices, mesh.indices, textures));
+        }
+        for (size_t i = data.meshes.size(); i < meshes.size(); i++)
+            meshes[i].release();
+        meshes.erase(meshes.begin() + data.meshes.size(), meshes.end());
+    }
+
+    // whether a texture of the model is read from filename, relative to the working directory like the path
+    bool usesTexture(const string &filename) const
+    {
+        for (const Texture &texture : textures_loaded)
+            if (directory + '/' + texture.path == filename)
+                return true;
+        return false;
     }
 
+    // uploads image into the textures read from filename, the meshes keep their texture IDs
+    void reloadTexture(const string &filename, const TextureImage &image)
+    {
+        for (const Texture &texture : textures_loaded)
+            if (directory + '/' + texture.path == filename)
+                uploadTexture(texture.id, image, texture.type == "texture_diffuse");
+    }
+
+private:
+    /*  Functions   */
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    static void processNode(aiNode *node, const aiScene *scene, Data &data)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -77,22 +170,22 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            data.meshes.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, data);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    static Data::MeshData processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        Data::MeshData data;
+        vector<Vertex> &vertices = data.vertices;
+        vector<unsigned int> &indices = data.indices;
 
         // Walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -151,36 +244,41 @@ private:
         // normal: texture_normalN
 
         // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        materialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
         // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        materialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
         // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+        materialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
         // 4. ambient maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_ambient");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+        materialTextures(material, aiTextureType_AMBIENT, "texture_ambient", data.textures);
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data, upload() makes the Mesh with its GL objects
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // appends the type and path of all material textures of a given type
+    static void materialTextures(aiMaterial *mat, aiTextureType type, const string &typeName, vector<pair<string, string>> &textures)
     {
-        vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
+            textures.push_back({ typeName, str.C_Str() });
+        }
+    }
+
+    // checks the material textures of a mesh and loads the textures if they're not loaded yet.
+    // the required info is returned as a Texture struct.
+    vector<Texture> loadMaterialTextures(const vector<pair<string, string>> &materialTextures)
+    {
+        vector<Texture> textures;
+        for(const auto &materialTexture : materialTextures)
+        {
             // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
             bool skip = false;
             for(unsigned int j = 0; j < textures_loaded.size(); j++)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+                if(textures_loaded[j].path == materialTexture.second)
                 {
                     textures.push_back(textures_loaded[j]);
                     skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
@@ -190,9 +288,9 @@ private:
             if(!skip)
             {   // if texture hasn't been loaded already, load it
                 Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory, type == aiTextureType_DIFFUSE);
-                texture.type = typeName;
-                texture.path = str.C_Str();
+                texture.id = TextureFromFile(materialTexture.second.c_str(), this->directory, materialTexture.first == "texture_diffuse");
+                texture.type = materialTexture.first;
+                texture.path = materialTexture.second;
                 textures.push_back(texture);
                 textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
             }
@@ -204,93 +302,63 @@ private:
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
+    TRACE_SCOPE("Load texture");
     string filename = string(path);
     filename = directory + '/' + filename;
 
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format, internalFormat;
-        if (nrComponents == 1)
-            internalFormat = format = GL_RED;
-        else if (nrComponents == 3)
-        {
-            format = GL_RGB;
-            internalFormat = gamma ? GL_SRGB : format;
-        }
-        else if (nrComponents == 4)
-        {
-            format = GL_RGBA;
-            internalFormat = gamma ? GL_SRGB_ALPHA : format;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
+    TextureImage image(filename);
+    if (image.data)
+        uploadTexture(textureID, image, gamma);
     else
-    {
         std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
 
     return textureID;
 }
 
 unsigned int TextureFromFileMod(string path, const string &directory, bool gamma)
 {
+    TRACE_SCOPE("Load texture");
     string filename = path;
     filename = directory + '/' + filename;
 
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format, internalFormat;
-        if (nrComponents == 1)
-            internalFormat = format = GL_RED;
-        else if (nrComponents == 3)
-        {
-            format = GL_RGB;
-            internalFormat = gamma ? GL_SRGB : format;
-        }
-        else if (nrComponents == 4)
-        {
-            format = GL_RGBA;
-            internalFormat = gamma ? GL_SRGB_ALPHA : format;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    TextureImage image(filename);
+    if (image.data)
+        uploadTexture(textureID, image, gamma);
+    else
+        std::cout << "Texture failed to load at path: " << path << std::endl;
 
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return textureID;
+}
 
-        stbi_image_free(data);
+void uploadTexture(unsigned int textureID, const TextureImage &image, bool gamma)
+{
+    GLenum format, internalFormat;
+    if (image.nrComponents == 1)
+        internalFormat = format = GL_RED;
+    else if (image.nrComponents == 3)
+    {
+        format = GL_RGB;
+        internalFormat = gamma ? GL_SRGB : format;
     }
-    else
+    else if (image.nrComponents == 4)
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        format = GL_RGBA;
+        internalFormat = gamma ? GL_SRGB_ALPHA : format;
     }
 
-    return textureID;
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 }
 #endif
\ No newline at end of file
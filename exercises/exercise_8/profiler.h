@@ -0,0 +1,258 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <trace.h>
+#include <gl_stats.h>
+#include <gl_capture.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+// Named GPU and CPU timings of the passes of a frame.
+// Every begin()/end() pair writes a GL timestamp on both sides and measures the CPU time in between, so scopes
+// can nest and can run around passes that already have a GpuTimer (only one GL_TIME_ELAPSED query can be
+// active at a time). The queries of a frame live in one of FRAME_COUNT pools, which is read back when the pool
+// comes around again. If its results are still not there the frame is dropped instead of waiting for it.
+// Statistics cover the last HISTORY frames that were read back, in milliseconds.
+// Every scope also goes to the CPU trace (trace.h) under the same name, so names have to be string literals,
+// is a pass of the GL call statistics (gl_stats.h) when those are set and a pass marker of a running GL capture
+// (gl_capture.h).
+class Profiler
+{
+public:
+    static const int FRAME_COUNT = 3;
+    static const int HISTORY = 240;
+
+    struct Scope
+    {
+        std::string name;
+        int depth = 0;              // 0 for passes of the frame, 1 for passes inside those, ...
+        float gpuAverage = 0.0f, gpuMin = 0.0f, gpuMax = 0.0f;
+        float cpuAverage = 0.0f, cpuMin = 0.0f, cpuMax = 0.0f;
+        std::vector<float> gpuHistory, cpuHistory;   // per read back frame, negative when the scope did not run
+    };
+
+    // the whole frame, from beginFrame to endFrame
+    float frameGpuMs = 0.0f;
+    float frameCpuMs = 0.0f;
+    std::vector<float> frameGpuHistory;
+    int droppedFrames = 0;      // read back too late to fit in FRAME_COUNT frames
+    int readBackFrames = 0;     // frames that made it into the histories so far
+    GlStats* glStats = nullptr;
+
+    Profiler() : frameGpuHistory(HISTORY, 0.0f)
+    {
+    }
+
+    ~Profiler()
+    {
+        for (Frame& frame : frames)
+            if (!frame.queries.empty())
+                glDeleteQueries((GLsizei)frame.queries.size(), &frame.queries[0]);
+    }
+
+    void beginFrame()
+    {
+        current = (current + 1) % FRAME_COUNT;
+        Frame& frame = frames[current];
+        if (frame.pending)
+            readBack(frame);
+        frame.samples.clear();
+        frame.usedQueries = 0;
+        frame.pending = true;
+        frame.cpuStart = Clock::now();
+        glQueryCounter(query(frame), GL_TIMESTAMP);
+    }
+
+    // call after the last command of the frame, before swapping
+    void endFrame()
+    {
+        Frame& frame = frames[current];
+        glQueryCounter(query(frame), GL_TIMESTAMP);
+        frame.cpuMs = std::chrono::duration<float, std::milli>(Clock::now() - frame.cpuStart).count();
+    }
+
+    void begin(const char* name)
+    {
+        Frame& frame = frames[current];
+        Sample sample;
+        sample.scope = scopeIndex(name, (int)open.size());
+        sample.name = name;
+        sample.traceStart = TRACE_NOW();
+        sample.beginQuery = frame.usedQueries;
+        glQueryCounter(query(frame), GL_TIMESTAMP);
+        sample.cpuStart = Clock::now();
+        open.push_back((int)frame.samples.size());
+        frame.samples.push_back(sample);
+        if (glStats)
+            glStats->beginPass(name);
+        GlCapture::beginPass(name);
+    }
+
+    void end()
+    {
+        if (glStats)
+            glStats->endPass();
+        GlCapture::endPass();
+        Frame& frame = frames[current];
+        Sample& sample = frame.samples[open.back()];
+        open.pop_back();
+        sample.cpuMs = std::chrono::duration<float, std::milli>(Clock::now() - sample.cpuStart).count();
+        sample.endQuery = frame.usedQueries;
+        glQueryCounter(query(frame), GL_TIMESTAMP);
+        TRACE_EVENT(sample.name, sample.traceStart);
+    }
+
+    const std::vector<Scope>& scopes() const
+    {
+        return scopeList;
+    }
+
+    // rolling averages by name, 0 for a scope that never ran
+    float gpuMs(const char* name) const
+    {
+        const Scope* scope = find(name);
+        return scope ? scope->gpuAverage : 0.0f;
+    }
+
+    float cpuMs(const char* name) const
+    {
+        const Scope* scope = find(name);
+        return scope ? scope->cpuAverage : 0.0f;
+    }
+
+    // index into the histories of the frame read back framesAgo frames before the latest one
+    int historyIndex(int framesAgo) const
+    {
+        return ((nextHistory - 1 - framesAgo) % HISTORY + HISTORY) % HISTORY;
+    }
+
+private:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    struct Sample
+    {
+        int scope;
+        int beginQuery, endQuery;       // indices into the queries of the frame
+        Clock::time_point cpuStart;
+        float cpuMs = 0.0f;
+        const char* name;
+        int64_t traceStart;
+    };
+
+    struct Frame
+    {
+        std::vector<unsigned int> queries;  // only grows, the first and the last used are the frame itself
+        int usedQueries = 0;
+        std::vector<Sample> samples;
+        bool pending = false;
+        Clock::time_point cpuStart;
+        float cpuMs = 0.0f;
+        std::vector<GLuint64> times;
+    };
+
+    Frame frames[FRAME_COUNT];
+    int current = 0;
+    std::vector<int> open;              // samples begun and not ended yet, innermost last
+    std::vector<Scope> scopeList;
+    int nextHistory = 0;
+
+    unsigned int query(Frame& frame)
+    {
+        if (frame.usedQueries == (int)frame.queries.size())
+        {
+            unsigned int id;
+            glGenQueries(1, &id);
+            frame.queries.push_back(id);
+        }
+        return frame.queries[frame.usedQueries++];
+    }
+
+    const Scope* find(const char* name) const
+    {
+        for (const Scope& scope : scopeList)
+            if (scope.name == name)
+                return &scope;
+        return nullptr;
+    }
+
+    int scopeIndex(const char* name, int depth)
+    {
+        for (size_t i = 0; i < scopeList.size(); i++)
+            if (scopeList[i].name == name)
+                return (int)i;
+        Scope scope;
+        scope.name = name;
+        scope.depth = depth;
+        scope.gpuHistory.assign(HISTORY, -1.0f);
+        scope.cpuHistory.assign(HISTORY, -1.0f);
+        scopeList.push_back(scope);
+        return (int)scopeList.size() - 1;
+    }
+
+    // timestamps complete in order, so once the frame's last one is there all of them are
+    void readBack(Frame& frame)
+    {
+        frame.pending = false;
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.usedQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            droppedFrames++;
+            return;
+        }
+        frame.times.resize(frame.usedQueries);
+        for (int i = 0; i < frame.usedQueries; i++)
+            glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &frame.times[i]);
+
+        int slot = nextHistory;
+        nextHistory = (nextHistory + 1) % HISTORY;
+        readBackFrames++;
+        for (Scope& scope : scopeList)
+            scope.gpuHistory[slot] = scope.cpuHistory[slot] = -1.0f;
+        // a scope can run more than once per frame, its times add up
+        for (const Sample& sample : frame.samples)
+        {
+            Scope& scope = scopeList[sample.scope];
+            float gpuMs = (frame.times[sample.endQuery] - frame.times[sample.beginQuery]) / 1000000.0f;
+            scope.gpuHistory[slot] = std::max(scope.gpuHistory[slot], 0.0f) + gpuMs;
+            scope.cpuHistory[slot] = std::max(scope.cpuHistory[slot], 0.0f) + sample.cpuMs;
+        }
+        // the frame's end timestamp is the last query, written after all the scopes
+        frameGpuMs = (frame.times[frame.usedQueries - 1] - frame.times[0]) / 1000000.0f;
+        frameCpuMs = frame.cpuMs;
+        frameGpuHistory[slot] = frameGpuMs;
+
+        for (Scope& scope : scopeList)
+        {
+            summarize(scope.gpuHistory, scope.gpuAverage, scope.gpuMin, scope.gpuMax);
+            summarize(scope.cpuHistory, scope.cpuAverage, scope.cpuMin, scope.cpuMax);
+        }
+    }
+
+    static void summarize(const std::vector<float>& history, float& average, float& minimum, float& maximum)
+    {
+        float sum = 0.0f;
+        int count = 0;
+        minimum = 1e30f;
+        maximum = 0.0f;
+        for (float ms : history)
+        {
+            if (ms < 0.0f)
+                continue;
+            sum += ms;
+            count++;
+            minimum = std::min(minimum, ms);
+            maximum = std::max(maximum, ms);
+        }
+        average = count ? sum / count : 0.0f;
+        if (!count)
+            minimum = 0.0f;
+    }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// Linked programs saved with glGetProgramBinary and loaded again with glProgramBinary on the next launch, so
+// Shader does not compile and link its programs every time (the geometry shader programs take long on software
+// drivers). A program is found by a hash of the sources of all its stages, as they are compiled (defines
+// included), and of the vendor, renderer and version strings of the driver, so editing a shader or updating the
+// driver misses the cache. A binary the driver rejects anyway is compiled from the sources and saved again.
+//
+// Files are DIRECTORY/<hash>.bin, little endian: "RPRG", uint32 version, uint32 binary format, float milliseconds
+// the compile and link took (what a hit saves, less the load), uint32 size and the binary.
+class ProgramCache
+{
+public:
+    static constexpr const char* DIRECTORY = "shader_cache";
+    static const uint32_t MAGIC = 0x47525052;     // "RPRG"
+    static const uint32_t VERSION = 1;
+
+    struct Stats
+    {
+        int hits = 0;
+        int misses = 0;         // not in the cache, or the driver rejected the binary
+        int rejected = 0;       // of the misses
+        float loadMs = 0.0f;    // of the hits
+        float compileMs = 0.0f; // of the misses
+        float savedMs = 0.0f;   // what the hits took to compile when they were saved, less what they took to load
+    };
+
+    // off while a GL capture runs (gl_capture.h), a replay has to compile the sources
+    static bool& enabled()
+    {
+        static bool on = true;
+        return on;
+    }
+
+    static Stats& stats()
+    {
+        static Stats cacheStats;
+        return cacheStats;
+    }
+
+    // a key for the stages of a program, by type and source
+    static uint64_t key(const std::vector<std::pair<GLenum, const std::string*>>& stages)
+    {
+        uint64_t hash = 14695981039346656037ull;    // FNV-1a
+        auto add = [&hash](const void* data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= ((const unsigned char*)data)[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        uint32_t version = VERSION;
+        add(&version, sizeof(version));
+        for (const auto& stage : stages)
+        {
+            add(&stage.first, sizeof(stage.first));
+            add(stage.second->data(), stage.second->size() + 1);
+        }
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char* text = (const char*)glGetString(name);
+            std::string value = text ? text : "";
+            add(value.data(), value.size() + 1);
+        }
+        return hash;
+    }
+
+    // links program from the cached binary, false when there is none or the driver does not take it
+    static bool load(uint64_t key, GLuint program)
+    {
+        if (!available())
+            return false;
+        auto start = std::chrono::steady_clock::now();
+        FILE* file = fopen(path(key).c_str(), "rb");
+        if (!file)
+        {
+            stats().misses++;
+            return false;
+        }
+        uint32_t header[3] = {};
+        float compileMs = 0.0f;
+        uint32_t size = 0;
+        std::vector<char> binary;
+        bool read = fread(header, sizeof(header), 1, file) == 1 && header[0] == MAGIC && header[1] == VERSION &&
+                    fread(&compileMs, sizeof(compileMs), 1, file) == 1 && fread(&size, sizeof(size), 1, file) == 1;
+        if (read)
+        {
+            binary.resize(size);
+            read = size > 0 && fread(&binary[0], 1, size, file) == size;
+        }
+        fclose(file);
+
+        GLint linked = GL_FALSE;
+        if (read)
+        {
+            glProgramBinary(program, header[2], &binary[0], (GLsizei)size);
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        }
+        if (!linked)
+        {
+            stats().misses++;
+            stats().rejected++;
+            return false;
+        }
+        float loadMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        stats().hits++;
+        stats().loadMs += loadMs;
+        stats().savedMs += compileMs - loadMs;
+        return true;
+    }
+
+    // whether linked programs are stored, they need GL_PROGRAM_BINARY_RETRIEVABLE_HINT set before linking
+    static bool storing()
+    {
+        return available();
+    }
+
+    // saves the binary of a linked program, compileMs is how long compiling and linking it took
+    static void store(uint64_t key, GLuint program, float compileMs)
+    {
+        if (!available())
+            return;
+        stats().compileMs += compileMs;
+        GLint linked = GL_FALSE, size = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+        if (!linked || size <= 0)
+            return;
+        std::vector<char> binary(size);
+        GLenum format = 0;
+        glGetProgramBinary(program, size, &size, &format, &binary[0]);
+
+#ifdef _WIN32
+        _mkdir(DIRECTORY);
+#else
+        mkdir(DIRECTORY, 0755);
+#endif
+        FILE* file = fopen(path(key).c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "Program cache: could not write " << path(key) << std::endl;
+            return;
+        }
+        uint32_t header[3] = { MAGIC, VERSION, format };
+        uint32_t binarySize = (uint32_t)size;
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(&compileMs, sizeof(compileMs), 1, file);
+        fwrite(&binarySize, sizeof(binarySize), 1, file);
+        fwrite(&binary[0], 1, binarySize, file);
+        fclose(file);
+    }
+
+    static void printStats()
+    {
+        const Stats& cache = stats();
+        if (!available())
+            std::cout << "Program cache: not used, " << (enabled() ? "the driver has no program binary formats" : "turned off") << std::endl;
+        else
+            printf("Program cache: %d hits, %d misses (%d rejected), %.1f ms loading, %.1f ms compiling, %.1f ms saved\n",
+                   cache.hits, cache.misses, cache.rejected, cache.loadMs, cache.compileMs, cache.savedMs);
+        fflush(stdout);
+    }
+
+private:
+    // binaries need GL 4.1 or ARB_get_program_binary, and a driver that offers at least one format
+    static bool available()
+    {
+        static int formats = -1;
+        if (formats < 0)
+        {
+            formats = 0;
+            if (glProgramBinary && glGetProgramBinary)
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        }
+        return enabled() && formats > 0;
+    }
+
+    static std::string path(uint64_t key)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "%s/%016llx.bin", DIRECTORY, (unsigned long long)key);
+        return name;
+    }
+};
+
+#endif
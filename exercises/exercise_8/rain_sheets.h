@@ -0,0 +1,125 @@
+#ifndef RAIN_SHEETS_H
+#define RAIN_SHEETS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.h>
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+// Far field rain. Beyond the rain box the individual drops are replaced by a few cylinders around the
+// camera textured with a scrolling sheet of streaks, so the rain reaches the horizon while the number
+// of drops and the blended area stay about the same. The sheet texture is generated at startup.
+class RainSheets
+{
+public:
+    static const int LAYER_COUNT = 3;
+
+    unsigned int texture;
+    float radius[LAYER_COUNT] = { 0.45f, 1.2f, 3.0f };    // in rain box sizes, the first one overlaps the fading edge of the box
+    float opacity[LAYER_COUNT] = { 0.35f, 0.3f, 0.25f };
+    float opacityScale = 1.0f;
+
+    // constructor, generates the sheet texture and loads the shader
+    RainSheets()
+    {
+        std::vector<unsigned char> pixels;
+        generateSheet(pixels);
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, TEXTURE_SIZE, TEXTURE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, &pixels[0]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        shader = new Shader("shaders/rain_sheet.vert", "shaders/rain_sheet.frag");
+    }
+
+    ~RainSheets()
+    {
+        glDeleteTextures(1, &texture);
+        delete shader;
+    }
+
+    // draws all layers, farthest first, with the blending already set up by the caller.
+    // The cylinder vertices are generated from gl_VertexID, so any VAO can be bound.
+    void draw(const glm::mat4 &viewProjection, glm::vec3 cameraPosition, glm::vec3 velocity, float currentTime, float boxSize)
+    {
+        // left out while the program is compiling (shader_compiler.h)
+        if (!shader->ready())
+            return;
+        float radii[LAYER_COUNT];
+        float opacities[LAYER_COUNT];
+        for (int i = 0; i < LAYER_COUNT; i++)
+        {
+            radii[i] = radius[i] * boxSize;
+            opacities[i] = opacity[i] * opacityScale;
+        }
+
+        shader->use();
+        shader->setMat4("viewProjection", viewProjection);
+        shader->setVec3("cameraPosition", cameraPosition);
+        shader->setVec3("velocity", velocity);
+        shader->setFloat("currentTime", currentTime);
+        shader->setFloat("boxSize", boxSize);
+        shader->setInt("segments", SEGMENTS);
+        glUniform1fv(glGetUniformLocation(shader->ID, "radius"), LAYER_COUNT, radii);
+        glUniform1fv(glGetUniformLocation(shader->ID, "opacity"), LAYER_COUNT, opacities);
+        shader->setInt("layerCount", LAYER_COUNT);
+        shader->setInt("rainSheet", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+
+        glDrawArraysInstanced(GL_TRIANGLES, 0, SEGMENTS * 6, LAYER_COUNT);
+    }
+
+private:
+    static const int TEXTURE_SIZE = 256;
+    static const int SEGMENTS = 48;    // around each cylinder
+    Shader* shader;
+
+    // Tileable sheet of vertical streaks with a soft horizontal profile and random length and brightness
+    static void generateSheet(std::vector<unsigned char> &pixels)
+    {
+        std::vector<float> sheet(TEXTURE_SIZE * TEXTURE_SIZE, 0.0f);
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+        for (int streak = 0; streak < 300; streak++)
+        {
+            float x = uniform(random) * TEXTURE_SIZE;
+            int head = (int)(uniform(random) * TEXTURE_SIZE);
+            int length = 16 + (int)(uniform(random) * 48.0f);
+            float brightness = 0.3f + 0.7f * uniform(random);
+
+            for (int i = 0; i < length; i++)
+            {
+                // brightest at the head of the streak, fading towards the tail
+                float intensity = brightness * (1.0f - (float)i / length);
+                int y = (head + i) % TEXTURE_SIZE;
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int column = ((int)std::floor(x) + dx + TEXTURE_SIZE) % TEXTURE_SIZE;
+                    float distance = std::fabs(std::floor(x) + dx + 0.5f - x);
+                    float value = intensity * std::max(0.0f, 1.0f - distance);
+                    float &texel = sheet[y * TEXTURE_SIZE + column];
+                    texel = std::max(texel, value);
+                }
+            }
+        }
+
+        pixels.resize(sheet.size());
+        for (size_t i = 0; i < sheet.size(); i++)
+            pixels[i] = (unsigned char)(std::min(sheet[i], 1.0f) * 255.0f + 0.5f);
+    }
+};
+
+#endif
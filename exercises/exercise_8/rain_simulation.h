@@ -0,0 +1,195 @@
+#ifndef RAIN_SIMULATION_H
+#define RAIN_SIMULATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.h>
+
+#include <vector>
+
+// GPU rain simulation, needs a GL 4.3 context.
+// A compute pass evaluates every drop once per frame, culls it against the view frustum and the rain map
+// and appends the visible streaks and the active splashes to two compacted buffers. The vertex counts of
+// two indirect draw commands are accumulated with atomics in the same pass, so the draws only process
+// what survived and the CPU never needs to know how many that was.
+class RainSimulation
+{
+public:
+    Shader* simulateShader;
+    Shader* drawShader;
+
+    // counts read back from the GPU a few frames late, for display only
+    int visibleStreaks = 0;
+    int activeSplashes = 0;
+
+    RainSimulation()
+    {
+        simulateShader = new Shader("shaders/rain_simulate.comp");
+        drawShader = new Shader("shaders/rain_compacted.vert", "shaders/rain.frag");
+
+        glGenBuffers(1, &commandBuffer);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(resetCommands), resetCommands, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+        glGenBuffers(1, &streakBuffer);
+        glGenBuffers(1, &splashBuffer);
+
+        glGenBuffers(READBACK_COUNT, readbackBuffers);
+        for (int i = 0; i < READBACK_COUNT; i++)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[i]);
+            glBufferData(GL_COPY_WRITE_BUFFER, sizeof(resetCommands), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    ~RainSimulation()
+    {
+        for (int i = 0; i < READBACK_COUNT; i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        glDeleteBuffers(READBACK_COUNT, readbackBuffers);
+        glDeleteBuffers(1, &commandBuffer);
+        glDeleteBuffers(1, &streakBuffer);
+        glDeleteBuffers(1, &splashBuffer);
+        delete simulateShader;
+        delete drawShader;
+    }
+
+    // runs the compute pass. simulateShader must be in use with the rain uniforms already set
+    void simulate(int rainCount, const glm::mat4 &viewProjection)
+    {
+        ensureCapacity(rainCount);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(resetCommands), resetCommands);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, streakBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, splashBuffer);
+
+        glm::vec4 planes[5];
+        frustumPlanes(viewProjection, planes);
+        glUniform4fv(glGetUniformLocation(simulateShader->ID, "frustumPlanes"), 5, &planes[0][0]);
+
+        glDispatchCompute((rainCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        readStats();
+    }
+
+    // draw the streaks and the splashes. drawShader must be in use with the rain uniforms set,
+    // any VAO can be bound since the vertices are read from the storage buffers
+    void drawStreaks()
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        drawShader->setBool("splashes", false);
+        glDrawArraysIndirect(GL_LINES, (void*)0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    void drawSplashes()
+    {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        drawShader->setBool("splashes", true);
+        glDrawArraysIndirect(GL_TRIANGLES, (void*)sizeof(DrawArraysIndirectCommand));
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // copies the output of the last simulate back to the CPU, waits for the GPU so only for validation
+    void readBack(std::vector<glm::vec4>& streaks, std::vector<glm::vec4>& splashes)
+    {
+        DrawArraysIndirectCommand commands[2];
+        glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(commands), commands);
+        streaks.resize(commands[0].count / 2);
+        splashes.resize(commands[1].count / 6);
+        glBindBuffer(GL_COPY_READ_BUFFER, streakBuffer);
+        if (!streaks.empty())
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, streaks.size() * sizeof(glm::vec4), &streaks[0]);
+        glBindBuffer(GL_COPY_READ_BUFFER, splashBuffer);
+        if (!splashes.empty())
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, splashes.size() * sizeof(glm::vec4), &splashes[0]);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+
+private:
+    struct DrawArraysIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint first;
+        GLuint baseInstance;
+    };
+
+    static const int WORKGROUP_SIZE = 256;     // local_size_x in rain_simulate.comp
+    static const int READBACK_COUNT = 3;
+    const DrawArraysIndirectCommand resetCommands[2] = { { 0, 1, 0, 0 }, { 0, 1, 0, 0 } };
+
+    unsigned int commandBuffer;
+    unsigned int streakBuffer, splashBuffer;
+    int capacity = 0;
+
+    unsigned int readbackBuffers[READBACK_COUNT];
+    GLsync fences[READBACK_COUNT] = {};
+    int currentReadback = 0;
+
+    // grows the compacted buffers, in the worst case every drop has both a streak and a splash
+    void ensureCapacity(int rainCount)
+    {
+        if (rainCount <= capacity)
+            return;
+        capacity = rainCount;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, streakBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, splashBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)capacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // left, right, bottom, top and the camera plane (w > 0, like the vertex shader path) of the
+    // view projection, pointing inwards. A point is outside if dot(plane.xyz, p) + plane.w < 0
+    static void frustumPlanes(const glm::mat4 &m, glm::vec4 planes[5])
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        planes[0] = row3 + row0;
+        planes[1] = row3 - row0;
+        planes[2] = row3 + row1;
+        planes[3] = row3 - row1;
+        planes[4] = row3;
+    }
+
+    // copies this frame's counts aside and reads the oldest copy if the GPU is done with it
+    void readStats()
+    {
+        GLsync &fence = fences[currentReadback];
+        if (fence)
+        {
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                return;    // still in flight, keep the old numbers and try again next frame
+            glDeleteSync(fence);
+            fence = 0;
+
+            DrawArraysIndirectCommand commands[2];
+            glBindBuffer(GL_COPY_READ_BUFFER, readbackBuffers[currentReadback]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(commands), commands);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            visibleStreaks = commands[0].count / 2;
+            activeSplashes = commands[1].count / 6;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, commandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readbackBuffers[currentReadback]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(resetCommands));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        currentReadback = (currentReadback + 1) % READBACK_COUNT;
+    }
+};
+
+#endif
@@ -0,0 +1,786 @@
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <gl_capture.h>
+
+#include <vector>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+
+// Runs a GL capture of the app (gl_capture.h) again without the app: what came before the captured frames once
+// as setup, then the captured frames in a loop, and reports how long the calls took, by function and by pass.
+//
+//   exercise_8_replay FILE [--loops N] [--top N] [--list] [--disable FIRST-LAST]...
+//
+// CPU times are those of the GL calls themselves, what the driver costs to submit them. GPU times come from
+// timestamps around the passes and the frames, read back after each loop.
+// --list prints the calls of the captured frames with their index, --disable skips a range of those to find
+// which ones cost (bisecting). Calls that create, delete or map objects always run, later ones depend on them.
+// Without a display, build with -DGLFW_USE_OSMESA=ON as for --bench.
+class Replay
+{
+public:
+    int width = 0, height = 0;
+    std::vector<std::pair<int, int>> disabled;      // call index ranges of the window, inclusive
+    bool list = false;
+
+    bool load(const char* path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "Replay: could not read " << path << std::endl;
+            return false;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (read<uint32_t>() != GlCapture::MAGIC || read<uint32_t>() != (uint32_t)GlCapture::VERSION)
+        {
+            std::cout << "Replay: " << path << " is not a GL capture of this version" << std::endl;
+            return false;
+        }
+        width = read<int32_t>();
+        height = read<int32_t>();
+        return !truncated;
+    }
+
+    // everything up to the captured frames, false when there are none
+    bool setup()
+    {
+        while (position < data.size() && !truncated)
+        {
+            int call = read<uint16_t>();
+            if (call == GlCapture::CALL_WINDOW)
+            {
+                windowStart = position;
+                return true;
+            }
+            if (call == GlCapture::CALL_END || !execute(call, true))
+                break;
+        }
+        std::cout << "Replay: the capture has no captured frames" << std::endl;
+        return false;
+    }
+
+    // the captured frames once, times only count when measure is set
+    void loop(GLFWwindow* window, bool measure)
+    {
+        position = windowStart;
+        measuring = measure;
+        callIndex = 0;
+        frameQueries.clear();
+        frameCpuStart = callNs;
+        beginTimestamp(frameQueries);
+        while (position < data.size() && !truncated)
+        {
+            int call = read<uint16_t>();
+            if (call == GlCapture::CALL_END)
+                break;
+            if (call == GlCapture::CALL_FRAME)
+            {
+                glfwSwapBuffers(window);
+                endFrame();
+                continue;
+            }
+            if (call == GlCapture::CALL_PASS_BEGIN || call == GlCapture::CALL_PASS_END)
+            {
+                pass(call);
+                continue;
+            }
+            bool run = !isDisabled(callIndex) || alwaysRuns(call);
+            if (list && measure)
+                std::cout << callIndex << " " << GlCapture::callName(call) << (run ? "" : " (disabled)") << std::endl;
+            callIndex++;
+            if (!execute(call, run))
+                break;
+        }
+        if (measure)
+        {
+            readTimestamps();
+            measuredLoops++;
+            list = false;
+        }
+    }
+
+    void report(int top) const
+    {
+        if (!measuredFrames)
+        {
+            std::cout << "Replay: nothing measured" << std::endl;
+            return;
+        }
+        std::cout << "Replay: " << measuredFrames << " frames, " << callIndex << " calls in the captured frames" << std::endl;
+        printf("%-28s %10s %10s %8s\n", "per frame", "GPU ms", "CPU ms", "calls");
+        printf("%-28s %10.3f %10.3f %8.0f\n", "frame", frameGpuNs / 1e6 / measuredFrames, frameCpuNs / 1e6 / measuredFrames,
+               (double)callIndex * measuredLoops / measuredFrames);
+        for (const Pass& pass : passes)
+            printf("%*s%-*s %10.3f %10.3f %8.0f\n", pass.depth * 2, "", 28 - pass.depth * 2, pass.name.c_str(),
+                   pass.gpuNs / 1e6 / measuredFrames, pass.cpuNs / 1e6 / measuredFrames, (double)pass.calls / measuredFrames);
+
+        std::vector<int> calls;
+        for (int call = 0; call < GlCapture::CALL_COUNT; call++)
+            if (functions[call].count)
+                calls.push_back(call);
+        std::sort(calls.begin(), calls.end(), [this](int a, int b) { return functions[a].ns > functions[b].ns; });
+        printf("\n%-28s %10s %10s %10s\n", "function", "calls", "CPU ms", "us/call");
+        for (int i = 0; i < (int)calls.size() && i < top; i++)
+        {
+            const Function& function = functions[calls[i]];
+            printf("%-28s %10.1f %10.3f %10.3f\n", GlCapture::callName(calls[i]), (double)function.count / measuredFrames,
+                   function.ns / 1e6 / measuredFrames, function.ns / 1e3 / function.count);
+        }
+    }
+
+private:
+    // kinds of object names, in the order of the characters in GL_CAPTURE_FUNCTIONS
+    enum Kind { TEXTURE, BUFFER, VERTEX_ARRAY, FRAMEBUFFER, QUERY, PROGRAM, SHADER, KIND_COUNT };
+
+    struct Function
+    {
+        int64_t count = 0;
+        int64_t ns = 0;
+    };
+
+    struct Pass
+    {
+        std::string name;
+        int depth;
+        double gpuNs = 0.0, cpuNs = 0.0;
+        int64_t calls = 0;
+    };
+
+    struct OpenPass
+    {
+        int pass;
+        int64_t cpuStart;
+        int callStart;
+        int query;
+    };
+
+    std::vector<uint8_t> data;
+    size_t position = 0;
+    size_t windowStart = 0;
+    bool truncated = false;
+
+    std::unordered_map<GLuint, GLuint> names[KIND_COUNT];  // recorded name to the one of the replay
+    std::unordered_map<uint64_t, GLsync> syncs;
+    std::unordered_map<uint64_t, GLint> locations;         // by recorded program and location
+    std::unordered_map<uint64_t, GLuint> blockIndices;     // by recorded program and index
+    std::unordered_map<GLenum, void*> mapped;              // by target
+    GLuint program = 0;                                    // recorded program in use
+    GLuint argumentProgram = 0, argumentShader = 0;        // recorded names of the call being mapped
+    uint64_t argumentSync = 0;
+
+    bool measuring = false;
+    int callIndex = 0;
+    int measuredFrames = 0, measuredLoops = 0;
+    int64_t callNs = 0;                 // time in all the measured calls so far
+    Function functions[GlCapture::CALL_COUNT];
+    std::vector<Pass> passes;
+    std::vector<OpenPass> open;
+    double frameGpuNs = 0.0, frameCpuNs = 0.0;
+    int64_t frameCpuStart = 0;
+
+    // timestamps of the loop, read back at its end: frame boundaries, and begin and end of every pass
+    std::vector<GLuint> queryPool;
+    int usedQueries = 0;
+    std::vector<int> frameQueries;
+    std::vector<std::pair<int, std::pair<int, int>>> passQueries;     // pass, begin and end query
+
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value, T>::type read()
+    {
+        T value = T();
+        if (position + sizeof(T) > data.size())
+        {
+            truncated = true;
+            position = data.size();
+            return value;
+        }
+        memcpy(&value, &data[position], sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_pointer<T>::value, T>::type read()
+    {
+        return (T)(uintptr_t)read<uint64_t>();
+    }
+
+    const void* readData(uint64_t* dataSize = nullptr)
+    {
+        if (dataSize)
+            *dataSize = 0;
+        if (!read<uint8_t>())
+            return nullptr;
+        uint64_t size = read<uint64_t>();
+        if (position + size > data.size())
+        {
+            truncated = true;
+            position = data.size();
+            return nullptr;
+        }
+        const void* bytes = &data[position];
+        position += size;
+        if (dataSize)
+            *dataSize = size;
+        return bytes;
+    }
+
+    std::string readString()
+    {
+        uint32_t length = read<uint32_t>();
+        if (position + length > data.size())
+        {
+            truncated = true;
+            position = data.size();
+            return std::string();
+        }
+        std::string text((const char*)&data[position], length);
+        position += length;
+        return text;
+    }
+
+    bool isDisabled(int index) const
+    {
+        for (const std::pair<int, int>& range : disabled)
+            if (index >= range.first && index <= range.second)
+                return true;
+        return false;
+    }
+
+    static bool alwaysRuns(int call)
+    {
+        switch (call)
+        {
+        case GlCapture::CALL_glCreateProgram: case GlCapture::CALL_glCreateShader:
+        case GlCapture::CALL_glGenBuffers: case GlCapture::CALL_glGenFramebuffers: case GlCapture::CALL_glGenQueries:
+        case GlCapture::CALL_glGenTextures: case GlCapture::CALL_glGenVertexArrays:
+        case GlCapture::CALL_glDeleteBuffers: case GlCapture::CALL_glDeleteFramebuffers: case GlCapture::CALL_glDeleteQueries:
+        case GlCapture::CALL_glDeleteTextures: case GlCapture::CALL_glDeleteVertexArrays:
+        case GlCapture::CALL_glDeleteProgram: case GlCapture::CALL_glDeleteShader:
+        case GlCapture::CALL_glFenceSync: case GlCapture::CALL_glDeleteSync:
+        case GlCapture::CALL_glGetUniformLocation: case GlCapture::CALL_glGetUniformBlockIndex:
+        case GlCapture::CALL_glMapBufferRange: case GlCapture::CALL_glUnmapBuffer:
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Call>
+    void timed(int call, Call function)
+    {
+        if (!measuring)
+        {
+            function();
+            return;
+        }
+        auto start = std::chrono::steady_clock::now();
+        function();
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        functions[call].count++;
+        functions[call].ns += ns;
+        callNs += ns;
+    }
+
+    GLuint name(int kind, GLuint recorded) const
+    {
+        auto found = names[kind].find(recorded);
+        return found != names[kind].end() ? found->second : recorded;
+    }
+
+    // an object the capture created, the one made by an earlier loop for the same recorded name goes away
+    void created(int kind, GLuint recorded, GLuint object)
+    {
+        auto found = names[kind].find(recorded);
+        if (found != names[kind].end() && found->second != object)
+            deleteObject(kind, found->second);
+        names[kind][recorded] = object;
+    }
+
+    static void deleteObject(int kind, GLuint object)
+    {
+        switch (kind)
+        {
+        case TEXTURE: glad_glDeleteTextures(1, &object); break;
+        case BUFFER: glad_glDeleteBuffers(1, &object); break;
+        case VERTEX_ARRAY: glad_glDeleteVertexArrays(1, &object); break;
+        case FRAMEBUFFER: glad_glDeleteFramebuffers(1, &object); break;
+        case QUERY: glad_glDeleteQueries(1, &object); break;
+        case PROGRAM: glad_glDeleteProgram(object); break;
+        case SHADER: glad_glDeleteShader(object); break;
+        }
+    }
+
+    static uint64_t programKey(GLuint program, GLuint value)
+    {
+        return (uint64_t)program << 32 | value;
+    }
+
+    // maps one argument of a generic function by its character in GL_CAPTURE_FUNCTIONS, false when it is a fence
+    // the replay does not have (one a later loop already deleted), the call is then skipped
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value, bool>::type map(char kind, T& value)
+    {
+        static const char kinds[] = "TBVFQPS";
+        const char* found = kind != '-' ? strchr(kinds, kind) : nullptr;
+        if (found && *found)
+        {
+            if (kind == 'P')
+                argumentProgram = (GLuint)value;
+            else if (kind == 'S')
+                argumentShader = (GLuint)value;
+            value = (T)name((int)(found - kinds), (GLuint)value);
+        }
+        else if (kind == 'L')
+        {
+            auto location = locations.find(programKey(program, (GLuint)value));
+            if (location != locations.end())
+                value = (T)location->second;
+        }
+        else if (kind == 'K')
+        {
+            auto index = blockIndices.find(programKey(argumentProgram, (GLuint)value));
+            if (index != blockIndices.end())
+                value = (T)index->second;
+        }
+        return true;
+    }
+
+    bool map(char kind, GLsync& sync)
+    {
+        if (kind != 'Y')
+            return true;
+        argumentSync = (uint64_t)(uintptr_t)sync;
+        auto found = syncs.find(argumentSync);
+        if (found == syncs.end())
+            return false;
+        sync = found->second;
+        return true;
+    }
+
+    template <typename T>
+    typename std::enable_if<!std::is_integral<T>::value, bool>::type map(char, T&)
+    {
+        return true;
+    }
+
+    template <typename R, typename... Args, size_t... I>
+    void callGeneric(int call, bool run, R (APIENTRYP function)(Args...), std::tuple<Args...>& args, std::index_sequence<I...>)
+    {
+        const char* kinds = GlCapture::argumentKinds(call);
+        bool mappedAll = true;
+        int order[] = { 0, (mappedAll = map(kinds[I], std::get<I>(args)) && mappedAll, 0)... };
+        (void)order;
+        if (run && mappedAll)
+            timed(call, [&]() { function(std::get<I>(args)...); });
+    }
+
+    // reads the arguments as the capture wrote them (in order, braced) and calls the real function with the mapped ones
+    template <typename R, typename... Args>
+    void replayGeneric(int call, bool run, R (APIENTRYP function)(Args...))
+    {
+        std::tuple<Args...> args { read<Args>()... };
+        callGeneric(call, run, function, args, std::index_sequence_for<Args...>());
+    }
+
+    void genNames(int call, bool run, int kind, void (APIENTRYP gen)(GLsizei, GLuint*))
+    {
+        GLsizei n = read<GLsizei>();
+        std::vector<GLuint> recorded(n), objects(n);
+        for (GLuint& name : recorded)
+            name = read<GLuint>();
+        if (!run || n <= 0)
+            return;
+        timed(call, [&]() { gen(n, &objects[0]); });
+        for (GLsizei i = 0; i < n; i++)
+            created(kind, recorded[i], objects[i]);
+    }
+
+    void deleteNames(int call, int kind, void (APIENTRYP remove)(GLsizei, const GLuint*))
+    {
+        GLsizei n = read<GLsizei>();
+        std::vector<GLuint> objects;
+        for (GLsizei i = 0; i < n; i++)
+        {
+            GLuint recorded = read<GLuint>();
+            auto found = names[kind].find(recorded);
+            if (found == names[kind].end())
+                continue;
+            objects.push_back(found->second);
+            names[kind].erase(found);
+        }
+        if (!objects.empty())
+            timed(call, [&]() { remove((GLsizei)objects.size(), &objects[0]); });
+    }
+
+    void uniforms(int call, bool run, void (APIENTRYP uniform)(GLint, GLsizei, const GLfloat*))
+    {
+        GLint location = read<GLint>();
+        GLsizei count = read<GLsizei>();
+        const GLfloat* values = (const GLfloat*)readData();
+        map('L', location);
+        if (run)
+            timed(call, [&]() { uniform(location, count, values); });
+    }
+
+    void uniformMatrices(int call, bool run, void (APIENTRYP uniform)(GLint, GLsizei, GLboolean, const GLfloat*))
+    {
+        GLint location = read<GLint>();
+        GLsizei count = read<GLsizei>();
+        const GLfloat* values = (const GLfloat*)readData();
+        GLboolean transpose = read<GLboolean>();
+        map('L', location);
+        if (run)
+            timed(call, [&]() { uniform(location, count, transpose, values); });
+    }
+
+    // one call and its arguments, false when the file ends in the middle of it or has a call this replay does not know
+    bool execute(int call, bool run)
+    {
+        switch (call)
+        {
+#define GL_REPLAY_GENERIC(name, ...) \
+        case GlCapture::CALL_##name: \
+            replayGeneric(call, run, glad_##name); \
+            break;
+        GL_CAPTURE_FUNCTIONS(GL_REPLAY_GENERIC)
+#undef GL_REPLAY_GENERIC
+
+        case GlCapture::CALL_glBufferData:
+        {
+            GLenum target = read<GLenum>();
+            GLsizeiptr size = read<GLsizeiptr>();
+            const void* bytes = readData();
+            GLenum usage = read<GLenum>();
+            if (run)
+                timed(call, [&]() { glad_glBufferData(target, size, bytes, usage); });
+            break;
+        }
+        case GlCapture::CALL_glBufferSubData:
+        {
+            GLenum target = read<GLenum>();
+            GLintptr offset = read<GLintptr>();
+            GLsizeiptr size = read<GLsizeiptr>();
+            const void* bytes = readData();
+            if (run)
+                timed(call, [&]() { glad_glBufferSubData(target, offset, size, bytes); });
+            break;
+        }
+        case GlCapture::CALL_glCreateProgram:
+        {
+            GLuint recorded = read<GLuint>();
+            GLuint object = 0;
+            timed(call, [&]() { object = glad_glCreateProgram(); });
+            created(PROGRAM, recorded, object);
+            break;
+        }
+        case GlCapture::CALL_glCreateShader:
+        {
+            GLenum type = read<GLenum>();
+            GLuint recorded = read<GLuint>();
+            GLuint object = 0;
+            timed(call, [&]() { object = glad_glCreateShader(type); });
+            created(SHADER, recorded, object);
+            break;
+        }
+        case GlCapture::CALL_glGenBuffers: genNames(call, true, BUFFER, glad_glGenBuffers); break;
+        case GlCapture::CALL_glGenFramebuffers: genNames(call, true, FRAMEBUFFER, glad_glGenFramebuffers); break;
+        case GlCapture::CALL_glGenQueries: genNames(call, true, QUERY, glad_glGenQueries); break;
+        case GlCapture::CALL_glGenTextures: genNames(call, true, TEXTURE, glad_glGenTextures); break;
+        case GlCapture::CALL_glGenVertexArrays: genNames(call, true, VERTEX_ARRAY, glad_glGenVertexArrays); break;
+        case GlCapture::CALL_glDeleteBuffers: deleteNames(call, BUFFER, glad_glDeleteBuffers); break;
+        case GlCapture::CALL_glDeleteFramebuffers: deleteNames(call, FRAMEBUFFER, glad_glDeleteFramebuffers); break;
+        case GlCapture::CALL_glDeleteQueries: deleteNames(call, QUERY, glad_glDeleteQueries); break;
+        case GlCapture::CALL_glDeleteTextures: deleteNames(call, TEXTURE, glad_glDeleteTextures); break;
+        case GlCapture::CALL_glDeleteVertexArrays: deleteNames(call, VERTEX_ARRAY, glad_glDeleteVertexArrays); break;
+        case GlCapture::CALL_glDrawBuffers:
+        {
+            GLsizei n = read<GLsizei>();
+            std::vector<GLenum> buffers(n);
+            for (GLenum& buffer : buffers)
+                buffer = read<GLenum>();
+            if (run && n > 0)
+                timed(call, [&]() { glad_glDrawBuffers(n, &buffers[0]); });
+            break;
+        }
+        case GlCapture::CALL_glFenceSync:
+        {
+            GLenum condition = read<GLenum>();
+            GLbitfield flags = read<GLbitfield>();
+            uint64_t recorded = read<uint64_t>();
+            GLsync sync = 0;
+            timed(call, [&]() { sync = glad_glFenceSync(condition, flags); });
+            auto found = syncs.find(recorded);
+            if (found != syncs.end())
+                glad_glDeleteSync(found->second);
+            syncs[recorded] = sync;
+            break;
+        }
+        case GlCapture::CALL_glGetUniformBlockIndex:
+        case GlCapture::CALL_glGetUniformLocation:
+        {
+            GLuint recordedProgram = read<GLuint>();
+            std::string uniform = readString();
+            GLuint recorded = read<GLuint>();
+            GLuint object = name(PROGRAM, recordedProgram);
+            if (call == GlCapture::CALL_glGetUniformBlockIndex)
+                timed(call, [&]() { blockIndices[programKey(recordedProgram, recorded)] = glad_glGetUniformBlockIndex(object, uniform.c_str()); });
+            else
+                timed(call, [&]() { locations[programKey(recordedProgram, recorded)] = glad_glGetUniformLocation(object, uniform.c_str()); });
+            break;
+        }
+        case GlCapture::CALL_glMapBufferRange:
+        {
+            GLenum target = read<GLenum>();
+            GLintptr offset = read<GLintptr>();
+            GLsizeiptr length = read<GLsizeiptr>();
+            GLbitfield access = read<GLbitfield>();
+            timed(call, [&]() { mapped[target] = glad_glMapBufferRange(target, offset, length, access); });
+            break;
+        }
+        case GlCapture::CALL_glUnmapBuffer:
+        {
+            GLenum target = read<GLenum>();
+            uint64_t size;
+            const void* bytes = readData(&size);
+            void* destination = mapped[target];
+            timed(call, [&]() {
+                if (destination && bytes)
+                    memcpy(destination, bytes, (size_t)size);
+                glad_glUnmapBuffer(target);
+            });
+            mapped.erase(target);
+            break;
+        }
+        case GlCapture::CALL_glPixelStorei:
+        {
+            GLenum parameter = read<GLenum>();
+            GLint value = read<GLint>();
+            if (run)
+                timed(call, [&]() { glad_glPixelStorei(parameter, value); });
+            break;
+        }
+        case GlCapture::CALL_glShaderSource:
+        {
+            GLuint shader = name(SHADER, read<GLuint>());
+            std::string source = readString();
+            const GLchar* text = source.c_str();
+            GLint length = (GLint)source.size();
+            if (run)
+                timed(call, [&]() { glad_glShaderSource(shader, 1, &text, &length); });
+            break;
+        }
+        case GlCapture::CALL_glTexImage2D:
+        {
+            GLenum target = read<GLenum>();
+            GLint level = read<GLint>(), internalFormat = read<GLint>();
+            GLsizei textureWidth = read<GLsizei>(), textureHeight = read<GLsizei>();
+            GLint border = read<GLint>();
+            GLenum format = read<GLenum>(), type = read<GLenum>();
+            const void* pixels = readData();
+            if (run)
+                timed(call, [&]() { glad_glTexImage2D(target, level, internalFormat, textureWidth, textureHeight, border, format, type, pixels); });
+            break;
+        }
+        case GlCapture::CALL_glTexImage3D:
+        {
+            GLenum target = read<GLenum>();
+            GLint level = read<GLint>(), internalFormat = read<GLint>();
+            GLsizei textureWidth = read<GLsizei>(), textureHeight = read<GLsizei>(), depth = read<GLsizei>();
+            GLint border = read<GLint>();
+            GLenum format = read<GLenum>(), type = read<GLenum>();
+            const void* pixels = readData();
+            if (run)
+                timed(call, [&]() {
+                    glad_glTexImage3D(target, level, internalFormat, textureWidth, textureHeight, depth, border, format, type, pixels);
+                });
+            break;
+        }
+        case GlCapture::CALL_glTexParameterfv:
+        {
+            GLenum target = read<GLenum>();
+            GLenum parameter = read<GLenum>();
+            const GLfloat* values = (const GLfloat*)readData();
+            if (run && values)
+                timed(call, [&]() { glad_glTexParameterfv(target, parameter, values); });
+            break;
+        }
+        case GlCapture::CALL_glUniform1fv: uniforms(call, run, glad_glUniform1fv); break;
+        case GlCapture::CALL_glUniform2fv: uniforms(call, run, glad_glUniform2fv); break;
+        case GlCapture::CALL_glUniform3fv: uniforms(call, run, glad_glUniform3fv); break;
+        case GlCapture::CALL_glUniform4fv: uniforms(call, run, glad_glUniform4fv); break;
+        case GlCapture::CALL_glUniformMatrix2fv: uniformMatrices(call, run, glad_glUniformMatrix2fv); break;
+        case GlCapture::CALL_glUniformMatrix3fv: uniformMatrices(call, run, glad_glUniformMatrix3fv); break;
+        case GlCapture::CALL_glUniformMatrix4fv: uniformMatrices(call, run, glad_glUniformMatrix4fv); break;
+
+        case GlCapture::CALL_FRAME:
+            break;
+        case GlCapture::CALL_PASS_BEGIN:
+            readString();
+            break;
+        case GlCapture::CALL_PASS_END:
+            break;
+        default:
+            std::cout << "Replay: unknown call " << call << ", the capture is from another version" << std::endl;
+            return false;
+        }
+
+        // what the generic calls leave behind for the next ones
+        if (call == GlCapture::CALL_glUseProgram)
+            program = argumentProgram;
+        else if (call == GlCapture::CALL_glDeleteProgram)
+            names[PROGRAM].erase(argumentProgram);
+        else if (call == GlCapture::CALL_glDeleteShader)
+            names[SHADER].erase(argumentShader);
+        else if (call == GlCapture::CALL_glDeleteSync)
+            syncs.erase(argumentSync);
+        if (truncated)
+            std::cout << "Replay: the capture ends in the middle of " << GlCapture::callName(call) << std::endl;
+        return !truncated;
+    }
+
+    int timestamp()
+    {
+        if (usedQueries == (int)queryPool.size())
+        {
+            GLuint query;
+            glad_glGenQueries(1, &query);
+            queryPool.push_back(query);
+        }
+        glad_glQueryCounter(queryPool[usedQueries], GL_TIMESTAMP);
+        return usedQueries++;
+    }
+
+    void beginTimestamp(std::vector<int>& queries)
+    {
+        usedQueries = 0;
+        passQueries.clear();
+        if (measuring)
+            queries.push_back(timestamp());
+    }
+
+    void endFrame()
+    {
+        if (!measuring)
+            return;
+        frameQueries.push_back(timestamp());
+        frameCpuNs += callNs - frameCpuStart;
+        frameCpuStart = callNs;
+        measuredFrames++;
+    }
+
+    void pass(int call)
+    {
+        if (call == GlCapture::CALL_PASS_BEGIN)
+        {
+            std::string passName = readString();
+            if (!measuring)
+                return;
+            int index = 0;
+            while (index < (int)passes.size() && (passes[index].name != passName || passes[index].depth != (int)open.size()))
+                index++;
+            if (index == (int)passes.size())
+                passes.push_back({ passName, (int)open.size() });
+            open.push_back({ index, callNs, callIndex, timestamp() });
+            return;
+        }
+        if (!measuring || open.empty())
+            return;
+        OpenPass ended = open.back();
+        open.pop_back();
+        passes[ended.pass].cpuNs += callNs - ended.cpuStart;
+        passes[ended.pass].calls += callIndex - ended.callStart;
+        passQueries.push_back({ ended.pass, { ended.query, timestamp() } });
+    }
+
+    // waits for the loop to finish on the GPU
+    void readTimestamps()
+    {
+        std::vector<GLuint64> times(usedQueries);
+        for (int i = 0; i < usedQueries; i++)
+            glad_glGetQueryObjectui64v(queryPool[i], GL_QUERY_RESULT, &times[i]);
+        for (size_t i = 1; i < frameQueries.size(); i++)
+            frameGpuNs += (double)(times[frameQueries[i]] - times[frameQueries[i - 1]]);
+        for (const auto& query : passQueries)
+            passes[query.first].gpuNs += (double)(times[query.second.second] - times[query.second.first]);
+    }
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " FILE [--loops N] [--top N] [--list] [--disable FIRST-LAST]..." << std::endl;
+        return 1;
+    }
+    Replay replay;
+    int loops = 10, top = 20;
+    for (int i = 2; i < argc; i++)
+    {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        std::pair<int, int> range;
+        if (!strcmp(argv[i], "--loops") && value && (loops = atoi(value)) > 0)
+            i++;
+        else if (!strcmp(argv[i], "--top") && value && (top = atoi(value)) > 0)
+            i++;
+        else if (!strcmp(argv[i], "--list"))
+            replay.list = true;
+        else if (!strcmp(argv[i], "--disable") && value && sscanf(value, "%d-%d", &range.first, &range.second) == 2)
+        {
+            replay.disabled.push_back(range);
+            i++;
+        }
+        else
+        {
+            std::cout << "Unknown or invalid argument " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+    if (!replay.load(argv[1]))
+        return 1;
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(replay.width, replay.height, "Rainy day replay", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return 1;
+    }
+    std::cout << "Replay on " << glGetString(GL_RENDERER) << ", " << replay.width << "x" << replay.height << std::endl;
+
+    int exitCode = 1;
+    if (replay.setup())
+    {
+        // the first loop runs everything once more before it is measured, shaders and textures are then resident
+        replay.loop(window, false);
+        for (int i = 0; i < loops; i++)
+            replay.loop(window, true);
+        replay.report(top);
+        exitCode = 0;
+    }
+    glfwTerminate();
+    return exitCode;
+}
@@ -6,18 +6,31 @@
 #include <glm/glm.hpp>
 
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
+#include <trace.h>
+#include <program_cache.h>
+#include <shader_compiler.h>
+
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    float compileMs = 0.0f;     // once ready, 0 when the program came from the cache
+    bool cached = false;
+    // constructor generates the shader on the fly. defines are #define lines inserted after the #version line
+    // of every stage, for compile time variants (shader_variants.h). An #include "file" line is replaced by that
+    // file, next to the stage, for what several shaders share
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string& defines = "")
+        : sourcePaths({ vertexPath, fragmentPath, geometryPath ? geometryPath : "" }), defines(defines)
     {
+        TRACE_SCOPE("Compile shader");
+        instances().push_back(this);
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -58,45 +71,148 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
+        include(vertexCode, vertexPath);
+        include(fragmentCode, fragmentPath);
+        if (geometryPath != nullptr)
+            include(geometryCode, geometryPath);
+        if (!defines.empty())
+            for (std::string* code : { &vertexCode, &fragmentCode, &geometryCode })
+            {
+                size_t lineEnd = code->find('\n');
+                if (lineEnd != std::string::npos)
+                    code->insert(lineEnd + 1, defines);
+            }
+        // a program linked before from the same sources by the same driver comes from the cache (program_cache.h)
+        uint64_t cacheKey = ProgramCache::key({ { GL_VERTEX_SHADER, &vertexCode }, { GL_FRAGMENT_SHADER, &fragmentCode },
+                                                { GL_GEOMETRY_SHADER, &geometryCode } });
+        // 2. compile shaders, possibly in the background (shader_compiler.h)
+        std::vector<std::pair<GLenum, std::string>> stages = { { GL_VERTEX_SHADER, vertexCode }, { GL_FRAGMENT_SHADER, fragmentCode } };
         // if geometry shader is given, compile geometry shader
-        unsigned int geometry;
         if (geometryPath != nullptr)
+            stages.push_back({ GL_GEOMETRY_SHADER, geometryCode });
+        issue(cacheKey, stages);
+    }
+    // constructor for a compute program, needs a GL 4.3 context
+    // ------------------------------------------------------------------------
+    explicit Shader(const char* computePath) : sourcePaths({ computePath })
+    {
+        TRACE_SCOPE("Compile shader");
+        instances().push_back(this);
+        std::string computeCode;
+        std::ifstream cShaderFile;
+        cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        try
         {
-            const char * gShaderCode = geometryCode.c_str();
-            geometry = glCreateShader(GL_GEOMETRY_SHADER);
-            glShaderSource(geometry, 1, &gShaderCode, NULL);
-            glCompileShader(geometry);
-            checkCompileErrors(geometry, "GEOMETRY");
+            cShaderFile.open(computePath);
+            std::stringstream cShaderStream;
+            cShaderStream << cShaderFile.rdbuf();
+            cShaderFile.close();
+            computeCode = cShaderStream.str();
         }
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        if (geometryPath != nullptr)
-            glAttachShader(ID, geometry);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        if (geometryPath != nullptr)
-            glDeleteShader(geometry);
-
+        catch (std::ifstream::failure e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+        }
+        include(computeCode, computePath);
+        uint64_t cacheKey = ProgramCache::key({ { GL_COMPUTE_SHADER, &computeCode } });
+        issue(cacheKey, { { GL_COMPUTE_SHADER, computeCode } });
+    }
+    // waits for a program still compiling, the program itself stays like with the learnopengl version. A reload
+    // owns its program until applyReload() takes it, one dropped before is outdated and neither cached nor kept
+    ~Shader()
+    {
+        if (job)
+        {
+            ShaderCompiler::wait(*job);
+            finish(reloadOf != nullptr);
+        }
+        if (reloadOf)
+            glDeleteProgram(ID);
+        delete next;
+        instances().erase(std::find(instances().begin(), instances().end(), this));
+    }
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+    // whether the program is linked and can be used, without waiting for it. Passes skip their draws until it is
+    // ------------------------------------------------------------------------
+    bool ready()
+    {
+        if (job && ShaderCompiler::done(*job))
+            finish();
+        return !job;
+    }
+    // waits until the program is linked
+    void wait()
+    {
+        if (job)
+        {
+            ShaderCompiler::wait(*job);
+            finish();
+        }
+    }
+    // how many programs are still compiling, polling all of them. Returns 0 once everything is ready
+    static int pollPending()
+    {
+        std::vector<Shader*> compiling = pending();
+        for (Shader* shader : compiling)
+            shader->ready();
+        return (int)pending().size();
+    }
+    static void waitAll()
+    {
+        while (!pending().empty())
+            pending().front()->wait();
+    }
+    // every shader there is, for the hot reload (hot_reload.h)
+    static const std::vector<Shader*>& all()
+    {
+        return instances();
+    }
+    // whether one of the stages, or a file they include, is read from path
+    bool uses(const std::string& path) const
+    {
+        return !reloadOf && (std::find(sourcePaths.begin(), sourcePaths.end(), path) != sourcePaths.end() ||
+                             std::find(includedPaths.begin(), includedPaths.end(), path) != includedPaths.end());
+    }
+    // compiles the program again from its files, in the background like at startup. The old program stays in use
+    // until the new one is linked, and for good when it does not compile, see applyReload()
+    void reload()
+    {
+        delete next;    // a reload still compiling is outdated by now
+        next = sourcePaths.size() == 1 ? new Shader(sourcePaths[0].c_str())
+                                       : new Shader(sourcePaths[0].c_str(), sourcePaths[1].c_str(),
+                                                    sourcePaths[2].empty() ? nullptr : sourcePaths[2].c_str(), defines);
+        next->reloadOf = this;
     }
+    bool reloading() const
+    {
+        return next != nullptr;
+    }
+    // once the reloaded program is linked it takes over the ID, uniform block bindings included. Uniforms that are
+    // not set every frame start over at their defaults. Returns false while it is still compiling
+    bool applyReload()
+    {
+        if (!next)
+            return true;
+        if (!next->ready())
+            return false;
+        GLint linked = GL_FALSE;
+        glGetProgramiv(next->ID, GL_LINK_STATUS, &linked);
+        reloadFailed = !linked;
+        if (linked)
+        {
+            glDeleteProgram(ID);
+            ID = next->ID;
+            next->ID = 0;
+            compileMs = next->compileMs;
+            cached = next->cached;
+            applyBlockBindings();
+        }
+        delete next;    // with the program when it did not link
+        next = nullptr;
+        return true;
+    }
+    bool reloadFailed = false;  // the last reload did not link, the program is still the one from before
     // activate the shader
     // ------------------------------------------------------------------------
     void use()
@@ -161,8 +277,119 @@ public:
     {
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
+    // ------------------------------------------------------------------------
+    // connects a uniform block to a binding point, if the program uses the block. Applied once the program is
+    // linked, and again to reloaded programs
+    void bindUniformBlock(const std::string &name, unsigned int binding)
+    {
+        blockBindings.push_back({ name, binding });
+        if (!job)
+            applyBlockBindings();
+    }
 
 private:
+    ShaderCompiler::Job* job = nullptr;     // while the program is compiling
+    uint64_t cacheKey = 0;
+    std::vector<std::pair<std::string, unsigned int>> blockBindings;
+    std::vector<std::string> sourcePaths;   // vertex, fragment and geometry (empty for none), or compute
+    std::vector<std::string> includedPaths;
+    std::string defines;
+    Shader* next = nullptr;                 // the reloaded program while it is compiling
+    Shader* reloadOf = nullptr;             // set on next
+
+    static std::vector<Shader*>& pending()
+    {
+        static std::vector<Shader*> compiling;
+        return compiling;
+    }
+
+    static std::vector<Shader*>& instances()
+    {
+        static std::vector<Shader*> shaders;
+        return shaders;
+    }
+
+    // replaces the #include "file" lines of code with the file, looked up next to path. A #line after it keeps
+    // the line numbers of the compile errors those of path
+    void include(std::string& code, const std::string& path)
+    {
+        if (code.find("#include") == std::string::npos)
+            return;
+        std::istringstream lines(code);
+        std::string result, line;
+        for (int number = 1; std::getline(lines, line); number++)
+        {
+            if (line.compare(0, 10, "#include \"") != 0)
+            {
+                result += line + '\n';
+                continue;
+            }
+            std::string file = path.substr(0, path.find_last_of('/') + 1) + line.substr(10, line.find('"', 10) - 10);
+            std::ifstream included(file);
+            if (!included.is_open())
+                std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << file << std::endl;
+            std::stringstream includedCode;
+            includedCode << included.rdbuf();
+            result += includedCode.str() + "\n#line " + std::to_string(number + 1) + '\n';
+            if (std::find(includedPaths.begin(), includedPaths.end(), file) == includedPaths.end())
+                includedPaths.push_back(file);
+        }
+        code = result;
+    }
+
+    void applyBlockBindings()
+    {
+        for (const auto& block : blockBindings)
+        {
+            unsigned int index = glGetUniformBlockIndex(ID, block.first.c_str());
+            if (index != GL_INVALID_INDEX)
+                glUniformBlockBinding(ID, index, block.second);
+        }
+    }
+
+    void issue(uint64_t key, const std::vector<std::pair<GLenum, std::string>>& stages)
+    {
+        ID = glCreateProgram();
+        if ((cached = ProgramCache::load(key, ID)))
+            return;
+        cacheKey = key;
+        job = new ShaderCompiler::Job();
+        job->program = ID;
+        job->retrievable = ProgramCache::storing();
+        job->stages = stages;
+        pending().push_back(this);
+        ShaderCompiler::compile(*job);
+        if (ShaderCompiler::mode() == ShaderCompiler::SYNCHRONOUS)
+            finish();
+    }
+
+    // checks the results of a compile that is done, and stores the program in the cache. An outdated program is
+    // only cleaned up, it is about to be deleted
+    void finish(bool outdated = false)
+    {
+        static const std::pair<GLenum, const char*> stageNames[] = {
+            { GL_VERTEX_SHADER, "VERTEX" }, { GL_FRAGMENT_SHADER, "FRAGMENT" }, { GL_GEOMETRY_SHADER, "GEOMETRY" }, { GL_COMPUTE_SHADER, "COMPUTE" }
+        };
+        if (!outdated)
+        {
+            for (size_t i = 0; i < job->shaders.size(); i++)
+                for (const auto& stageName : stageNames)
+                    if (stageName.first == job->stages[i].first)
+                        checkCompileErrors(job->shaders[i], stageName.second);
+            checkCompileErrors(ID, "PROGRAM");
+            compileMs = job->compileMs;
+            ProgramCache::store(cacheKey, ID, compileMs);
+        }
+        // delete the shaders as they're linked into our program now and no longer necessery
+        for (GLuint shader : job->shaders)
+            glDeleteShader(shader);
+        delete job;
+        job = nullptr;
+        pending().erase(std::find(pending().begin(), pending().end(), this));
+        if (!outdated)
+            applyBlockBindings();
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
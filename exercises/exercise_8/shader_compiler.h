@@ -0,0 +1,232 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+#include <trace.h>
+
+// KHR_parallel_shader_compile is not in the generated glad, it only adds these two enums and one function
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Compiles and links the programs of Shader without waiting for them, so every shader is issued up front and the
+// first frames are drawn while the driver is still busy. With KHR_parallel_shader_compile (or the ARB version) the
+// driver compiles on its own threads and GL_COMPLETION_STATUS_KHR tells without blocking when a program is done.
+// Without it one worker thread compiles on a hidden context shared with the window. It calls the glad_gl* pointers
+// directly, as the glad debug callbacks, GlStats and GlCapture are only ever used from the render thread.
+//
+// A program is usable once done() returned true for its job, passes using one that is not are skipped.
+// Captures (gl_capture.h) always compile synchronously, so the calls are recorded in order.
+class ShaderCompiler
+{
+public:
+    enum Mode { SYNCHRONOUS, PARALLEL_EXTENSION, WORKER_THREAD, AUTOMATIC };
+
+    // the stages of one program, compiled and attached in this order
+    struct Job
+    {
+        GLuint program = 0;
+        bool retrievable = false;   // sets GL_PROGRAM_BINARY_RETRIEVABLE_HINT for the program cache
+        std::vector<std::pair<GLenum, std::string>> stages;
+        std::vector<GLuint> shaders;
+        float compileMs = 0.0f;     // on the worker thread, or the calls on the render thread (the extension's own
+                                    // threads cannot be timed, only polled once a frame)
+        std::atomic<bool> linked{ false };  // the worker thread is done with it
+    };
+
+    // picks how programs are compiled from now on, for the context current on this thread. AUTOMATIC takes the
+    // extension, then the worker thread
+    static void start(GLFWwindow* window, Mode requested)
+    {
+        State& state = get();
+        state.mode = SYNCHRONOUS;
+        if (requested == SYNCHRONOUS)
+            return;
+
+        bool extension = glfwExtensionSupported("GL_KHR_parallel_shader_compile") || glfwExtensionSupported("GL_ARB_parallel_shader_compile");
+        if (extension && (requested == AUTOMATIC || requested == PARALLEL_EXTENSION))
+        {
+            typedef void (APIENTRYP MaxShaderCompilerThreads)(GLuint count);
+            MaxShaderCompilerThreads maxThreads = (MaxShaderCompilerThreads)glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+            if (!maxThreads)
+                maxThreads = (MaxShaderCompilerThreads)glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+            if (maxThreads)
+                maxThreads(0xFFFFFFFFu);    // as many as the driver likes
+            state.mode = PARALLEL_EXTENSION;
+            return;
+        }
+
+        // a hidden window, only for its context
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        state.workerWindow = glfwCreateWindow(1, 1, "Shader compiler", nullptr, window);
+        if (!state.workerWindow)
+        {
+            std::cout << "Shader compiler: no shared context for the worker thread, compiling synchronously" << std::endl;
+            return;
+        }
+        state.stopping = false;
+        state.worker = std::thread(workerLoop);
+        state.mode = WORKER_THREAD;
+    }
+
+    // waits for the worker thread to finish what it was given
+    static void stop()
+    {
+        State& state = get();
+        if (state.worker.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.stopping = true;
+            }
+            state.wake.notify_all();
+            state.worker.join();
+        }
+        if (state.workerWindow)
+            glfwDestroyWindow(state.workerWindow);
+        state.workerWindow = nullptr;
+        state.mode = SYNCHRONOUS;
+    }
+
+    static Mode mode()
+    {
+        return get().mode;
+    }
+
+    static const char* modeName(Mode mode)
+    {
+        static const char* names[] = { "synchronous", "parallel extension", "worker thread", "automatic" };
+        return names[mode];
+    }
+
+    // starts compiling and linking job.program, synchronously it is done on return
+    static void compile(Job& job)
+    {
+        if (get().mode == WORKER_THREAD)
+        {
+            State& state = get();
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                state.queue.push_back(&job);
+            }
+            state.wake.notify_one();
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        if (job.retrievable)
+            glProgramParameteri(job.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        for (const auto& stage : job.stages)
+        {
+            GLuint shader = glCreateShader(stage.first);
+            const char* source = stage.second.c_str();
+            glShaderSource(shader, 1, &source, NULL);
+            glCompileShader(shader);
+            glAttachShader(job.program, shader);
+            job.shaders.push_back(shader);
+        }
+        glLinkProgram(job.program);
+        job.compileMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        job.linked = true;
+    }
+
+    // true once the program is linked (or failed to), without waiting for it
+    static bool done(Job& job)
+    {
+        if (!job.linked)
+            return false;
+        if (get().mode != PARALLEL_EXTENSION)
+            return true;
+        GLint complete = GL_FALSE;
+        glGetProgramiv(job.program, GL_COMPLETION_STATUS_KHR, &complete);
+        return complete == GL_TRUE;
+    }
+
+    static void wait(Job& job)
+    {
+        TRACE_SCOPE("Wait for shader");
+        State& state = get();
+        if (state.mode == WORKER_THREAD)
+        {
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.finished.wait(lock, [&job]() { return job.linked.load(); });
+        }
+        // the extension blocks on the link status query, which the caller makes next anyway
+    }
+
+private:
+    struct State
+    {
+        Mode mode = SYNCHRONOUS;
+        GLFWwindow* workerWindow = nullptr;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake, finished;
+        std::deque<Job*> queue;
+        bool stopping = false;
+    };
+
+    static State& get()
+    {
+        static State state;
+        return state;
+    }
+
+    static void workerLoop()
+    {
+        TRACE_THREAD_NAME("Shader compiler");
+        State& state = get();
+        glfwMakeContextCurrent(state.workerWindow);
+        for (;;)
+        {
+            Job* job;
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.wake.wait(lock, [&state]() { return state.stopping || !state.queue.empty(); });
+                if (state.queue.empty())
+                    break;
+                job = state.queue.front();
+                state.queue.pop_front();
+            }
+
+            TRACE_SCOPE("Compile shader");
+            auto start = std::chrono::steady_clock::now();
+            if (job->retrievable)
+                glad_glProgramParameteri(job->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+            for (const auto& stage : job->stages)
+            {
+                GLuint shader = glad_glCreateShader(stage.first);
+                const char* source = stage.second.c_str();
+                glad_glShaderSource(shader, 1, &source, NULL);
+                glad_glCompileShader(shader);
+                glad_glAttachShader(job->program, shader);
+                job->shaders.push_back(shader);
+            }
+            glad_glLinkProgram(job->program);
+            // the render thread's context sees the result once it is complete here
+            glad_glFinish();
+            job->compileMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                job->linked = true;
+            }
+            state.finished.notify_all();
+        }
+        glfwMakeContextCurrent(nullptr);
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <shader.h>
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// Compile time permutations of one vertex and fragment shader. A variant key has one bit per feature, the
+// features of a variant become #define lines, so every variant only does the work its draws need instead of
+// branching on uniforms. Variants are compiled when they are first asked for, asking for the ones known up front at
+// startup compiles them in the background with the other shaders (shader_compiler.h).
+class ShaderVariants
+{
+public:
+    // featureNames[i] is the #define of bit i
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, const std::vector<const char*>& featureNames)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), featureNames(featureNames)
+    {
+    }
+
+    ~ShaderVariants()
+    {
+        for (auto& variant : variants)
+            delete variant.second;
+    }
+
+    // the variant with the features of key, compiling it if it was not asked for before
+    Shader* get(uint32_t key)
+    {
+        auto found = variants.find(key);
+        if (found != variants.end())
+            return found->second;
+
+        std::string defines;
+        for (size_t i = 0; i < featureNames.size(); i++)
+            if (key & (1u << i))
+                defines += std::string("#define ") + featureNames[i] + "\n";
+        Shader* variant = new Shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr, defines);
+        for (const auto& block : blockBindings)
+            variant->bindUniformBlock(block.first, block.second);
+        variants[key] = variant;
+        return variant;
+    }
+
+    bool contains(const Shader* shader) const
+    {
+        for (const auto& variant : variants)
+            if (variant.second == shader)
+                return true;
+        return false;
+    }
+
+    // for every variant, also the ones compiled later
+    void bindUniformBlock(const std::string& name, unsigned int binding)
+    {
+        blockBindings.push_back({ name, binding });
+        for (auto& variant : variants)
+            variant.second->bindUniformBlock(name, binding);
+    }
+
+    // calls visit(key, variant) for every variant, in key order
+    template <typename Visit>
+    void forEach(Visit visit) const
+    {
+        for (const auto& variant : variants)
+            visit(variant.first, *variant.second);
+    }
+
+    // the defines of key joined with |, "base" without any
+    std::string keyName(uint32_t key) const
+    {
+        std::string name;
+        for (size_t i = 0; i < featureNames.size(); i++)
+            if (key & (1u << i))
+                name += (name.empty() ? "" : "|") + std::string(featureNames[i]);
+        return name.empty() ? "base" : name;
+    }
+
+    struct Stats
+    {
+        int variants = 0;
+        int ready = 0;
+        int cached = 0;         // of the ready ones
+        float compileMs = 0.0f;
+    };
+
+    Stats stats() const
+    {
+        Stats counts;
+        for (const auto& variant : variants)
+        {
+            counts.variants++;
+            if (!variant.second->ready())
+                continue;
+            counts.ready++;
+            counts.cached += variant.second->cached;
+            counts.compileMs += variant.second->compileMs;
+        }
+        return counts;
+    }
+
+    void printStats(const char* name) const
+    {
+        Stats counts = stats();
+        printf("%s: %d variants, %d ready, %d from the program cache, %.1f ms compiling\n", name, counts.variants, counts.ready,
+               counts.cached, counts.compileMs);
+        for (const auto& variant : variants)
+        {
+            if (!variant.second->ready())
+                continue;
+            if (variant.second->cached)
+                printf("  %-72s cached\n", keyName(variant.first).c_str());
+            else
+                printf("  %-72s %.1f ms\n", keyName(variant.first).c_str(), variant.second->compileMs);
+        }
+        fflush(stdout);
+    }
+
+private:
+    std::string vertexPath, fragmentPath;
+    std::vector<const char*> featureNames;
+    std::map<uint32_t, Shader*> variants;
+    std::vector<std::pair<std::string, unsigned int>> blockBindings;
+};
+
+// The features of pbr_shading.frag, see the top of the shader. The material ones come from the mesh and the
+// model (Mesh::variantFeatures), the rest from the lighting pass. Plain constants, so they mix with 0 and each other
+constexpr uint32_t PBR_NORMAL_MAP = 1u << 0;
+constexpr uint32_t PBR_AMBIENT_OCCLUSION_MAP = 1u << 1;
+constexpr uint32_t PBR_WETNESS = 1u << 2;
+constexpr uint32_t PBR_METALNESS = 1u << 3;
+constexpr uint32_t PBR_POINT_LIGHT = 1u << 4;
+constexpr uint32_t PBR_SHADOW = 1u << 5;
+constexpr uint32_t PBR_INDIRECT_LIGHT = 1u << 6;
+constexpr uint32_t PBR_VISIBILITY_MASK = 1u << 7;
+
+inline const std::vector<const char*>& pbrFeatureNames()
+{
+    static const std::vector<const char*> names = { "NORMAL_MAP", "AMBIENT_OCCLUSION_MAP", "WETNESS", "METALNESS",
+                                                    "POINT_LIGHT", "SHADOW", "INDIRECT_LIGHT", "VISIBILITY_MASK" };
+    return names;
+}
+
+#endif
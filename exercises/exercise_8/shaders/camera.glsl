@@ -0,0 +1,11 @@
+// camera of this frame, written once by latchCamera in main.cpp. FrameCamera there is the same block on the C++
+// side, change both together
+layout (std140) uniform Camera
+{
+   mat4 view;
+   mat4 projection;
+   mat4 viewProjection;
+   mat4 inverseViewProjection;
+   vec4 position;
+   vec4 irradiance[9];       // of the sky as spherical harmonics, see sky_irradiance.h
+} camera;
@@ -6,7 +6,7 @@ layout (location = 3) in vec3 tangent;
 
 
 uniform mat4 model; // represents model coordinates in the world coord space
-uniform mat4 viewProjection;  // represents the view and projection matrices combined
+#include "camera.glsl"
 uniform mat4 lightSpaceMatrix;   // transforms from world space to light space
 
 out vec4 worldPos;
@@ -18,9 +18,7 @@ uniform vec4 texCoordTransform;
 
 out vec4 fragPosLightSpace;
 
-// Rain
-uniform mat4 rainSpaceMatrix;
-out vec4 fragPosRainSpace;
+invariant gl_Position;
 
 void main() {
    // vertex in world space (for lighting computation)
@@ -31,10 +29,9 @@ void main() {
    worldTangent = (model * vec4(tangent, 0.0)).xyz;
 
    fragPosLightSpace = lightSpaceMatrix * worldPos;
-   fragPosRainSpace= rainSpaceMatrix* worldPos;
 
    textureCoordinates = textCoord * texCoordTransform.xy + texCoordTransform.zw;
 
    // final vertex position (for opengl rendering, not for lighting)
-   gl_Position = viewProjection * worldPos;
+   gl_Position = camera.viewProjection * worldPos;
 }
\ No newline at end of file
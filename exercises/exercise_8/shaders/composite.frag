@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+
+void main()
+{
+   // the texture is sRGB, so this reads linear values and GL_FRAMEBUFFER_SRGB encodes them again on write
+   FragColor = vec4(texelFetch(sceneColor, ivec2(gl_FragCoord.xy), 0).rgb, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+
+uniform sampler2D sceneDepth;
+uniform int scale;
+
+void main()
+{
+   // farthest depth of the block of scene pixels covered by this texel, so a drop is kept
+   // as long as it is visible in any of them, the upsampling sorts out the edges
+   ivec2 base = ivec2(gl_FragCoord.xy) * scale;
+   ivec2 last = textureSize(sceneDepth, 0) - 1;
+   float depth = 0.0;
+   for (int y = 0; y < scale; y++)
+      for (int x = 0; x < scale; x++)
+         depth = max(depth, texelFetch(sceneDepth, min(base + ivec2(x, y), last), 0).r);
+
+   gl_FragDepth = depth;
+}
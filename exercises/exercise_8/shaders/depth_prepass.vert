@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in vec3 vertex;
+
+uniform mat4 model;
+#include "camera.glsl"
+
+// must match common_shading.vert exactly, so both passes produce the same depth
+invariant gl_Position;
+
+void main()
+{
+   vec4 worldPos = model * vec4(vertex, 1.0);
+   gl_Position = camera.viewProjection * worldPos;
+}
@@ -0,0 +1,52 @@
+#version 330 core
+
+// premultiplied color and coverage of the particles, blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA
+out vec4 FragColor;
+
+uniform sampler2D particleColor;
+uniform sampler2D particleDepth;
+uniform sampler2D sceneDepth;
+uniform int scale;
+uniform float nearPlane;
+uniform float farPlane;
+
+float LinearDepth(float depth)
+{
+   return nearPlane * farPlane / (farPlane - depth * (farPlane - nearPlane));
+}
+
+void main()
+{
+   ivec2 pixel = ivec2(gl_FragCoord.xy);
+   float depth = LinearDepth(texelFetch(sceneDepth, pixel, 0).r);
+
+   // the 2x2 low resolution texels around this pixel and their bilinear weights
+   vec2 position = (vec2(pixel) + 0.5) / float(scale) - 0.5;
+   ivec2 base = ivec2(floor(position));
+   vec2 f = position - vec2(base);
+   ivec2 last = textureSize(particleColor, 0) - 1;
+
+   vec4 bilinear = vec4(0.0);
+   vec4 nearest = vec4(0.0);
+   float nearestDifference = 1e20;
+   float maxDifference = 0.0;
+   for (int i = 0; i < 4; i++)
+   {
+      ivec2 offset = ivec2(i & 1, i >> 1);
+      ivec2 texel = clamp(base + offset, ivec2(0), last);
+      vec4 color = texelFetch(particleColor, texel, 0);
+      float difference = abs(LinearDepth(texelFetch(particleDepth, texel, 0).r) - depth);
+
+      vec2 weights = mix(1.0 - f, f, vec2(offset));
+      bilinear += color * weights.x * weights.y;
+      if (difference < nearestDifference)
+      {
+         nearestDifference = difference;
+         nearest = color;
+      }
+      maxDifference = max(maxDifference, difference);
+   }
+
+   // smooth where all texels see the same surface, across depth edges take the texel that matches this pixel
+   FragColor = maxDifference < 0.05 * depth ? bilinear : nearest;
+}
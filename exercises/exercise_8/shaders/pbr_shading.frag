@@ -1,6 +1,17 @@
 #version 330 core
 
-uniform vec3 camPosition; // so we can compute the view vector
+// Compiled in variants, ShaderVariants (shader_variants.h) inserts the #defines of the features a draw needs:
+//   NORMAL_MAP             the mesh has a normal map, otherwise the interpolated normal is used
+//   AMBIENT_OCCLUSION_MAP  the mesh has an ambient occlusion map
+//   WETNESS                the surface gets wet in the rain
+//   METALNESS              metals by the metalness uniform, otherwise a dielectric
+//   POINT_LIGHT            attenuated by the distance to the light, otherwise a directional light
+//   SHADOW                 the directional light is shadowed by the shadow map
+//   INDIRECT_LIGHT         skybox ambient and reflection, only added by the first lighting pass
+//   VISIBILITY_MASK        shadow and wetness come from the mask instead (see visibility_mask.frag)
+
+#include "camera.glsl"
+
 out vec4 FragColor; // the output color of this fragment
 
 // light uniform variables
@@ -12,6 +23,9 @@ uniform float lightRadius;
 // material properties
 uniform vec3 reflectionColor;
 uniform float roughness;
+#ifdef METALNESS
+uniform float metalness;
+#endif
 // legacy uniforms, not needed for PBR
 uniform float ambientReflectance;
 uniform float diffuseReflectance;
@@ -37,41 +51,60 @@ in vec2 textureCoordinates;
 in vec4 fragPosLightSpace;
 
 
-// Rain
-uniform sampler2D rainMap;
-in vec4 fragPosRainSpace;
+// Rain, exposure baked into a world space volume (see wetness.h)
+uniform sampler3D wetnessVolume;
+uniform vec3 wetnessVolumeMin;
+uniform vec3 wetnessVolumeSize;
+uniform float wetnessNormalOffset;
+
+// Shadow and wetness evaluated once per pixel after the depth pre-pass (see visibility_mask.frag)
+uniform sampler2D visibilityMask;
+uniform sampler2D visibilityMaskDepth;
+uniform int visibilityMaskScale;
 
 
 // Constant Pi
 const float PI = 3.14159265359;
 
 float resultRoughness = 0.0f;
+float wetness = 0.0f;
 
 
-float GetWetness()
+vec2 GetVisibilityMask()
 {
-
-   vec3 projCoords = fragPosRainSpace.xyz / fragPosRainSpace.w;
-   projCoords = projCoords * 0.5 + 0.5;
-
-   float closestDepth = texture(rainMap, projCoords.xy).r;
-   float currentDepth = clamp(projCoords.z,-1,1);
-
-   float bias =0.005;
-   float wetness = currentDepth - bias > closestDepth  ? 0.0f : 1.0f;
-
-   // source: https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
-   vec2 texelSize = 1.0 / textureSize(rainMap, 0);
-   for(int x = -1; x <= 1; ++x)
+   ivec2 pixel = ivec2(gl_FragCoord.xy);
+   if (visibilityMaskScale == 1)
+      return texelFetch(visibilityMask, pixel, 0).rg;
+
+   // depth aware upsampling: of the four closest mask texels, take the one that was evaluated
+   // at the depth closest to this fragment, so shadows and wetness do not bleed across edges
+   ivec2 base = (pixel - 1) / 2;
+   ivec2 maxTexel = textureSize(visibilityMask, 0) - 1;
+   vec2 result = vec2(1.0, 0.0);
+   float bestDifference = 2.0;
+   for (int i = 0; i < 4; i++)
    {
-      for(int y = -1; y <= 1; ++y)
+      ivec2 texel = clamp(base + ivec2(i & 1, i >> 1), ivec2(0), maxTexel);
+      float difference = abs(texelFetch(visibilityMaskDepth, texel, 0).r - gl_FragCoord.z);
+      if (difference < bestDifference)
       {
-         float pcfDepth = texture(rainMap, projCoords.xy + vec2(x, y) * texelSize).r;
-         wetness += currentDepth - bias > pcfDepth ? 0.0 : 1.0;
+         bestDifference = difference;
+         result = texelFetch(visibilityMask, texel, 0).rg;
       }
    }
+   return result;
+}
+
 
-   return wetness/=15.0f;
+float GetWetness()
+{
+   // push the lookup off the surface along the geometric normal, otherwise half of the
+   // trilinear footprint lies inside the geometry, which is always covered
+   vec3 samplePos = worldPos.xyz + normalize(worldNormal) * wetnessNormalOffset;
+   vec3 volumeCoords = (samplePos - wetnessVolumeMin) / wetnessVolumeSize;
+
+   // the volume is sliced along world Y
+   return texture(wetnessVolume, volumeCoords.xzy).r;
 }
 
 
@@ -124,7 +157,7 @@ vec3 GetCookTorranceSpecularLighting(vec3 N, vec3 L, vec3 V)
    // Get the rougness from a texture to use for Fresnel term
    float roughnessTexture = 0.5f;//texture(texture_ambient1, textureCoordinates).g;
 
-   resultRoughness = mix(roughnessTexture, 0.01f, GetWetness());
+   resultRoughness = mix(roughnessTexture, 0.01f, wetness);
    float a = resultRoughness * resultRoughness;
 
    float D = DistributionGGX(N, H, a);
@@ -163,14 +196,28 @@ vec3 GetNormalMap()
    return TBN * normalMap;
 }
 
+// cosine weighted mean radiance of the sky around the normal, from the coefficients of sky_irradiance.h
+vec3 GetSkyIrradiance(vec3 n)
+{
+   vec3 irradiance = camera.irradiance[0].rgb
+                   + camera.irradiance[1].rgb * n.y + camera.irradiance[2].rgb * n.z + camera.irradiance[3].rgb * n.x
+                   + camera.irradiance[4].rgb * (n.x * n.y) + camera.irradiance[5].rgb * (n.y * n.z)
+                   + camera.irradiance[6].rgb * (3.0f * n.z * n.z - 1.0f) + camera.irradiance[7].rgb * (n.x * n.z)
+                   + camera.irradiance[8].rgb * (n.x * n.x - n.y * n.y);
+   // the ringing of the truncated series can dip below zero opposite a bright sky
+   return max(irradiance, vec3(0.0f));
+}
+
 vec3 GetAmbientLighting(vec3 albedo, vec3 normal)
 {
 
-   vec3 ambient = textureLod(skybox, normal,6.0f).xyz;
+   vec3 ambient = GetSkyIrradiance(normal);
    ambient *= albedo/ PI;
 
+#ifdef AMBIENT_OCCLUSION_MAP
    float ambientOcclusion = texture(texture_ambient1, textureCoordinates).r;
    ambient *= ambientOcclusion;
+#endif
 
    return ambient;
 }
@@ -245,41 +292,70 @@ vec3 GetWetAlbedeo(vec3 dryAlbedeo){
 void main()
 {
    vec4 P = worldPos;
+#ifdef NORMAL_MAP
    vec3 N = GetNormalMap();
+#else
+   vec3 N = normalize(worldNormal);
+#endif
+
+#ifdef VISIBILITY_MASK
+   vec2 visibility = GetVisibilityMask();
+#endif
 
-   // Uses the textures to get the correct wetness
-   float wetness = GetWetness();
+#ifdef WETNESS
+   // Uses the baked volume to get the correct wetness
+#ifdef VISIBILITY_MASK
+   wetness = visibility.g;
+#else
+   wetness = GetWetness();
+#endif
+#endif
 
-   float metalness = 0;//texture(texture_ambient1, textureCoordinates).b;
    vec3 albedo = texture(texture_diffuse1, textureCoordinates).xyz;
 
+#ifdef WETNESS
    vec3 albedoWet = albedo*GetWetAlbedeo(albedo);
-
+#ifdef METALNESS
    albedo =mix(mix(albedo, albedoWet, wetness),albedo,metalness );
+#else
+   albedo = mix(albedo, albedoWet, wetness);
+#endif
+#endif
    albedo *= reflectionColor;
 
 
-   bool positional = lightRadius > 0;
+#ifdef POINT_LIGHT
+   vec3 L = normalize(lightPosition - P.xyz);
+#else
+   vec3 L = normalize(lightPosition);
+#endif
+   vec3 V = normalize(camera.position.xyz - P.xyz);
 
-   vec3 L = normalize(lightPosition - (positional ? P.xyz : vec3(0.0f)));
-   vec3 V = normalize(camPosition - P.xyz);
-
-   vec3 ambient = GetAmbientLighting(albedo, N);
    vec3 diffuse = GetLambertianDiffuseLighting(N, L, albedo);
+#ifdef INDIRECT_LIGHT
+   vec3 ambient = GetAmbientLighting(albedo, N);
+   // before the specular term sets resultRoughness, so the reflection is always the sharp one
    vec3 environment = GetEnvironmentLighting(N, V);
+#endif
 
    vec3 specular = GetCookTorranceSpecularLighting(N,L,V);
 
    // This time we get the lightColor outside the diffuse and specular terms (we are multiplying later)
    vec3 lightRadiance = lightColor;
 
-   // Modulate lightRadiance by distance attenuation (only for positional lights)
-   float attenuation = positional ? GetAttenuation(P) : 1.0f;
-   lightRadiance *= attenuation;
+#ifdef POINT_LIGHT
+   // Modulate lightRadiance by distance attenuation
+   lightRadiance *= GetAttenuation(P);
+#endif
 
+#ifdef SHADOW
    // Modulate lightRadiance by shadow (only for directional light)
-   float shadow = positional ? 1.0f : GetShadow();
-   lightRadiance *= shadow;
+#ifdef VISIBILITY_MASK
+   lightRadiance *= visibility.r;
+#else
+   lightRadiance *= GetShadow();
+#endif
+#endif
 
    // Modulate the radiance with the angle of incidence
    lightRadiance *= max(dot(N, L), 0.0);
@@ -289,18 +365,26 @@ void main()
    vec3 F0 = vec3(0.04f);
 
 
+#ifdef METALNESS
    F0 = mix(F0,albedo,metalness);
 
    diffuse  = mix(diffuse,vec3(0),metalness);
+#ifdef INDIRECT_LIGHT
    ambient = mix(ambient,vec3(0),metalness);
+#endif
+#endif
 
    // Compute the Fresnel term for indirect light,
    // using the clamped cosine of the angle formed by
    // the NORMAL vector and the view vector
    vec3 H = normalize(L + V);
 
+#ifdef INDIRECT_LIGHT
    vec3 schlickAmbient = FresnelSchlick( F0,max(dot(V, N), 0.0));
    vec3 indirectLight = mix(ambient,environment,schlickAmbient);
+#else
+   vec3 indirectLight = vec3(0.0);
+#endif
    vec3 schlickSpec = FresnelSchlick( F0,max(dot(V, H), 0.0));
 
 
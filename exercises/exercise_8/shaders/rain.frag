@@ -0,0 +1,17 @@
+#version 330 core
+
+out vec4 fragColor;
+uniform bool splashes;
+uniform sampler2D splashTexture;
+
+in vec4 color;
+in vec2 textCoords;
+
+void main()
+{
+    float alpha = color.a;
+    if (splashes)
+        alpha *= texture(splashTexture, textCoords).r;
+
+    fragColor = vec4(color.rgb, alpha);
+}
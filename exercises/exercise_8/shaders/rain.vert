@@ -0,0 +1,106 @@
+#version 330 core
+#include "rain_common.glsl"
+
+// Rain streaks and splash sprites generated in the vertex shader, without a geometry shader.
+// Streaks are drawn as lines, two vertices per drop. Splashes are drawn as instanced quads, every
+// instance is a batch of quadsPerInstance quads of 4 vertices so the per instance overhead is paid
+// once per batch instead of once per drop.
+
+uniform bool splashes;          // which of the two draws this is
+uniform int quadsPerInstance;
+
+uniform float splashSpeed;
+uniform float splashQuadSize;
+uniform mat4 viewProjection;
+
+// for splash and occlusion
+uniform mat4 rainSpaceMatrix;
+uniform mat4 inverseRainSpaceMatrix;
+uniform sampler2D rainMap;
+
+out vec4 color;
+out vec2 textCoords;
+
+// All vertices of a primitive make the same decision, so moving them outside of the clip volume
+// drops the whole primitive before it reaches the rasterizer
+void Cull()
+{
+   gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+   color = vec4(0.0);
+}
+
+// The streak is the line from the drop to where it was a second ago
+void EmitStreak(vec3 worldPos, int end)
+{
+   float fade = NearFieldFade(worldPos);
+   vec4 bottom = viewProjection * vec4(worldPos, 1.0);
+   vec4 top = viewProjection * vec4(worldPos - velocity, 1.0);
+   // faded out or off screen, both ends outside of the same clip plane
+   if (fade == 0.0 || (bottom.w < 0.0 && top.w < 0.0) ||
+       (bottom.x > bottom.w && top.x > top.w) || (bottom.x < -bottom.w && top.x < -top.w) ||
+       (bottom.y > bottom.w && top.y > top.w) || (bottom.y < -bottom.w && top.y < -top.w))
+   {
+      Cull();
+      return;
+   }
+
+   // same occlusion and fading as particle.frag, evaluated per drop instead of per fragment
+   vec4 fragPosRainSpace = rainSpaceMatrix * vec4(worldPos, 1.0f);
+   vec3 projCoords = fragPosRainSpace.xyz / fragPosRainSpace.w * 0.5f + 0.5f;
+   float closestDepth = texture(rainMap, projCoords.xy).r;
+   float currentDepth = clamp(projCoords.z, -1.0f, 1.0f);
+   if (currentDepth - 0.005 > closestDepth)
+   {
+      Cull();
+      return;
+   }
+   gl_Position = end == 0 ? bottom : top;
+   color = vec4(1.0, 1.0, 1.0, 0.3f * StreakAlpha() * fade);
+}
+
+// The splash sits where the drop's column hits the rain map, and fades in as the drop gets close to it
+void EmitSplash(vec3 worldPos, int corner)
+{
+   vec4 fragPosRainSpace = rainSpaceMatrix * vec4(worldPos, 1.0f);
+   vec3 projCoords = fragPosRainSpace.xyz / fragPosRainSpace.w * 0.5f + 0.5f;
+   float closestDepth = texture(rainMap, projCoords.xy).r;
+   float currentDepth = clamp(projCoords.z, -1.0f, 1.0f);
+
+   float range = clamp((closestDepth - currentDepth) / splashSpeed, 0, 1);
+   float fade = NearFieldFade(worldPos);
+   // the drop is still too far above the surface for its splash to be visible
+   if (range == 1.0 || fade == 0.0)
+   {
+      Cull();
+      return;
+   }
+
+   projCoords.z = closestDepth;
+   vec4 temp = inverseRainSpaceMatrix * vec4(projCoords * 2 - 1, 1.0);
+   vec3 splashPos = temp.xyz / temp.w;
+
+   // same corners and texture coordinates as splash.geo
+   vec2 side = vec2((corner & 2) == 0 ? splashQuadSize : -splashQuadSize, (corner & 1) == 0 ? splashQuadSize : -splashQuadSize);
+   gl_Position = viewProjection * vec4(splashPos + vec3(side, 0.0), 1.0);
+   textCoords = vec2(corner >> 1, corner & 1);
+   color = vec4(0.9, 0.9, 1.0, mix(0.2, 0.0f, range) * fade);
+}
+
+void main()
+{
+   textCoords = vec2(0.0);
+   if (!splashes)
+   {
+      EmitStreak(GetDropPosition(gl_VertexID / 2), gl_VertexID & 1);
+      return;
+   }
+
+   int drop = gl_InstanceID * quadsPerInstance + gl_VertexID / 4;
+   if (drop >= rainCount)
+   {
+      // the last batch is only partially used
+      Cull();
+      return;
+   }
+   EmitSplash(GetDropPosition(drop), gl_VertexID & 3);
+}
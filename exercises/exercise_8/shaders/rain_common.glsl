@@ -0,0 +1,53 @@
+// Shared by the rain shaders, Shader pastes it over their #include "rain_common.glsl" line. cpu_rain.h is the
+// C++ version of it, keep the two in step.
+
+uniform int rainCount;
+uniform float currentTime;
+uniform float boxSize;
+uniform vec3 cameraPosition;
+uniform vec3 forward;
+uniform vec3 velocity;
+uniform float nearFieldFadeStart;   // horizontal distance to the camera
+uniform float nearFieldFadeEnd;
+
+// Position of drop number id inside the unit rain box, generated instead of read from a vertex buffer.
+// The R3 low-discrepancy sequence spreads any number of drops evenly over the box, a hashed jitter of
+// up to half the mean drop spacing hides its lattice pattern. Both run in 32 bit fixed point so the
+// sequence stays exact for millions of drops.
+uvec3 Hash(uvec3 v)
+{
+   v = v * 1664525u + 1013904223u;
+   v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+   v ^= v >> 16u;
+   v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+   return v;
+}
+
+vec3 RainSeed(int id)
+{
+   uvec3 sequence = uint(id) * uvec3(3518319155u, 2882110345u, 2360945575u);
+   vec3 jitter = vec3(Hash(uvec3(uint(id))) >> 8u) / 16777216.0 - 0.5;
+   return fract(vec3(sequence >> 8u) / 16777216.0 + jitter / pow(float(rainCount), 1.0 / 3.0));
+}
+
+// Where drop number id is at currentTime: its seed moved by the rain and wrapped into the box in front of the
+// camera. Taken inspiration from Charlie Birtwistle and Stephen Mcauley code in 5.1 Dynamic Weather Effects
+vec3 GetDropPosition(int id)
+{
+   vec3 position = RainSeed(id) * boxSize;
+   position += velocity * currentTime - (cameraPosition + forward + vec3(boxSize) * 0.5f);
+   position = mod(position, boxSize);
+   return position + cameraPosition + forward - vec3(boxSize) * 0.5f;
+}
+
+// Opacity of a streak, longer streaks are fainter
+float StreakAlpha()
+{
+   return 1.0f - length(velocity.xy) / boxSize * 0.5f;
+}
+
+// Fades the drops out towards the edge of the rain box, where the rain sheets take over
+float NearFieldFade(vec3 worldPos)
+{
+   return 1.0 - smoothstep(nearFieldFadeStart, nearFieldFadeEnd, length(worldPos.xz - cameraPosition.xz));
+}
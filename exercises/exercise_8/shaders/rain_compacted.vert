@@ -0,0 +1,38 @@
+#version 430 core
+
+// Draws the streaks and splashes left by rain_simulate.comp, with the same look as rain.vert
+
+layout (std430, binding = 1) readonly buffer Streaks { vec4 streakDrops[]; };
+layout (std430, binding = 2) readonly buffer Splashes { vec4 splashDrops[]; };
+
+uniform bool splashes;          // which of the two draws this is
+uniform vec3 velocity;
+uniform float splashQuadSize;
+uniform mat4 viewProjection;
+
+out vec4 color;
+out vec2 textCoords;
+
+const int quadCorners[6] = int[6](0, 1, 2, 2, 1, 3);
+
+void main()
+{
+   textCoords = vec2(0.0);
+   if (!splashes)
+   {
+      // the line from the drop to where it was a second ago
+      vec4 drop = streakDrops[gl_VertexID / 2];
+      vec3 position = (gl_VertexID & 1) == 0 ? drop.xyz : drop.xyz - velocity;
+      gl_Position = viewProjection * vec4(position, 1.0);
+      color = vec4(1.0, 1.0, 1.0, drop.w);
+      return;
+   }
+
+   // same corners and texture coordinates as splash.geo
+   vec4 splash = splashDrops[gl_VertexID / 6];
+   int corner = quadCorners[gl_VertexID % 6];
+   vec2 side = vec2((corner & 2) == 0 ? splashQuadSize : -splashQuadSize, (corner & 1) == 0 ? splashQuadSize : -splashQuadSize);
+   gl_Position = viewProjection * vec4(splash.xyz + vec3(side, 0.0), 1.0);
+   textCoords = vec2(corner >> 1, corner & 1);
+   color = vec4(0.9, 0.9, 1.0, splash.w);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+
+out vec4 fragColor;
+uniform sampler2D rainSheet;
+
+in vec2 sheetCoords;
+in float height;
+flat in float layerOpacity;
+
+void main()
+{
+    float streaks = texture(rainSheet, sheetCoords).r;
+    // fades out towards the top of the cylinder, so looking up shows no edge
+    float fade = smoothstep(1.0, 0.5, height) * smoothstep(0.0, 0.05, height);
+
+    fragColor = vec4(1.0, 1.0, 1.0, streaks * layerOpacity * fade);
+}
@@ -0,0 +1,53 @@
+#version 330 core
+
+// Open cylinder around the camera for one far field rain layer, generated from gl_VertexID.
+// gl_InstanceID selects the layer, the farthest one is drawn first.
+
+uniform mat4 viewProjection;
+uniform vec3 cameraPosition;
+uniform vec3 velocity;
+uniform float currentTime;
+uniform float boxSize;
+uniform int segments;
+uniform int layerCount;
+uniform float radius[3];
+uniform float opacity[3];
+
+out vec2 sheetCoords;
+out float height;     // 0 at the bottom of the cylinder, 1 at the top
+flat out float layerOpacity;
+
+const float PI = 3.14159265359;
+
+void main()
+{
+   int layer = layerCount - 1 - gl_InstanceID;
+   float r = radius[layer];
+   layerOpacity = opacity[layer];
+
+   // two triangles per segment, corners (column, top): (0,0) (1,0) (0,1) (0,1) (1,0) (1,1)
+   int segment = gl_VertexID / 6;
+   int corner = gl_VertexID % 6;
+   int column = segment + ((corner == 1 || corner == 4 || corner == 5) ? 1 : 0);
+   height = (corner == 2 || corner == 3 || corner == 5) ? 1.0 : 0.0;
+
+   float angle = 2.0 * PI * float(column) / float(segments);
+   vec3 outward = vec3(cos(angle), 0.0, sin(angle));
+   vec3 tangent = vec3(-outward.z, 0.0, outward.x);
+   // from below the ground to high enough to fill the view above the horizon, inside the far plane
+   float y = mix(cameraPosition.y - boxSize * 0.5, cameraPosition.y + r * 0.4, height);
+   vec3 worldPos = vec3(cameraPosition.x, y, cameraPosition.z) + outward * r;
+
+   // streak tiles of about the same angular size on every layer, a whole number of them around the cylinder
+   float tilesAround = floor(2.0 * PI / 0.15 + 0.5);
+   float tileWidth = 2.0 * PI * r / tilesAround;
+   float tileHeight = tileWidth * 4.0;
+
+   // sheared along the fall direction, so the streaks lean with the wind, and scrolled with the rain
+   float fallSpeed = min(velocity.y, -0.1);
+   float across = angle * r - dot(velocity, tangent) / fallSpeed * y;
+   float along = y - fallSpeed * currentTime;
+   sheetCoords = vec2(across / tileWidth, along / tileHeight) + vec2(0.37, 0.61) * float(layer);
+
+   gl_Position = viewProjection * vec4(worldPos, 1.0);
+}
@@ -3,9 +3,7 @@ layout (location = 0) in vec3 vertex;
 
 out vec3 TexCoords;
 
-
-uniform mat4 projection;
-uniform mat4 view;
+#include "camera.glsl"
 
 void main()
 {
@@ -17,7 +15,7 @@ void main()
    // repersenting the skybox relative to the camera.
    // To do that we extract the top left part of the matrix with mat3, and multiply by vertex without
    // the homogeneous coordinate
-   vec4 pos = projection * vec4(mat3(view) * vertex, 1.0);
+   vec4 pos = camera.projection * vec4(mat3(camera.view) * vertex, 1.0);
    // Notice this interesting manipulation, we use w as the z coordinate, why do you think this is the case?
    gl_Position = pos.xyww;
 }  
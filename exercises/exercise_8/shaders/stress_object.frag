@@ -0,0 +1,25 @@
+#version 330 core
+
+in vec3 worldNormal;
+
+out vec4 FragColor;
+
+layout (std140) uniform Object
+{
+   mat4 model;
+   vec4 color;
+} object;
+
+// once per pass, recorded by StressScene
+layout (std140) uniform StressPass
+{
+   vec4 lightDirection;    // towards the light
+   vec4 lightColor;
+   vec4 ambientColor;
+} pass;
+
+void main()
+{
+   float diffuse = max(dot(normalize(worldNormal), pass.lightDirection.xyz), 0.0);
+   FragColor = vec4(object.color.rgb * (pass.ambientColor.rgb + pass.lightColor.rgb * diffuse), 1.0);
+}
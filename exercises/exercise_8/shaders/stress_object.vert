@@ -0,0 +1,21 @@
+#version 330 core
+layout (location = 0) in vec3 vertex;
+layout (location = 1) in vec3 normal;
+
+#include "camera.glsl"
+
+// per draw, recorded by StressScene into a command buffer
+layout (std140) uniform Object
+{
+   mat4 model;
+   vec4 color;
+} object;
+
+out vec3 worldNormal;
+
+void main()
+{
+   // uniform scale only, so the model matrix keeps the normals perpendicular
+   worldNormal = mat3(object.model) * normal;
+   gl_Position = camera.viewProjection * object.model * vec4(vertex, 1.0);
+}
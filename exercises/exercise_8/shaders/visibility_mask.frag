@@ -0,0 +1,91 @@
+#version 330 core
+
+// R: shadow of the directional light, G: wetness
+layout (location = 0) out vec2 visibility;
+// depth the texel was evaluated at, for the depth aware upsampling of the half resolution mask
+layout (location = 1) out float visibilityDepth;
+
+in vec2 textureCoordinates;
+
+uniform sampler2D sceneDepth;
+#include "camera.glsl"
+uniform int maskScale;      // 1 for full resolution, 2 for half resolution
+
+uniform mat4 lightSpaceMatrix;
+uniform sampler2D shadowMap;
+
+uniform sampler3D wetnessVolume;
+uniform vec3 wetnessVolumeMin;
+uniform vec3 wetnessVolumeSize;
+uniform float wetnessNormalOffset;
+
+vec3 GetWorldPosition(ivec2 pixel, float depth)
+{
+   vec2 uv = (vec2(pixel) + 0.5) / vec2(textureSize(sceneDepth, 0));
+   vec4 clipPos = vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+   vec4 worldPos = camera.inverseViewProjection * clipPos;
+   return worldPos.xyz / worldPos.w;
+}
+
+// reconstructs the normal from the neighbouring pixels, using the side with the smaller depth
+// difference so silhouettes do not bend the normal towards the background
+vec3 GetWorldNormal(ivec2 pixel, vec3 P, float depth)
+{
+   ivec2 maxPixel = textureSize(sceneDepth, 0) - 1;
+   ivec2 left = clamp(pixel - ivec2(1, 0), ivec2(0), maxPixel);
+   ivec2 right = clamp(pixel + ivec2(1, 0), ivec2(0), maxPixel);
+   ivec2 down = clamp(pixel - ivec2(0, 1), ivec2(0), maxPixel);
+   ivec2 up = clamp(pixel + ivec2(0, 1), ivec2(0), maxPixel);
+
+   float depthLeft = texelFetch(sceneDepth, left, 0).r;
+   float depthRight = texelFetch(sceneDepth, right, 0).r;
+   float depthDown = texelFetch(sceneDepth, down, 0).r;
+   float depthUp = texelFetch(sceneDepth, up, 0).r;
+
+   vec3 dx = abs(depthRight - depth) < abs(depthLeft - depth) ? GetWorldPosition(right, depthRight) - P : P - GetWorldPosition(left, depthLeft);
+   vec3 dy = abs(depthUp - depth) < abs(depthDown - depth) ? GetWorldPosition(up, depthUp) - P : P - GetWorldPosition(down, depthDown);
+
+   return normalize(cross(dx, dy));
+}
+
+// taken from GetShadow() in pbr_shading.frag
+float GetShadow(vec3 P)
+{
+   vec4 fragPosLightSpace = lightSpaceMatrix * vec4(P, 1.0);
+   vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
+   projCoords = projCoords * 0.5 + 0.5;
+
+   float closestDepth = texture(shadowMap, projCoords.xy).r;
+   float currentDepth = clamp(projCoords.z,-1,1);
+
+   float bias =0.005;
+   return currentDepth - bias > closestDepth  ? 0.0 : 1.0;
+}
+
+// taken from GetWetness() in pbr_shading.frag
+float GetWetness(vec3 P, vec3 N)
+{
+   vec3 samplePos = P + N * wetnessNormalOffset;
+   vec3 volumeCoords = (samplePos - wetnessVolumeMin) / wetnessVolumeSize;
+   return texture(wetnessVolume, volumeCoords.xzy).r;
+}
+
+void main()
+{
+   // at half resolution every mask texel is evaluated at one of the full resolution pixels it covers
+   ivec2 pixel = ivec2(gl_FragCoord.xy) * maskScale;
+   float depth = texelFetch(sceneDepth, pixel, 0).r;
+   visibilityDepth = depth;
+
+   // nothing but sky here
+   if (depth >= 1.0)
+   {
+      visibility = vec2(1.0, 0.0);
+      return;
+   }
+
+   vec3 P = GetWorldPosition(pixel, depth);
+   vec3 N = GetWorldNormal(pixel, P, depth);
+
+   visibility = vec2(GetShadow(P), GetWetness(P, N));
+}
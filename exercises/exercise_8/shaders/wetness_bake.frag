@@ -0,0 +1,49 @@
+#version 330 core
+
+out float wetness;
+
+in vec2 volumeCoords;
+
+uniform sampler2D rainMap;
+uniform mat4 rainSpaceMatrix;
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+uniform float sliceY;
+
+uniform int kernelRadius;
+uniform float bias;
+uniform float maxWetness;
+
+// taken from GetWetness() in pbr_shading.frag, evaluated once per voxel instead of once per fragment
+float GetExposure(vec2 coords, float currentDepth)
+{
+   float closestDepth = texture(rainMap, coords).r;
+   return currentDepth - bias > closestDepth ? 0.0f : 1.0f;
+}
+
+void main()
+{
+   // the volume is sliced along world Y, the render target covers world X and Z
+   vec3 worldPos = boundsMin + vec3(volumeCoords.x, sliceY, volumeCoords.y) * boundsSize;
+
+   vec4 fragPosRainSpace = rainSpaceMatrix * vec4(worldPos, 1.0);
+   vec3 projCoords = fragPosRainSpace.xyz / fragPosRainSpace.w;
+   projCoords = projCoords * 0.5 + 0.5;
+   float currentDepth = clamp(projCoords.z, -1, 1);
+
+   // source: https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping
+   float exposure = GetExposure(projCoords.xy, currentDepth);
+   float taps = 1.0f;
+   vec2 texelSize = 1.0 / textureSize(rainMap, 0);
+   for(int x = -kernelRadius; x <= kernelRadius; ++x)
+   {
+      for(int y = -kernelRadius; y <= kernelRadius; ++y)
+      {
+         exposure += GetExposure(projCoords.xy + vec2(x, y) * texelSize, currentDepth);
+         taps += 1.0f;
+      }
+   }
+
+   wetness = exposure / taps * maxWetness;
+}
@@ -0,0 +1,11 @@
+#version 330 core
+
+out vec2 volumeCoords;
+
+void main()
+{
+   // full screen triangle, no vertex buffer needed
+   vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+   volumeCoords = corner;
+   gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,220 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+
+#include <trace.h>
+
+// Hands the latest value from one writer thread to one reader thread without locks.
+// The writer fills back() and publishes it, the reader acquires the newest published value into front().
+// Neither side ever waits: the third slot is where the published value sits until the reader swaps it in,
+// and a value the reader did not pick up in time is simply overwritten by the next one.
+template<typename T>
+class TripleBuffer
+{
+public:
+    T& back()
+    {
+        return slots[backIndex];
+    }
+
+    void publish()
+    {
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // returns false and keeps front() as it is if nothing was published since the last acquire
+    bool acquire()
+    {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T& front() const
+    {
+        return slots[frontIndex];
+    }
+
+private:
+    static const int INDEX_MASK = 3;
+    static const int FRESH = 4;
+
+    T slots[3] = {};
+    int backIndex = 0, frontIndex = 1;
+    std::atomic<int> middle{2};
+};
+
+// what the simulation owns. Camera orientation stays with the render thread, it follows the mouse
+// at the latch and is only passed in to know where forward is
+struct SimulationState
+{
+    double time = 0.0;                 // seconds, drives the rain
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float lightAngle = 0.0f;           // radians the additional lights are turned around the y axis
+
+    static SimulationState mix(const SimulationState& a, const SimulationState& b, float t)
+    {
+        SimulationState state;
+        state.time = a.time + (b.time - a.time) * t;
+        state.cameraPosition = glm::mix(a.cameraPosition, b.cameraPosition, t);
+        state.lightAngle = glm::mix(a.lightAngle, b.lightAngle, t);
+        return state;
+    }
+};
+
+// input and settings from the render thread, copied at the start of every tick
+struct SimulationInput
+{
+    bool forward = false, backward = false, left = false, right = false;
+    glm::vec3 front = glm::vec3(0.0f, 0.0f, -1.0f);
+    glm::vec3 side = glm::vec3(1.0f, 0.0f, 0.0f);
+    float movementSpeed = 2.5f;
+    float lightRotationSpeed = 0.0f;   // radians per second
+};
+
+// Advances the simulation on its own thread at a fixed tick, independent of how long frames take.
+// Every tick publishes the state before and after it, so the renderer can interpolate the two on its own
+// schedule. Rendering is one tick behind the simulation that way, in exchange a stalled frame no longer
+// slows the simulation down and the motion stays smooth when frame and tick rate do not line up.
+class Simulation
+{
+public:
+    // statistics, written by the simulation thread
+    std::atomic<float> tickMs{0.0f};           // work per tick, averaged
+    std::atomic<float> ticksPerSecond{0.0f};
+    std::atomic<int> droppedTicks{0};          // skipped because the thread was too far behind
+
+    Simulation(const glm::vec3& cameraPosition, double startTime, float tickRate = 120.0f)
+        : tickSeconds(1.0 / tickRate)
+    {
+        state.time = startTime;
+        state.cameraPosition = cameraPosition;
+        startWall = Clock::now();
+        Snapshot& snapshot = snapshots.back();
+        snapshot.previous = snapshot.current = state;
+        snapshot.scheduled = startWall;
+        snapshots.publish();
+
+        thread = std::thread(&Simulation::run, this);
+    }
+
+    ~Simulation()
+    {
+        stopping = true;
+        thread.join();
+    }
+
+    void setInput(const SimulationInput& newInput)
+    {
+        std::lock_guard<std::mutex> lock(inputMutex);
+        input = newInput;
+    }
+
+    // the state to show now, between the last two ticks. Render thread only
+    SimulationState sample()
+    {
+        snapshots.acquire();
+        const Snapshot& snapshot = snapshots.front();
+        double sinceTick = std::chrono::duration<double>(Clock::now() - snapshot.scheduled).count();
+        float alpha = (float)glm::clamp(sinceTick / tickSeconds, 0.0, 1.0);
+        return SimulationState::mix(snapshot.previous, snapshot.current, alpha);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    static const int MAX_CATCH_UP = 5;   // ticks, further behind than this the schedule starts over
+
+    struct Snapshot
+    {
+        SimulationState previous, current;
+        Clock::time_point scheduled;   // when current was due, ticks run late but not early
+    };
+
+    const double tickSeconds;
+    Clock::time_point startWall;
+    std::thread thread;
+    std::atomic<bool> stopping{false};
+
+    std::mutex inputMutex;
+    SimulationInput input;
+
+    SimulationState state;                 // simulation thread only
+    TripleBuffer<Snapshot> snapshots;
+
+    void run()
+    {
+        Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(tickSeconds));
+        Clock::time_point next = startWall;
+        Clock::time_point rateStart = startWall;
+        int rateTicks = 0;
+        float averageMs = 0.0f;
+        TRACE_THREAD_NAME("Simulation");
+
+        while (!stopping)
+        {
+            next += interval;
+            std::this_thread::sleep_until(next);
+
+            Clock::time_point now = Clock::now();
+            if (now - next > interval * (int)MAX_CATCH_UP)
+            {
+                droppedTicks += (int)((now - next) / interval);
+                next = now;
+            }
+
+            tick(next);
+
+            Clock::time_point end = Clock::now();
+            averageMs = averageMs * 0.95f + std::chrono::duration<float, std::milli>(end - now).count() * 0.05f;
+            tickMs = averageMs;
+            rateTicks++;
+            float rateSeconds = std::chrono::duration<float>(end - rateStart).count();
+            if (rateSeconds >= 0.5f)
+            {
+                ticksPerSecond = rateTicks / rateSeconds;
+                rateTicks = 0;
+                rateStart = end;
+            }
+        }
+    }
+
+    void tick(Clock::time_point scheduled)
+    {
+        TRACE_SCOPE("Simulation tick");
+        SimulationInput current;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            current = input;
+        }
+
+        Snapshot& snapshot = snapshots.back();
+        snapshot.previous = state;
+
+        float dt = (float)tickSeconds;
+        float velocity = current.movementSpeed * dt;
+        if (current.forward)
+            state.cameraPosition += current.front * velocity;
+        if (current.backward)
+            state.cameraPosition -= current.front * velocity;
+        if (current.left)
+            state.cameraPosition -= current.side * velocity;
+        if (current.right)
+            state.cameraPosition += current.side * velocity;
+
+        state.lightAngle += current.lightRotationSpeed * dt;
+        state.time += tickSeconds;
+
+        snapshot.current = state;
+        snapshot.scheduled = scheduled;
+        snapshots.publish();
+    }
+};
+
+#endif
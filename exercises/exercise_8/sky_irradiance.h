@@ -0,0 +1,297 @@
+#ifndef SKY_IRRADIANCE_H
+#define SKY_IRRADIANCE_H
+
+#include <glm/glm.hpp>
+
+#include <model.h>
+#include <thread_pool.h>
+#include <trace.h>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+#include <sys/stat.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SKY_IRRADIANCE_SSE2 1
+#endif
+
+// The light the skybox sends onto a surface, as 9 spherical harmonics coefficients (bands 0 to 2) per color.
+// Irradiance is so smooth that 9 coefficients keep all but a few percent of it, so pbr_shading.frag gets it
+// with a handful of multiply-adds per fragment instead of a lookup in a far mip of the cubemap, whose box filtered
+// texels neither weigh by the cosine nor cover the hemisphere.
+//
+// The faces are projected once when they are loaded, every texel weighed by the solid angle it covers. The faces
+// are decoded and projected in parallel on a ThreadPool, four texels at a time with SSE2. The result is cached
+// next to the faces (CACHE_FILE), found by the size and modification time of every face.
+//
+// coefficients[] has the convolution with the clamped cosine and the normalization of the basis folded in, so for a
+// normal n the cosine weighted mean radiance (irradiance / pi) is
+//   c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+// They are vec4s like in a std140 array, the fourth component is not used.
+class SkyIrradiance
+{
+public:
+    static constexpr const char* CACHE_FILE = "irradiance_sh.bin";
+    static const uint32_t MAGIC = 0x39485352;     // "RSH9"
+    static const uint32_t VERSION = 1;
+
+    glm::vec4 coefficients[9] = {};
+    bool cached = false;        // the coefficients came from the cache
+    float projectMs = 0.0f;     // decoding and projecting, 0 when cached
+
+    // the coefficients cached for faces, false when there are none or the faces changed since
+    bool load(const std::vector<std::string>& faces)
+    {
+        FILE* file = fopen(cachePath(faces).c_str(), "rb");
+        if (!file)
+            return false;
+        uint32_t header[2] = {};
+        uint64_t cacheKey = 0;
+        glm::vec4 read[9];
+        bool valid = fread(header, sizeof(header), 1, file) == 1 && header[0] == MAGIC && header[1] == VERSION &&
+                     fread(&cacheKey, sizeof(cacheKey), 1, file) == 1 && cacheKey == key(faces) &&
+                     fread(read, sizeof(read), 1, file) == 1;
+        fclose(file);
+        if (!valid)
+            return false;
+        for (int i = 0; i < 9; i++)
+            coefficients[i] = read[i];
+        cached = true;
+        projectMs = 0.0f;
+        return true;
+    }
+
+    void save(const std::vector<std::string>& faces) const
+    {
+        FILE* file = fopen(cachePath(faces).c_str(), "wb");
+        if (!file)
+        {
+            std::cout << "Sky irradiance: could not write " << cachePath(faces) << std::endl;
+            return;
+        }
+        uint32_t header[2] = { MAGIC, VERSION };
+        uint64_t cacheKey = key(faces);
+        fwrite(header, sizeof(header), 1, file);
+        fwrite(&cacheKey, sizeof(cacheKey), 1, file);
+        fwrite(coefficients, sizeof(coefficients), 1, file);
+        fclose(file);
+    }
+
+    // projects the 6 faces, in the order of the cubemap (+X, -X, +Y, -Y, +Z, -Z) and read like loadCubemap reads
+    // them. A face that cannot be read adds no light
+    void project(const std::vector<std::string>& faces, ThreadPool* pool)
+    {
+        TRACE_SCOPE("Project sky irradiance");
+        auto start = std::chrono::steady_clock::now();
+        float faceSums[6][9][3] = {};
+        auto body = [&](int begin, int end, int /*thread*/) {
+            for (int face = begin; face < end && face < (int)faces.size(); face++)
+                projectFace(faces[face], face, faceSums[face]);
+        };
+        if (pool)
+            pool->parallelFor(6, 1, body);
+        else
+            body(0, 6, 0);
+
+        // the clamped cosine convolved with each band, divided by pi, times the squared normalization of each basis
+        static const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        static const float normalization[9] = { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f,
+                                                0.315392f, 1.092548f, 0.546274f };
+        for (int i = 0; i < 9; i++)
+        {
+            glm::vec3 sum(0.0f);
+            for (int face = 0; face < 6; face++)
+                sum += glm::vec3(faceSums[face][i][0], faceSums[face][i][1], faceSums[face][i][2]);
+            coefficients[i] = glm::vec4(sum * band[i] * normalization[i] * normalization[i], 0.0f);
+        }
+        cached = false;
+        projectMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void printStats() const
+    {
+        if (cached)
+            printf("Sky irradiance: from %s\n", CACHE_FILE);
+        else
+            printf("Sky irradiance: projected the skybox in %.1f ms\n", projectMs);
+        fflush(stdout);
+    }
+
+private:
+    // direction of the texel at (s, t) in [-1, 1] is major + s * sAxis + t * tAxis, as GL picks the face of a
+    // direction (the first row of an image is t = -1)
+    struct Face
+    {
+        glm::vec3 major, sAxis, tAxis;
+    };
+
+    static const Face& face(int index)
+    {
+        static const Face faces[6] = {
+            { glm::vec3(1, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0) },
+            { glm::vec3(-1, 0, 0), glm::vec3(0, 0, 1), glm::vec3(0, -1, 0) },
+            { glm::vec3(0, 1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, 1) },
+            { glm::vec3(0, -1, 0), glm::vec3(1, 0, 0), glm::vec3(0, 0, -1) },
+            { glm::vec3(0, 0, 1), glm::vec3(1, 0, 0), glm::vec3(0, -1, 0) },
+            { glm::vec3(0, 0, -1), glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0) },
+        };
+        return faces[index];
+    }
+
+    // the faces are uploaded as GL_SRGB, the shaders see linear values
+    static const float* srgbToLinear()
+    {
+        static const std::vector<float> table = []() {
+            std::vector<float> values(256);
+            for (int i = 0; i < 256; i++)
+            {
+                float c = i / 255.0f;
+                values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // sums radiance * basis polynomial * solid angle over the texels of a face, per polynomial and color
+    static void projectFace(const std::string& path, int index, float sums[9][3])
+    {
+        TextureImage image(path);
+        if (!image.data)
+        {
+            std::cout << "Sky irradiance: failed to load " << path << std::endl;
+            return;
+        }
+        int width = image.width, height = image.height, nrComponents = image.nrComponents;
+        const Face& f = face(index);
+        const float* linear = srgbToLinear();
+        int green = nrComponents >= 3 ? 1 : 0, blue = nrComponents >= 3 ? 2 : 0;
+
+        for (int y = 0; y < height; y++)
+        {
+            float t = 2.0f * (y + 0.5f) / height - 1.0f;
+            const unsigned char* row = image.data + (size_t)y * width * nrComponents;
+            int x0 = 0;
+#ifdef SKY_IRRADIANCE_SSE2
+            x0 = width & ~3;
+            projectRow4(row, width, height, t, f, nrComponents, green, blue, linear, sums);
+#endif
+            for (int x = x0; x < width; x++)
+            {
+                float s = 2.0f * (x + 0.5f) / width - 1.0f;
+                glm::vec3 direction = f.major + s * f.sAxis + t * f.tAxis;
+                float inverseLength = 1.0f / std::sqrt(1.0f + s * s + t * t);
+                glm::vec3 n = direction * inverseLength;
+                // solid angle of the texel
+                float weight = 4.0f / (width * height) * inverseLength * inverseLength * inverseLength;
+                float basis[9] = { 1.0f, n.y, n.z, n.x, n.x * n.y, n.y * n.z, 3.0f * n.z * n.z - 1.0f, n.x * n.z, n.x * n.x - n.y * n.y };
+                const unsigned char* texel = row + x * nrComponents;
+                float radiance[3] = { linear[texel[0]], linear[texel[green]], linear[texel[blue]] };
+                for (int i = 0; i < 9; i++)
+                    for (int c = 0; c < 3; c++)
+                        sums[i][c] += basis[i] * weight * radiance[c];
+            }
+        }
+    }
+
+#ifdef SKY_IRRADIANCE_SSE2
+    // the loop of projectFace for four texels at a time, up to the last multiple of four
+    static void projectRow4(const unsigned char* row, int width, int height, float t, const Face& f, int nrComponents, int green, int blue,
+                            const float* linear, float sums[9][3])
+    {
+        const __m128 one = _mm_set1_ps(1.0f), three = _mm_set1_ps(3.0f);
+        const __m128 tt = _mm_set1_ps(t);
+        const __m128 texelArea = _mm_set1_ps(4.0f / (width * (float)height));
+        __m128 accumulated[9][3];
+        for (int i = 0; i < 9; i++)
+            for (int c = 0; c < 3; c++)
+                accumulated[i][c] = _mm_setzero_ps();
+
+        for (int x = 0; x + 4 <= width; x += 4)
+        {
+            __m128 s = _mm_set_ps(2.0f * (x + 3.5f) / width - 1.0f, 2.0f * (x + 2.5f) / width - 1.0f,
+                                  2.0f * (x + 1.5f) / width - 1.0f, 2.0f * (x + 0.5f) / width - 1.0f);
+            __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(s, s), _mm_mul_ps(tt, tt)))));
+            __m128 n[3];
+            for (int axis = 0; axis < 3; axis++)
+                n[axis] = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(f.major[axis] + t * f.tAxis[axis]), _mm_mul_ps(s, _mm_set1_ps(f.sAxis[axis]))),
+                                     inverseLength);
+            __m128 weight = _mm_mul_ps(texelArea, _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+            __m128 basis[9] = {
+                weight,
+                _mm_mul_ps(weight, n[1]),
+                _mm_mul_ps(weight, n[2]),
+                _mm_mul_ps(weight, n[0]),
+                _mm_mul_ps(weight, _mm_mul_ps(n[0], n[1])),
+                _mm_mul_ps(weight, _mm_mul_ps(n[1], n[2])),
+                _mm_mul_ps(weight, _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(n[2], n[2])), one)),
+                _mm_mul_ps(weight, _mm_mul_ps(n[0], n[2])),
+                _mm_mul_ps(weight, _mm_sub_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1]))),
+            };
+            const unsigned char* texel = row + x * nrComponents;
+            int channels[3] = { 0, green, blue };
+            __m128 radiance[3];
+            for (int c = 0; c < 3; c++)
+                radiance[c] = _mm_set_ps(linear[texel[3 * nrComponents + channels[c]]], linear[texel[2 * nrComponents + channels[c]]],
+                                         linear[texel[nrComponents + channels[c]]], linear[texel[channels[c]]]);
+            for (int i = 0; i < 9; i++)
+                for (int c = 0; c < 3; c++)
+                    accumulated[i][c] = _mm_add_ps(accumulated[i][c], _mm_mul_ps(basis[i], radiance[c]));
+        }
+
+        for (int i = 0; i < 9; i++)
+            for (int c = 0; c < 3; c++)
+            {
+                float lanes[4];
+                _mm_storeu_ps(lanes, accumulated[i][c]);
+                sums[i][c] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+            }
+    }
+#endif
+
+    // FNV-1a of the paths, sizes and modification times of the faces
+    static uint64_t key(const std::vector<std::string>& faces)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const void* data, size_t size) {
+            for (size_t i = 0; i < size; i++)
+            {
+                hash ^= ((const unsigned char*)data)[i];
+                hash *= 1099511628211ull;
+            }
+        };
+        for (const std::string& path : faces)
+        {
+            add(path.data(), path.size() + 1);
+            struct stat status;
+            int64_t size = -1, modified = 0;
+            if (stat(path.c_str(), &status) == 0)
+            {
+                size = (int64_t)status.st_size;
+#ifdef __linux__
+                // in nanoseconds, a face written again within the same second changes the key too
+                modified = (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+#else
+                modified = (int64_t)status.st_mtime;
+#endif
+            }
+            add(&size, sizeof(size));
+            add(&modified, sizeof(modified));
+        }
+        return hash;
+    }
+
+    static std::string cachePath(const std::vector<std::string>& faces)
+    {
+        std::string directory = faces.empty() ? "." : faces[0].substr(0, faces[0].find_last_of('/'));
+        return directory + "/" + CACHE_FILE;
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef STREAMING_BUFFER_H
+#define STREAMING_BUFFER_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <trace.h>
+
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+// glad is generated for GL 4.3, buffer storage is GL 4.4 / ARB_buffer_storage and loaded by hand
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFN_BUFFER_STORAGE)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// One buffer for the data that is written again every frame, split into REGION_COUNT regions used round robin.
+// Each frame allocates from its own region and fences it at the end, so the CPU writes frame N+1 while the
+// GPU still reads frame N, and only waits when it gets REGION_COUNT frames ahead. That wait is measured,
+// a long one means the GPU is the bottleneck.
+// With buffer storage the whole buffer stays mapped (persistent and coherent), without it every allocation
+// maps its range unsynchronized, which is safe for the same reason: the fence already guarantees the range is free.
+// The buffer is not tied to a target, bind id with whatever target the data is for.
+class StreamingBuffer
+{
+public:
+    static const int REGION_COUNT = 3;
+
+    unsigned int id = 0;
+    bool persistent = false;
+    size_t uniformAlignment = 256;   // offset alignment for binding ranges as uniform buffers
+
+    // fence waits, in milliseconds
+    float waitMs = 0.0f;        // of the current frame
+    float maxWaitMs = 0.0f;     // largest over the last second
+    int stalledFrames = 0;      // frames that found their region still in use
+
+    // allowPersistent false maps every allocation, for a GL capture (gl_capture.h) that has to see the writes
+    explicit StreamingBuffer(size_t regionSize = 1 << 20, bool allowPersistent = true)
+    {
+        bool hasStorage = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4);
+        if (allowPersistent && (hasStorage || glfwExtensionSupported("GL_ARB_buffer_storage")))
+            bufferStorage = (PFN_BUFFER_STORAGE)glfwGetProcAddress("glBufferStorage");
+        persistent = bufferStorage != nullptr;
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        uniformAlignment = std::max(alignment, 16);
+        create(regionSize);
+        lastReport = std::chrono::steady_clock::now();
+    }
+
+    ~StreamingBuffer()
+    {
+        for (int i = 0; i < REGION_COUNT; i++)
+            if (fences[i])
+                glDeleteSync(fences[i]);
+        release(retired, retiredFence);
+        glDeleteBuffers(1, &id);
+    }
+
+    // moves to the next region, waiting until the GPU is done with what was written there REGION_COUNT frames ago
+    void beginFrame()
+    {
+        region = (region + 1) % REGION_COUNT;
+        head = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        GLsync& fence = fences[region];
+        if (fence)
+        {
+            if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+                TRACE_SCOPE("Wait for frame region");
+                stalledFrames++;
+                while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+                    ;
+            }
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        auto end = std::chrono::steady_clock::now();
+        waitMs = std::chrono::duration<float, std::milli>(end - start).count();
+        windowMaxWaitMs = std::max(windowMaxWaitMs, waitMs);
+
+        // the worst wait of the last second goes to the log when it was long enough to cost a frame some time
+        if (end - lastReport > std::chrono::seconds(1))
+        {
+            maxWaitMs = windowMaxWaitMs;
+            if (maxWaitMs > 1.0f)
+                std::cout << "Streaming buffer: waited up to " << maxWaitMs << " ms for the GPU to release a frame region, "
+                          << stalledFrames << " stalled frames so far" << std::endl;
+            windowMaxWaitMs = 0.0f;
+            lastReport = end;
+        }
+
+        if (retired && glClientWaitSync(retiredFence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            release(retired, retiredFence);
+    }
+
+    // fences the region of this frame, call after the frame's last command that reads from it
+    void endFrame()
+    {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // size bytes for this frame at offset (aligned to alignment) in id, call unmap() once they are written
+    // and before the GPU reads them. Grows the buffer when the region is full
+    void* map(size_t size, size_t alignment, size_t& offset)
+    {
+        size_t start = (head + alignment - 1) / alignment * alignment;
+        if (start + size > regionSize)
+        {
+            grow(std::max(regionSize * 2, (size + alignment) * 2));
+            start = 0;
+        }
+        head = start + size;
+        offset = region * regionSize + start;
+
+        if (persistent)
+            return mapped + offset;
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        return glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    void unmap()
+    {
+        if (persistent)
+            return;
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    size_t capacity() const
+    {
+        return regionSize;
+    }
+
+private:
+    PFN_BUFFER_STORAGE bufferStorage = nullptr;
+    size_t regionSize = 0;
+    int region = 0;
+    size_t head = 0;
+    unsigned char* mapped = nullptr;
+    GLsync fences[REGION_COUNT] = {};
+
+    // the buffer before the last grow, deleted once the GPU is done with it
+    unsigned int retired = 0;
+    GLsync retiredFence = 0;
+
+    float windowMaxWaitMs = 0.0f;
+    std::chrono::steady_clock::time_point lastReport;
+
+    void create(size_t newRegionSize)
+    {
+        regionSize = newRegionSize;
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        if (persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            bufferStorage(GL_COPY_WRITE_BUFFER, regionSize * REGION_COUNT, NULL, flags);
+            mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, regionSize * REGION_COUNT, flags);
+        }
+        else
+            glBufferData(GL_COPY_WRITE_BUFFER, regionSize * REGION_COUNT, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // Replaces the buffer in the middle of a frame. What the frame already wrote stays in the old buffer,
+    // which has to live until the GPU has read it, the users bind id again every frame
+    void grow(size_t newRegionSize)
+    {
+        release(retired, retiredFence);
+        retired = id;
+        retiredFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        for (int i = 0; i < REGION_COUNT; i++)
+            if (fences[i])
+            {
+                glDeleteSync(fences[i]);
+                fences[i] = 0;
+            }
+        create(newRegionSize);
+    }
+
+    // waits until the GPU is done with the buffer and deletes it
+    static void release(unsigned int& buffer, GLsync& fence)
+    {
+        if (!buffer)
+            return;
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fence);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        fence = 0;
+    }
+};
+
+#endif
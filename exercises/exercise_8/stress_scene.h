@@ -0,0 +1,257 @@
+#ifndef STRESS_SCENE_H
+#define STRESS_SCENE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <shader.h>
+#include <command_buffer.h>
+#include <command_submitter.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <chrono>
+
+// A synthetic scene of many small spinning cubes, to measure recording draws on several threads.
+// Every frame each object gets a new model matrix, is culled against the view frustum and resolves its
+// material, all on the worker threads. The objects are split into chunks of CHUNK_SIZE, each chunk records
+// into its own command buffer, and a pass buffer in front sets the program, the state and the light.
+// Submitting the buffers in chunk order makes the frame independent of how the chunks were scheduled.
+class StressScene
+{
+public:
+    static const int CHUNK_SIZE = 256;
+    static const unsigned int OBJECT_BINDING = 1;   // uniform block bindings, 0 is the camera
+    static const unsigned int PASS_BINDING = 2;
+
+    Shader* shader;
+
+    // of the last record and submit
+    int visibleObjects = 0;
+    float recordMs = 0.0f;
+    float submitMs = 0.0f;
+
+    StressScene(uint32_t uniformAlignment) : uniformAlignment(uniformAlignment)
+    {
+        shader = new Shader("shaders/stress_object.vert", "shaders/stress_object.frag");
+        shader->bindUniformBlock("Object", OBJECT_BINDING);
+        shader->bindUniformBlock("StressPass", PASS_BINDING);
+        createCube();
+    }
+
+    ~StressScene()
+    {
+        glDeleteVertexArrays(1, &cubeVAO);
+        glDeleteBuffers(1, &cubeVBO);
+        glDeleteBuffers(1, &cubeEBO);
+        delete shader;
+    }
+
+    // lays the objects out on a square grid above the scene, the same way for the same count
+    void setCount(int count)
+    {
+        objects.resize(count);
+        int side = (int)ceil(sqrt((float)count));
+        unsigned int seed = 12345u;
+        auto random = [&seed]() {
+            seed = seed * 1664525u + 1013904223u;
+            return (seed >> 8) / 16777216.0f;
+        };
+        for (int i = 0; i < count; i++)
+        {
+            Object& object = objects[i];
+            object.position = glm::vec3(((i % side) - side * 0.5f) * 0.5f, 3.5f + random() * 2.0f, ((i / side) - side * 0.5f) * 0.5f);
+            object.scale = 0.08f + random() * 0.08f;
+            object.axis = glm::normalize(glm::vec3(random() - 0.5f, random() - 0.5f, random() - 0.5f) + glm::vec3(0.0f, 0.01f, 0.0f));
+            object.spinSpeed = 0.5f + random() * 2.0f;
+            object.material = (int)(random() * MATERIAL_COUNT) % MATERIAL_COUNT;
+        }
+
+        int chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        buffers.resize(chunks + 1, CommandBuffer(uniformAlignment));
+        chunkVisible.resize(chunks);
+        bufferPointers.resize(chunks + 1);
+        for (size_t i = 0; i < buffers.size(); i++)
+            bufferPointers[i] = &buffers[i];
+    }
+
+    int count() const
+    {
+        return (int)objects.size();
+    }
+
+    // records the pass and all chunks, spread over the pool when there is one
+    void record(const glm::mat4& viewProjection, float time, const glm::vec3& lightDirection, const glm::vec3& lightColor,
+                const glm::vec3& ambientColor, ThreadPool* pool)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        PassBlock pass;
+        pass.lightDirection = glm::vec4(glm::normalize(lightDirection), 0.0f);
+        pass.lightColor = glm::vec4(lightColor, 0.0f);
+        pass.ambientColor = glm::vec4(ambientColor, 0.0f);
+        CommandBuffer& passBuffer = buffers[0];
+        passBuffer.reset();
+        passBuffer.bindProgram(shader->ID);
+        passBuffer.setState(CommandBuffer::State());
+        passBuffer.setUniformBlock(PASS_BINDING, &pass, sizeof(pass));
+
+        glm::vec4 planes[6];
+        frustumPlanes(viewProjection, planes);
+        auto recordChunk = [&](int begin, int end, int) {
+            int chunk = begin / CHUNK_SIZE;
+            CommandBuffer& buffer = buffers[chunk + 1];
+            buffer.reset();
+            buffer.bindVertexArray(cubeVAO);
+            int visible = 0;
+            for (int i = begin; i < end; i++)
+            {
+                const Object& object = objects[i];
+                if (!insideFrustum(planes, object.position, object.scale * 1.7320508f))
+                    continue;
+                ObjectBlock block;
+                block.model = glm::translate(glm::mat4(1.0f), object.position);
+                block.model = glm::rotate(block.model, time * object.spinSpeed, object.axis);
+                block.model = glm::scale(block.model, glm::vec3(object.scale));
+                block.color = materialColor(object.material);
+                buffer.setUniformBlock(OBJECT_BINDING, &block, sizeof(block));
+                buffer.drawIndexed(CommandBuffer::TRIANGLES, 36);
+                visible++;
+            }
+            chunkVisible[chunk] = visible;
+        };
+        if (pool)
+            pool->parallelFor(count(), CHUNK_SIZE, recordChunk);
+        else
+            for (int begin = 0; begin < count(); begin += CHUNK_SIZE)
+                recordChunk(begin, std::min(begin + CHUNK_SIZE, count()), 0);
+
+        visibleObjects = 0;
+        for (int visible : chunkVisible)
+            visibleObjects += visible;
+        recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    void submit(CommandSubmitter& submitter)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        submitter.submit(&bufferPointers[0], (int)bufferPointers.size());
+        submitMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // the pass buffer first, then one per chunk
+    const std::vector<CommandBuffer>& recorded() const
+    {
+        return buffers;
+    }
+
+private:
+    static const int MATERIAL_COUNT = 8;
+
+    struct Object
+    {
+        glm::vec3 position;
+        float scale;
+        glm::vec3 axis;
+        float spinSpeed;
+        int material;
+    };
+
+    // std140 layouts of the blocks in stress_object.vert and stress_object.frag
+    struct ObjectBlock
+    {
+        glm::mat4 model;
+        glm::vec4 color;
+    };
+    struct PassBlock
+    {
+        glm::vec4 lightDirection;
+        glm::vec4 lightColor;
+        glm::vec4 ambientColor;
+    };
+
+    uint32_t uniformAlignment;
+    std::vector<Object> objects;
+    std::vector<CommandBuffer> buffers;
+    std::vector<const CommandBuffer*> bufferPointers;
+    std::vector<int> chunkVisible;
+    unsigned int cubeVAO, cubeVBO, cubeEBO;
+
+    static glm::vec4 materialColor(int material)
+    {
+        static const glm::vec4 colors[MATERIAL_COUNT] = {
+            { 0.8f, 0.1f, 0.1f, 1.0f }, { 0.1f, 0.6f, 0.1f, 1.0f }, { 0.1f, 0.2f, 0.8f, 1.0f }, { 0.8f, 0.7f, 0.1f, 1.0f },
+            { 0.6f, 0.1f, 0.7f, 1.0f }, { 0.1f, 0.7f, 0.7f, 1.0f }, { 0.9f, 0.4f, 0.1f, 1.0f }, { 0.7f, 0.7f, 0.7f, 1.0f } };
+        return colors[material];
+    }
+
+    // the six planes of the view projection, normalized and pointing inwards
+    static void frustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        planes[0] = row3 + row0;
+        planes[1] = row3 - row0;
+        planes[2] = row3 + row1;
+        planes[3] = row3 - row1;
+        planes[4] = row3 + row2;
+        planes[5] = row3 - row2;
+        for (int i = 0; i < 6; i++)
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
+
+    static bool insideFrustum(const glm::vec4 planes[6], const glm::vec3& center, float radius)
+    {
+        for (int i = 0; i < 6; i++)
+            if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+                return false;
+        return true;
+    }
+
+    // unit cube from -1 to 1 with flat normals, positions at location 0 and normals at location 1
+    void createCube()
+    {
+        std::vector<float> vertices;
+        std::vector<unsigned int> indices;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int sign = -1; sign <= 1; sign += 2)
+            {
+                glm::vec3 normal(0.0f);
+                normal[axis] = (float)sign;
+                glm::vec3 u(0.0f), v(0.0f);
+                u[(axis + 1) % 3] = 1.0f;
+                v[(axis + 2) % 3] = 1.0f;
+                if (sign < 0)
+                    std::swap(u, v);    // keep the winding counter clockwise seen from outside
+                unsigned int base = (unsigned int)vertices.size() / 6;
+                glm::vec3 corners[4] = { normal - u - v, normal + u - v, normal + u + v, normal - u + v };
+                for (const glm::vec3& corner : corners)
+                {
+                    vertices.insert(vertices.end(), { corner.x, corner.y, corner.z });
+                    vertices.insert(vertices.end(), { normal.x, normal.y, normal.z });
+                }
+                indices.insert(indices.end(), { base, base + 1, base + 2, base, base + 2, base + 3 });
+            }
+        }
+
+        glGenVertexArrays(1, &cubeVAO);
+        glGenBuffers(1, &cubeVBO);
+        glGenBuffers(1, &cubeEBO);
+        glBindVertexArray(cubeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glBindVertexArray(0);
+    }
+};
+
+#endif
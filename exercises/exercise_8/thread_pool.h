@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+#include <trace.h>
+
+// A fixed set of worker threads for splitting per-frame loops into chunks.
+// parallelFor hands out chunks through an atomic counter, the calling thread works on them too
+// and returns once all of them are done. Only one parallelFor runs at a time.
+class ThreadPool
+{
+public:
+    // threadCount includes the calling thread, 0 uses one thread per hardware thread
+    explicit ThreadPool(int threadCount = 0)
+    {
+        if (threadCount <= 0)
+            threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+        for (int i = 1; i < threadCount; i++)
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    int size() const
+    {
+        return (int)workers.size() + 1;
+    }
+
+    // calls body(begin, end, thread) for consecutive ranges of at most chunkSize out of [0, count).
+    // thread is in [0, size()) and can index per thread scratch data
+    void parallelFor(int count, int chunkSize, const std::function<void(int, int, int)>& body)
+    {
+        if (count <= 0)
+            return;
+        int chunks = (count + chunkSize - 1) / chunkSize;
+        if (chunks == 1 || workers.empty())
+        {
+            for (int begin = 0; begin < count; begin += chunkSize)
+                body(begin, std::min(begin + chunkSize, count), 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &body;
+            jobCount = count;
+            jobChunkSize = chunkSize;
+            nextChunk = 0;
+            busyWorkers = (int)workers.size();
+            generation++;
+        }
+        wake.notify_all();
+
+        runChunks(0);
+
+        TRACE_SCOPE("Wait for workers");
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+        job = nullptr;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    bool stopping = false;
+    unsigned int generation = 0;
+
+    const std::function<void(int, int, int)>* job = nullptr;
+    int jobCount = 0, jobChunkSize = 1;
+    std::atomic<int> nextChunk{0};
+    int busyWorkers = 0;
+
+    void runChunks(int thread)
+    {
+        TRACE_SCOPE("Parallel for");
+        for (;;)
+        {
+            int begin = nextChunk.fetch_add(1) * jobChunkSize;
+            if (begin >= jobCount)
+                return;
+            (*job)(begin, std::min(begin + jobChunkSize, jobCount), thread);
+        }
+    }
+
+    void workerLoop(int thread)
+    {
+        TRACE_THREAD_NAME("Worker %d", thread);
+        unsigned int seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            runChunks(thread);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0)
+                done.notify_one();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// CPU scopes of all threads, written as Chrome trace event JSON (open it in chrome://tracing or ui.perfetto.dev).
+// Only built with the RAINY_DAY_TRACE option of CMake, without it every macro below expands to nothing and
+// none of this is compiled in.
+//
+//   TRACE_SCOPE("name")          times the rest of the enclosing block
+//   TRACE_NOW() / TRACE_EVENT    for spans that do not fit a block: start = TRACE_NOW(), later TRACE_EVENT("name", start)
+//   TRACE_THREAD_NAME("Worker %d", i)   how the calling thread is labelled in the trace, printf style
+//   TRACE_START() / TRACE_STOP("file.json")   a capture window, TRACE_STOP writes it
+//
+// Names have to be string literals, events only keep the pointer.
+// Each thread records into its own ring buffer, so recording never locks or shares a cache line with another
+// thread. Buffers are found through a list that only grows, the writer publishes an event by bumping its count
+// and the collecting thread reads up to that count, so collecting does not stop the writers either.
+// Recording is on from the start of the process until the startup trace is written, and after that only
+// while a capture runs (Trace::start() to Trace::stop()).
+
+#include <cstdint>
+
+#ifdef RAINY_DAY_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdarg>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+class Trace
+{
+public:
+    // per thread, a capture keeps at most this many of the last events of each thread
+    static const int CAPACITY = 1 << 16;
+
+    // nanoseconds since the trace clock started
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - state().epoch).count();
+    }
+
+    static bool recording()
+    {
+        return state().recording.load(std::memory_order_relaxed);
+    }
+
+    static void record(const char* name, int64_t start, int64_t end)
+    {
+        ThreadBuffer* buffer = threadBuffer();
+        uint64_t index = buffer->written.load(std::memory_order_relaxed);
+        Event& event = buffer->events[index % CAPACITY];
+        event.name = name;
+        event.start = start;
+        event.end = end;
+        buffer->written.store(index + 1, std::memory_order_release);
+    }
+
+    static void setThreadName(const char* format, ...)
+    {
+        ThreadBuffer* buffer = threadBuffer();
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buffer->name, sizeof(buffer->name), format, args);
+        va_end(args);
+    }
+
+    // starts recording the events from now on
+    static void start()
+    {
+        State& trace = state();
+        trace.captureStart = now();
+        trace.recording = true;
+    }
+
+    // stops recording and writes what was recorded since start(), or since the process started the first time
+    static bool stop(const char* path)
+    {
+        State& trace = state();
+        trace.recording = false;
+        int64_t captureStart = trace.captureStart;
+
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            std::cout << "Trace: could not write " << path << std::endl;
+            return false;
+        }
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Rainy day\"}}");
+
+        int eventCount = 0, wrappedThreads = 0;
+        std::vector<Event> events;
+        for (ThreadBuffer* buffer = trace.buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+        {
+            // a thread that is still inside a scope may write one more event after recording stopped, into the
+            // slot of the oldest one, so the oldest few of a full buffer are left out
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t first = written > CAPACITY ? written - CAPACITY + 64 : 0;
+            events.clear();
+            for (uint64_t i = first; i < written; i++)
+            {
+                const Event& event = buffer->events[i % CAPACITY];
+                if (event.start >= captureStart)
+                    events.push_back(event);
+            }
+            if (events.empty())
+                continue;
+            if (first > 0 && buffer->events[first % CAPACITY].start >= captureStart)
+                wrappedThreads++;
+
+            // parents before their children when they start at the same time, scopes are recorded when they end
+            std::sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+                return a.start != b.start ? a.start < b.start : a.end > b.end;
+            });
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    buffer->id, buffer->name);
+            for (const Event& event : events)
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                        event.name, buffer->id, event.start / 1000.0, (event.end - event.start) / 1000.0);
+            eventCount += (int)events.size();
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        std::cout << "Trace: wrote " << eventCount << " events to " << path << std::endl;
+        if (wrappedThreads)
+            std::cout << "Trace: " << wrappedThreads << " threads recorded more than " << (int)CAPACITY
+                      << " events, only their last ones are in the trace" << std::endl;
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Event
+    {
+        const char* name;
+        int64_t start, end;
+    };
+
+    struct ThreadBuffer
+    {
+        Event events[CAPACITY];
+        std::atomic<uint64_t> written{0};
+        std::atomic<bool> inUse{true};
+        int id = 0;
+        char name[32] = {};
+        ThreadBuffer* next = nullptr;
+    };
+
+    struct State
+    {
+        Clock::time_point epoch = Clock::now();
+        std::atomic<bool> recording{true};
+        int64_t captureStart = 0;
+        std::atomic<ThreadBuffer*> buffers{nullptr};
+        std::atomic<int> threadCount{0};
+    };
+
+    // hands the buffer back when its thread ends, so threads that come and go reuse the same few buffers
+    struct ThreadBufferOwner
+    {
+        ThreadBuffer* buffer = nullptr;
+        ~ThreadBufferOwner()
+        {
+            if (buffer)
+                buffer->inUse.store(false, std::memory_order_release);
+        }
+    };
+
+    static State& state()
+    {
+        static State trace;
+        return trace;
+    }
+
+    static ThreadBuffer* threadBuffer()
+    {
+        static thread_local ThreadBufferOwner owner;
+        if (!owner.buffer)
+            owner.buffer = claimBuffer();
+        return owner.buffer;
+    }
+
+    static ThreadBuffer* claimBuffer()
+    {
+        State& trace = state();
+        for (ThreadBuffer* buffer = trace.buffers.load(std::memory_order_acquire); buffer; buffer = buffer->next)
+        {
+            bool expected = false;
+            if (buffer->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return buffer;
+        }
+
+        ThreadBuffer* buffer = new ThreadBuffer();
+        buffer->id = trace.threadCount++;
+        snprintf(buffer->name, sizeof(buffer->name), "Thread %d", buffer->id);
+        ThreadBuffer* head = trace.buffers.load(std::memory_order_relaxed);
+        do
+            buffer->next = head;
+        while (!trace.buffers.compare_exchange_weak(head, buffer, std::memory_order_release, std::memory_order_relaxed));
+        return buffer;
+    }
+};
+
+// records the time from its construction to the end of the block, if recording was on when it started
+class TraceScope
+{
+public:
+    explicit TraceScope(const char* name) : name(name), start(Trace::recording() ? Trace::now() : -1)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (start >= 0 && Trace::recording())
+            Trace::record(name, start, Trace::now());
+    }
+
+private:
+    const char* name;
+    int64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_NOW() (Trace::recording() ? Trace::now() : (int64_t)-1)
+#define TRACE_EVENT(name, start) \
+    do { int64_t traceStart_ = (start); if (traceStart_ >= 0 && Trace::recording()) Trace::record(name, traceStart_, Trace::now()); } while (0)
+#define TRACE_THREAD_NAME(...) Trace::setThreadName(__VA_ARGS__)
+#define TRACE_START() Trace::start()
+#define TRACE_STOP(path) Trace::stop(path)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_NOW() ((int64_t)-1)
+#define TRACE_EVENT(name, start) ((void)(start))
+#define TRACE_THREAD_NAME(...) ((void)0)
+#define TRACE_START() ((void)0)
+#define TRACE_STOP(path) ((void)(path))
+
+#endif
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef VALIDATION_H
+#define VALIDATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <wetness.h>
+#include <cpu_rain.h>
+#include <thread_pool.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+// What --validate runs: the CPU code that otherwise is only checked from the settings panel, on a synthetic scene and
+// without a GL context, so it can run on a machine without a GPU. Prints what it compared and returns false when
+// something does not match:
+//   - WetnessVolume::bakeReference against what is known to be covered
+//   - the SIMD kernel of CpuRain, on all threads, against the scalar one
+//
+// The scene is a rain map looking straight down on flat ground with a raised roof, so what is covered is known
+// without rendering anything.
+class Validation
+{
+public:
+    static bool run()
+    {
+        Scene scene;
+        bool passed = wetnessBake(scene);
+        passed &= cpuRain(scene);
+        std::cout << "Validation: " << (passed ? "passed" : "FAILED") << std::endl;
+        return passed;
+    }
+
+    // Prints how many drops of one list have no counterpart in the other within a small tolerance, and the
+    // largest distance of those that do. The GPU appends in any order, so the lists are matched by position.
+    // A drop right on the edge of a test can flip between the two, a handful of those is expected. Returns the drops
+    // without a match
+    static size_t compareDrops(const char* name, const std::vector<glm::vec4>& drops, std::vector<glm::vec4> reference)
+    {
+        const float tolerance = 1e-3f;
+        std::sort(reference.begin(), reference.end(), [](const glm::vec4& l, const glm::vec4& r) { return l.x < r.x; });
+        size_t unmatched = 0;
+        float maxError = 0.0f;
+        for (const glm::vec4& drop : drops)
+        {
+            auto first = std::lower_bound(reference.begin(), reference.end(), drop.x - tolerance,
+                                          [](const glm::vec4& l, float x) { return l.x < x; });
+            float closest = tolerance;
+            bool found = false;
+            for (auto it = first; it != reference.end() && it->x <= drop.x + tolerance; ++it)
+            {
+                float error = glm::length(*it - drop);
+                if (error <= closest)
+                {
+                    closest = error;
+                    found = true;
+                }
+            }
+            if (found)
+                maxError = std::max(maxError, closest);
+            else
+                unmatched++;
+        }
+        std::cout << "  " << name << ": " << drops.size() << " CPU, " << reference.size() << " reference, "
+                  << unmatched << " without a match, max distance " << maxError << std::endl;
+        return unmatched;
+    }
+
+private:
+    struct Scene
+    {
+        static const int RAIN_MAP_SIZE = 512;
+        glm::mat4 rainSpaceMatrix;
+        std::vector<float> rainDepth;    // row by row starting at the bottom, like glGetTexImage returns it
+
+        // the same projection as drawRainMap in main.cpp, with the rain falling straight down
+        Scene()
+        {
+            float near_plane = 0.5f, depthRange = 10.0f, half = 12.5f;
+            glm::mat4 projection = glm::ortho(-half, half, -half, half, near_plane, near_plane + depthRange);
+            glm::mat4 view = glm::lookAt(glm::vec3(0.0f, depthRange * 0.5f, 0.0f), glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+            rainSpaceMatrix = projection * view;
+
+            glm::mat4 inverse = glm::inverse(rainSpaceMatrix);
+            rainDepth.resize(RAIN_MAP_SIZE * RAIN_MAP_SIZE);
+            for (int y = 0; y < RAIN_MAP_SIZE; y++)
+                for (int x = 0; x < RAIN_MAP_SIZE; x++)
+                {
+                    glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / (float)RAIN_MAP_SIZE * 2.0f - 1.0f;
+                    glm::vec4 world = inverse * glm::vec4(ndc, 0.0f, 1.0f);
+                    world.y = height(world.x, world.z);
+                    glm::vec4 rainSpace = rainSpaceMatrix * world;
+                    rainDepth[(size_t)y * RAIN_MAP_SIZE + x] = rainSpace.z / rainSpace.w * 0.5f + 0.5f;
+                }
+        }
+
+        // ground at 0, a roof at 3 off the middle, so a flipped axis shows
+        static float height(float x, float z)
+        {
+            return x > -2.0f && x < 6.0f && z > -5.0f && z < 1.0f ? 3.0f : 0.0f;
+        }
+    };
+
+    // WetnessVolume::bakeReference: a voxel above everything around it is fully exposed, one below everything
+    // around it is dry. Voxels near the edge of the roof or within the depth bias of a surface are left out
+    static bool wetnessBake(const Scene& scene)
+    {
+        const glm::ivec3 resolution(128, 16, 128);
+        const glm::vec3 boundsMin(-12.5f, -0.5f, -12.5f), boundsSize(25.0f, 8.0f, 25.0f);
+        const int kernelRadius = 1;
+        const float bias = 0.005f, maxWetness = 10.0f / 15.0f;
+        std::vector<float> baked;
+        WetnessVolume::bakeReference(scene.rainDepth, Scene::RAIN_MAP_SIZE, Scene::RAIN_MAP_SIZE, scene.rainSpaceMatrix,
+                                     resolution, boundsMin, boundsSize, kernelRadius, bias, maxWetness, baked);
+
+        float reach = (kernelRadius + 2) * 25.0f / Scene::RAIN_MAP_SIZE;    // of the bilinear taps, in world units
+        float margin = 2.0f * bias * 10.0f;                                 // the bias, in world units
+        size_t checked = 0, mismatches = 0;
+        size_t i = 0;
+        for (int y = 0; y < resolution.y; y++)
+            for (int z = 0; z < resolution.z; z++)
+                for (int x = 0; x < resolution.x; x++, i++)
+                {
+                    glm::vec3 p = boundsMin + (glm::vec3(x, y, z) + 0.5f) / glm::vec3(resolution) * boundsSize;
+                    // the roof is larger than the taps reach, so one of the corners is on it when any tap is
+                    float lowest = Scene::height(p.x, p.z), highest = lowest;
+                    for (glm::vec2 corner : { glm::vec2(-reach, -reach), glm::vec2(reach, -reach), glm::vec2(-reach, reach), glm::vec2(reach, reach) })
+                    {
+                        lowest = std::min(lowest, Scene::height(p.x + corner.x, p.z + corner.y));
+                        highest = std::max(highest, Scene::height(p.x + corner.x, p.z + corner.y));
+                    }
+                    float expected;
+                    if (p.y > highest + margin)
+                        expected = maxWetness;
+                    else if (p.y < lowest - margin)
+                        expected = 0.0f;
+                    else
+                        continue;
+                    checked++;
+                    if (std::abs(baked[i] - expected) > 1e-5f)
+                        mismatches++;
+                }
+        std::cout << "Wetness bake reference: " << checked << " of " << baked.size() << " voxels checked, "
+                  << mismatches << " wrong" << std::endl;
+        return checked > 0 && mismatches == 0;
+    }
+
+    static size_t difference(size_t a, size_t b)
+    {
+        return a > b ? a - b : b - a;
+    }
+
+    // both kernels at a moment where the drops cover the roof, the ground and the edge of the rain box. The SIMD one
+    // may only differ on drops right on the edge of a test, one in 10000 of them at most
+    static bool cpuRain(const Scene& scene)
+    {
+        CpuRain rain;
+        rain.setRainMap(scene.rainDepth, Scene::RAIN_MAP_SIZE, Scene::RAIN_MAP_SIZE, scene.rainSpaceMatrix);
+        rain.setCount(500000);
+        CpuRain::Params params;
+        params.currentTime = 7.3f;
+        params.boxSize = 30.0f;
+        params.cameraPosition = glm::vec3(1.0f, 1.7f, 9.0f);
+        params.forward = glm::vec3(2.0f, 0.0f, -0.01f);
+        params.velocity = glm::vec3(-1.0f, -9.82f, 0.0f);
+        params.nearFieldFadeStart = params.boxSize * 0.35f;
+        params.nearFieldFadeEnd = params.boxSize * 0.5f;
+        params.splashSpeed = 0.5f;
+        params.splashQuadSize = 0.05f;
+        params.viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f) *
+                                glm::lookAt(params.cameraPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        rain.simd = false;
+        rain.update(params);
+        std::vector<glm::vec4> referenceStreaks = rain.streaks, referenceSplashes = rain.splashes;
+        ThreadPool pool;
+        rain.simd = true;
+        rain.update(params, &pool);
+        std::cout << "CPU rain: SIMD kernel on " << pool.size() << " threads against the scalar one" << std::endl;
+        size_t allowed = rain.count() / 10000;
+        // matched one way, drops missing from the SIMD lists show in the counts
+        size_t streaks = compareDrops("streaks", rain.streaks, referenceStreaks) + difference(rain.streaks.size(), referenceStreaks.size());
+        size_t splashes = compareDrops("splashes", rain.splashes, referenceSplashes) + difference(rain.splashes.size(), referenceSplashes.size());
+        return !referenceStreaks.empty() && !referenceSplashes.empty() && streaks <= allowed && splashes <= allowed;
+    }
+};
+
+#endif
@@ -0,0 +1,189 @@
+#ifndef WETNESS_H
+#define WETNESS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <shader.h>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Bakes how exposed the static scene is to the rain into a world-space volume texture.
+// The rain map only changes when the rain direction changes, so instead of projecting every shaded
+// fragment into rain space and taking 10 rain map samples, we evaluate that exposure once per voxel
+// and let the surface shaders read it back with a single trilinear fetch.
+// The volume is sliced along world Y, so a texel is addressed as (x, z, y).
+class WetnessVolume
+{
+public:
+    unsigned int texture;
+    glm::ivec3 resolution;    // voxels along world x, y, z
+    glm::vec3 boundsMin;
+    glm::vec3 boundsSize;
+
+    // bake settings
+    int kernelRadius = 1;         // PCF radius in rain map texels, 1 gives the same 3x3 kernel used per fragment before
+    float bias = 0.005f;          // depth bias in rain map depth units
+    float maxWetness = 10.0f / 15.0f; // the per-fragment version summed 10 taps and divided by 15
+
+    // constructor, allocates the volume and the objects needed to bake it on the GPU
+    WetnessVolume(glm::ivec3 resolution, glm::vec3 boundsMin, glm::vec3 boundsMax)
+        : resolution(resolution), boundsMin(boundsMin), boundsSize(boundsMax - boundsMin)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, resolution.x, resolution.z, resolution.y, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        // outside of the volume nothing is covering the surface, so it is fully exposed to the rain
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { maxWetness, maxWetness, maxWetness, maxWetness };
+        glTexParameterfv(GL_TEXTURE_3D, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        glGenFramebuffers(1, &FBO);
+        // the bake draws a full screen triangle generated from gl_VertexID, but core profile still needs a VAO bound
+        glGenVertexArrays(1, &emptyVAO);
+
+        bakeShader = new Shader("shaders/wetness_bake.vert", "shaders/wetness_bake.frag");
+    }
+
+    ~WetnessVolume()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteVertexArrays(1, &emptyVAO);
+        delete bakeShader;
+    }
+
+    // size of a voxel in world units, used to push the lookup off the surface
+    glm::vec3 voxelSize() const
+    {
+        return boundsSize / glm::vec3(resolution);
+    }
+
+    // whether the bake program is linked (shader_compiler.h)
+    bool ready()
+    {
+        return bakeShader->ready();
+    }
+
+    // evaluates the rain exposure of every voxel from the rain map.
+    // blend is the weight of the new bake, 1 replaces the volume and smaller values
+    // accumulate over several frames so surfaces dry and get wet smoothly
+    void bake(unsigned int rainMap, const glm::mat4 &rainSpaceMatrix, float blend = 1.0f)
+    {
+        int viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        GLboolean blendEnabled = glIsEnabled(GL_BLEND);
+
+        glDisable(GL_DEPTH_TEST);
+        if (blend < 1.0f)
+        {
+            glEnable(GL_BLEND);
+            glBlendColor(0.0f, 0.0f, 0.0f, blend);
+            glBlendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+        }
+        else
+            glDisable(GL_BLEND);
+
+        bakeShader->use();
+        bakeShader->setMat4("rainSpaceMatrix", rainSpaceMatrix);
+        bakeShader->setVec3("boundsMin", boundsMin);
+        bakeShader->setVec3("boundsSize", boundsSize);
+        bakeShader->setInt("kernelRadius", kernelRadius);
+        bakeShader->setFloat("bias", bias);
+        bakeShader->setFloat("maxWetness", maxWetness);
+        bakeShader->setInt("rainMap", 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, rainMap);
+
+        glViewport(0, 0, resolution.x, resolution.z);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glBindVertexArray(emptyVAO);
+        for (int y = 0; y < resolution.y; y++)
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0, y);
+            bakeShader->setFloat("sliceY", (y + 0.5f) / resolution.y);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glBlendFunc(GL_ONE, GL_ZERO);
+        if (blendEnabled) glEnable(GL_BLEND); else glDisable(GL_BLEND);
+        if (depthTest) glEnable(GL_DEPTH_TEST);
+    }
+
+    // CPU reference of the bake in shaders/wetness_bake.frag, so the result can be checked without a GL context.
+    // rainDepth holds the rain map depth values, row by row starting at the bottom, as glGetTexImage returns them.
+    // The output has one value in [0, 1] per voxel, laid out like the volume texture (x fastest, then z, then y).
+    static void bakeReference(const std::vector<float> &rainDepth, int rainWidth, int rainHeight,
+                              const glm::mat4 &rainSpaceMatrix, glm::ivec3 resolution,
+                              glm::vec3 boundsMin, glm::vec3 boundsSize,
+                              int kernelRadius, float bias, float maxWetness,
+                              std::vector<float> &out)
+    {
+        out.resize((size_t)resolution.x * resolution.y * resolution.z);
+        size_t i = 0;
+        for (int y = 0; y < resolution.y; y++)
+            for (int z = 0; z < resolution.z; z++)
+                for (int x = 0; x < resolution.x; x++)
+                {
+                    glm::vec3 uvw = (glm::vec3(x, y, z) + 0.5f) / glm::vec3(resolution);
+                    glm::vec4 rainSpace = rainSpaceMatrix * glm::vec4(boundsMin + uvw * boundsSize, 1.0f);
+                    glm::vec3 projCoords = glm::vec3(rainSpace) / rainSpace.w * 0.5f + 0.5f;
+                    float currentDepth = glm::clamp(projCoords.z, -1.0f, 1.0f);
+
+                    // same weighting as the shader, the center tap counts twice
+                    float exposure = sampleExposure(rainDepth, rainWidth, rainHeight, projCoords.x, projCoords.y, currentDepth, bias);
+                    float taps = 1.0f;
+                    for (int dx = -kernelRadius; dx <= kernelRadius; dx++)
+                        for (int dy = -kernelRadius; dy <= kernelRadius; dy++)
+                        {
+                            exposure += sampleExposure(rainDepth, rainWidth, rainHeight,
+                                                       projCoords.x + dx / (float)rainWidth,
+                                                       projCoords.y + dy / (float)rainHeight,
+                                                       currentDepth, bias);
+                            taps += 1.0f;
+                        }
+
+                    out[i++] = exposure / taps * maxWetness;
+                }
+    }
+
+private:
+    unsigned int FBO;
+    unsigned int emptyVAO;
+    Shader* bakeShader;
+
+    // bilinear depth lookup with a white border, like the GL_LINEAR / GL_CLAMP_TO_BORDER rain map
+    static float fetchDepth(const std::vector<float> &depth, int width, int height, int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+            return 1.0f;
+        return depth[(size_t)y * width + x];
+    }
+
+    static float sampleExposure(const std::vector<float> &depth, int width, int height, float u, float v, float currentDepth, float bias)
+    {
+        float fx = u * width - 0.5f;
+        float fy = v * height - 0.5f;
+        int x0 = (int)std::floor(fx);
+        int y0 = (int)std::floor(fy);
+        float tx = fx - x0;
+        float ty = fy - y0;
+        float closestDepth = glm::mix(glm::mix(fetchDepth(depth, width, height, x0, y0), fetchDepth(depth, width, height, x0 + 1, y0), tx),
+                                      glm::mix(fetchDepth(depth, width, height, x0, y0 + 1), fetchDepth(depth, width, height, x0 + 1, y0 + 1), tx),
+                                      ty);
+        return currentDepth - bias > closestDepth ? 0.0f : 1.0f;
+    }
+};
+
+#endif